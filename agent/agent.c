@@ -0,0 +1,704 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Agent library, once injected in a process ( androswat --agent ) it shares
+ * a memory ring with androswat and serves reads and change notifications
+ * from inside the process, without ptrace stops.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <android/log.h>
+
+#include "agent_protocol.h"
+
+#ifndef __NR_memfd_create
+#define __NR_memfd_create 385
+#endif
+#define MFD_CLOEXEC_ 1
+
+#define LOG(...) __android_log_print( ANDROID_LOG_INFO, "ANDROSWAT", __VA_ARGS__ )
+
+#define MAX_MAPS 4096
+#define PAGE_SIZE_ 4096
+// how often the readable mappings are refreshed, in ns
+#define MAPS_TTL 100000000ULL
+// longest context returned with a search match
+#define AGENT_MAX_CONTEXT 4096
+// ring_push retries, 100us each
+#define RING_WAIT 10000
+
+typedef struct {
+  uintptr_t begin;
+  uintptr_t end;
+}
+range_t;
+
+typedef struct {
+  const unsigned char *bytes;
+  uint32_t             length;
+}
+pattern_t;
+
+typedef struct {
+  uintptr_t begin;
+  // matches must start before end, but may extend up to limit
+  uintptr_t end;
+  uintptr_t limit;
+}
+chunk_t;
+
+typedef struct {
+  uint32_t          id;
+  uint32_t          context;
+  pattern_t         patterns[AGENT_MAX_PATTERNS];
+  uint32_t          npatterns;
+  // our copy of the patterns, in the heap we search
+  const unsigned char *copy;
+  uint32_t          copy_size;
+  chunk_t          *chunks;
+  uint32_t          nchunks;
+  volatile uint32_t next;
+  volatile uint64_t scanned;
+  volatile uint32_t matches;
+}
+search_t;
+
+typedef struct {
+  uint32_t  id;
+  uintptr_t address;
+  size_t    size;
+  size_t    block;
+  uint64_t  period;
+  uint64_t  next;
+  uint64_t *hashes;
+}
+watch_t;
+
+static int             __fd     = -1;
+static unsigned char  *__shm    = NULL;
+static agent_header_t *__header = NULL;
+static unsigned char  *__input  = NULL;
+static unsigned char  *__ring   = NULL;
+// search threads push records concurrently
+static pthread_mutex_t __ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static range_t         __maps[MAX_MAPS];
+static size_t          __nmaps  = 0;
+static uint64_t        __maps_time = 0;
+static watch_t         __watches[AGENT_MAX_WATCHES];
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void refresh_maps() {
+  FILE *fp = fopen( "/proc/self/maps", "rt" );
+  char line[1024];
+
+  __nmaps = 0;
+  __maps_time = now_ns();
+  if( !fp ){
+    return;
+  }
+
+  while( fgets( line, sizeof(line), fp ) && __nmaps < MAX_MAPS ){
+    unsigned long begin = 0, end = 0;
+    unsigned long long offset = 0, inode = 0;
+    char perms[5] = {0}, *path = NULL;
+    int n = 0;
+    struct stat st;
+
+    if( sscanf( line, "%lx-%lx %4s %llx %*s %llu %n", &begin, &end, perms, &offset, &inode, &n ) < 5 || perms[0] != 'r' ){
+      continue;
+    }
+
+    path = line + n;
+    path[ strcspn( path, "\n" ) ] = 0x00;
+
+    // pages of a file mapping past the end of the file raise SIGBUS, in
+    // here that would kill the process
+    if( inode && path[0] == '/' && stat( path, &st ) == 0 && S_ISREG(st.st_mode) && (unsigned long long)st.st_ino == inode ){
+      unsigned long long size = (unsigned long long)st.st_size > offset ? st.st_size - offset : 0;
+
+      size = ( size + PAGE_SIZE_ - 1 ) & ~( PAGE_SIZE_ - 1ULL );
+      if( size < end - begin ){
+        end = begin + size;
+      }
+    }
+
+    if( end > begin ){
+      __maps[__nmaps].begin = begin;
+      __maps[__nmaps].end   = end;
+      ++__nmaps;
+    }
+  }
+
+  fclose(fp);
+}
+
+// we're reading our own memory, an unmapped address would kill the process
+static int is_readable( uintptr_t address, size_t size ) {
+  int pass;
+
+  for( pass = 0; pass < 2; ++pass ){
+    uintptr_t cursor = address, end = address + size;
+    size_t i;
+
+    if( pass == 1 || now_ns() - __maps_time > MAPS_TTL ){
+      refresh_maps();
+    }
+
+    // __maps is sorted, adjacent readable mappings are fine
+    for( i = 0; i < __nmaps && cursor < end; ++i ){
+      if( __maps[i].begin <= cursor && cursor < __maps[i].end ){
+        cursor = __maps[i].end;
+      }
+    }
+
+    if( cursor >= end ){
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// With wait set, give the client up to a second to make room instead of
+// dropping the record right away.
+static int ring_push_unlocked( uint32_t type, uint32_t id, uint32_t tag, uint64_t address, const void *payload, uint32_t size, int wait ) {
+  uint32_t need = AGENT_ALIGN( sizeof(agent_record_t) + size ),
+           head = __header->ring_head,
+           tail = __header->ring_tail,
+           pos  = head & ( AGENT_RING_SIZE - 1 ),
+           left = AGENT_RING_SIZE - pos,
+           skip = left < need ? left : 0;
+  agent_record_t *record;
+
+  while( AGENT_RING_SIZE - ( head - tail ) < skip + need ){
+    if( wait-- <= 0 ){
+      __sync_fetch_and_add( &__header->dropped, 1 );
+      return 0;
+    }
+    usleep( 100 );
+    tail = __header->ring_tail;
+  }
+
+  // records never wrap, fill the end of the ring with padding
+  if( skip ){
+    if( left >= sizeof(agent_record_t) ){
+      record = (agent_record_t *)( __ring + pos );
+      memset( record, 0, sizeof(agent_record_t) );
+      record->type = AGENT_REC_PAD;
+    }
+    head += skip;
+    pos = 0;
+  }
+
+  record = (agent_record_t *)( __ring + pos );
+  record->type      = type;
+  record->id        = id;
+  record->address   = address;
+  record->size      = size;
+  record->reserved  = tag;
+  record->timestamp = now_ns();
+  if( size ){
+    memcpy( record + 1, payload, size );
+  }
+
+  // publish the record only once it's complete
+  __sync_synchronize();
+  __header->ring_head = head + need;
+
+  return 1;
+}
+
+static int ring_push( uint32_t type, uint32_t id, uint32_t tag, uint64_t address, const void *payload, uint32_t size, int wait ) {
+  int ok;
+
+  pthread_mutex_lock( &__ring_lock );
+  ok = ring_push_unlocked( type, id, tag, address, payload, size, wait );
+  pthread_mutex_unlock( &__ring_lock );
+
+  return ok;
+}
+
+static uint64_t hash_block( const unsigned char *data, size_t size ) {
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+
+  for( i = 0; i < size; ++i ){
+    h = ( h ^ data[i] ) * 1099511628211ULL;
+  }
+
+  return h;
+}
+
+static void do_read( const agent_command_t *cmd ) {
+  uintptr_t address = (uintptr_t)cmd->address;
+  size_t size = (size_t)cmd->size;
+
+  if( size > AGENT_MAX_PAYLOAD || is_readable( address, size ) == 0 ){
+    ring_push( AGENT_REC_ERROR, cmd->id, 0, address, NULL, 0, RING_WAIT );
+    return;
+  }
+
+  // the client is waiting for this one, wait for it to make room
+  ring_push( AGENT_REC_DATA, cmd->id, 0, address, (const void *)address, size, RING_WAIT );
+}
+
+static void do_watch( const agent_command_t *cmd ) {
+  size_t i, b, nblocks;
+  watch_t *w = NULL;
+
+  for( i = 0; i < AGENT_MAX_WATCHES && w == NULL; ++i ){
+    if( __watches[i].hashes == NULL ){
+      w = &__watches[i];
+    }
+  }
+
+  if( w == NULL || cmd->size == 0 || is_readable( (uintptr_t)cmd->address, (size_t)cmd->size ) == 0 ){
+    ring_push( AGENT_REC_ERROR, cmd->id, 0, (uintptr_t)cmd->address, NULL, 0, RING_WAIT );
+    return;
+  }
+
+  w->id      = cmd->id;
+  w->address = (uintptr_t)cmd->address;
+  w->size    = (size_t)cmd->size;
+  w->block   = cmd->block ? cmd->block : 256;
+  if( w->block > AGENT_MAX_PAYLOAD ){
+    w->block = AGENT_MAX_PAYLOAD;
+  }
+  w->period  = 1000000000ULL / ( cmd->hz ? cmd->hz : 100 );
+  w->next    = now_ns() + w->period;
+
+  nblocks   = ( w->size + w->block - 1 ) / w->block;
+  w->hashes = (uint64_t *)calloc( nblocks, sizeof(uint64_t) );
+
+  for( b = 0; b < nblocks; ++b ){
+    size_t off = b * w->block, len = w->size - off < w->block ? w->size - off : w->block;
+    w->hashes[b] = hash_block( (const unsigned char *)w->address + off, len );
+  }
+}
+
+// address 0 removes every watch
+static void do_unwatch( uintptr_t address ) {
+  size_t i;
+
+  for( i = 0; i < AGENT_MAX_WATCHES; ++i ){
+    if( __watches[i].hashes && ( address == 0 || __watches[i].address == address ) ){
+      free( __watches[i].hashes );
+      __watches[i].hashes = NULL;
+    }
+  }
+}
+
+static void sample_watches( uint64_t t ) {
+  size_t i, b;
+
+  for( i = 0; i < AGENT_MAX_WATCHES; ++i ){
+    watch_t *w = &__watches[i];
+    size_t nblocks;
+
+    if( w->hashes == NULL || t < w->next ){
+      continue;
+    }
+
+    w->next = t + w->period;
+
+    // the mapping went away, stop watching it
+    if( is_readable( w->address, w->size ) == 0 ){
+      ring_push( AGENT_REC_ERROR, w->id, 0, w->address, NULL, 0, 0 );
+      free( w->hashes );
+      w->hashes = NULL;
+      continue;
+    }
+
+    nblocks = ( w->size + w->block - 1 ) / w->block;
+    for( b = 0; b < nblocks; ++b ){
+      size_t off = b * w->block, len = w->size - off < w->block ? w->size - off : w->block;
+      const unsigned char *data = (const unsigned char *)w->address + off;
+      uint64_t h = hash_block( data, len );
+
+      if( h != w->hashes[b] ){
+        w->hashes[b] = h;
+        ring_push( AGENT_REC_CHANGE, w->id, 0, w->address + off, data, len, 0 );
+      }
+    }
+  }
+}
+
+static void search_chunk( search_t *search, const chunk_t *chunk ) {
+  uint32_t p;
+
+  for( p = 0; p < search->npatterns; ++p ){
+    const pattern_t *pattern = &search->patterns[p];
+    const unsigned char *cursor = (const unsigned char *)chunk->begin,
+                        *end    = (const unsigned char *)chunk->end,
+                        *limit  = (const unsigned char *)chunk->limit;
+
+    while( cursor < end ){
+      const unsigned char *hit = (const unsigned char *)memchr( cursor, pattern->bytes[0], end - cursor );
+      if( hit == NULL ){
+        break;
+      }
+
+      // the patterns themselves are no match
+      if( hit >= search->copy && hit < search->copy + search->copy_size ){
+        cursor = hit + 1;
+        continue;
+      }
+
+      if( (size_t)( limit - hit ) >= pattern->length && memcmp( hit, pattern->bytes, pattern->length ) == 0 ){
+        size_t context = (size_t)( limit - hit ) < search->context ? (size_t)( limit - hit ) : search->context;
+
+        if( context < pattern->length ){
+          context = pattern->length;
+        }
+
+        ring_push( AGENT_REC_MATCH, search->id, p, (uintptr_t)hit, hit, context, RING_WAIT );
+        __sync_fetch_and_add( &search->matches, 1 );
+      }
+
+      cursor = hit + 1;
+    }
+  }
+
+  __sync_fetch_and_add( &search->scanned, (uint64_t)( chunk->end - chunk->begin ) );
+  __header->heartbeat++;
+}
+
+static void *search_worker( void *arg ) {
+  search_t *search = (search_t *)arg;
+
+  while( 1 ){
+    uint32_t i = __sync_fetch_and_add( &search->next, 1 );
+    if( i >= search->nchunks ){
+      break;
+    }
+    search_chunk( search, &search->chunks[i] );
+  }
+
+  return NULL;
+}
+
+static void do_search( const agent_command_t *cmd ) {
+  const agent_search_t *args = (const agent_search_t *)__input;
+  const unsigned char *cursor = __input + sizeof(agent_search_t),
+                      *end    = __input + ( cmd->size < AGENT_INPUT_SIZE ? cmd->size : AGENT_INPUT_SIZE );
+  const uint32_t *lengths;
+  const agent_range_t *regions;
+  pthread_t threads[AGENT_MAX_THREADS];
+  uint32_t i, nthreads, maxlen = 0, capacity = 0, reach;
+  unsigned char *bytes;
+  search_t search;
+
+  memset( &search, 0, sizeof(search) );
+  search.id = cmd->id;
+
+  if( args->npatterns == 0 || args->npatterns > AGENT_MAX_PATTERNS || cursor + args->npatterns * sizeof(uint32_t) > end ){
+    ring_push( AGENT_REC_ERROR, cmd->id, 0, 0, NULL, 0, RING_WAIT );
+    return;
+  }
+
+  // patterns are copied, androswat may reuse the input area right away
+  lengths = (const uint32_t *)cursor;
+  cursor += AGENT_ALIGN( args->npatterns * sizeof(uint32_t) );
+  for( i = 0; i < args->npatterns; ++i ){
+    capacity += lengths[i];
+    maxlen = lengths[i] > maxlen ? lengths[i] : maxlen;
+  }
+
+  if( maxlen == 0 || cursor + AGENT_ALIGN(capacity) > end ){
+    ring_push( AGENT_REC_ERROR, cmd->id, 0, 0, NULL, 0, RING_WAIT );
+    return;
+  }
+
+  bytes = (unsigned char *)malloc( capacity );
+  memcpy( bytes, cursor, capacity );
+  cursor += AGENT_ALIGN(capacity);
+
+  search.npatterns = args->npatterns;
+  search.copy      = bytes;
+  search.copy_size = capacity;
+  search.context   = args->context > AGENT_MAX_CONTEXT ? AGENT_MAX_CONTEXT : args->context;
+  reach = search.context > maxlen - 1 ? search.context : maxlen - 1;
+  for( i = 0, capacity = 0; i < args->npatterns; ++i ){
+    search.patterns[i].bytes  = bytes + capacity;
+    search.patterns[i].length = lengths[i];
+    capacity += lengths[i];
+  }
+
+  // split every region we can safely read in chunks
+  regions = (const agent_range_t *)cursor;
+  if( cursor + args->nregions * sizeof(agent_range_t) > end ){
+    free( bytes );
+    ring_push( AGENT_REC_ERROR, cmd->id, 0, 0, NULL, 0, RING_WAIT );
+    return;
+  }
+
+  for( i = 0; i < args->nregions; ++i ){
+    uintptr_t begin = (uintptr_t)regions[i].begin, stop = (uintptr_t)regions[i].end;
+
+    // never search our own shared memory, or we'd find the patterns there
+    if( begin < (uintptr_t)__shm + AGENT_SHM_SIZE && stop > (uintptr_t)__shm ){
+      continue;
+    }
+    else if( stop <= begin || is_readable( begin, stop - begin ) == 0 ){
+      ring_push( AGENT_REC_ERROR, cmd->id, 0, begin, NULL, 0, RING_WAIT );
+      continue;
+    }
+
+    for( ; begin < stop; begin += AGENT_SEARCH_CHUNK ){
+      chunk_t *chunk;
+
+      if( ( search.nchunks & 1023 ) == 0 ){
+        search.chunks = (chunk_t *)realloc( search.chunks, ( search.nchunks + 1024 ) * sizeof(chunk_t) );
+      }
+
+      chunk = &search.chunks[ search.nchunks++ ];
+      chunk->begin = begin;
+      chunk->end   = stop - begin > AGENT_SEARCH_CHUNK ? begin + AGENT_SEARCH_CHUNK : stop;
+      // let matches and their context cross the end of the chunk
+      chunk->limit = stop - chunk->end > reach ? chunk->end + reach : stop;
+    }
+  }
+
+  nthreads = args->threads == 0 ? 1 : ( args->threads > AGENT_MAX_THREADS ? AGENT_MAX_THREADS : args->threads );
+  if( nthreads > search.nchunks ){
+    nthreads = search.nchunks ? search.nchunks : 1;
+  }
+
+  for( i = 0; i < nthreads; ++i ){
+    if( pthread_create( &threads[i], NULL, search_worker, &search ) != 0 ){
+      break;
+    }
+  }
+  // if some thread could not be created, the others will do its work
+  if( i == 0 ){
+    search_worker( &search );
+  }
+  nthreads = i;
+  for( i = 0; i < nthreads; ++i ){
+    pthread_join( threads[i], NULL );
+  }
+
+  ring_push( AGENT_REC_DONE, cmd->id, 0, search.scanned, NULL, 0, RING_WAIT );
+
+  free( search.chunks );
+  free( bytes );
+}
+
+static void reset() {
+  do_unwatch( 0 );
+
+  __header->cmd_head  = __header->cmd_tail  = 0;
+  __header->ring_head = __header->ring_tail = 0;
+  __header->dropped   = 0;
+}
+
+static int send_fd( int sock, int fd ) {
+  struct msghdr msg;
+  struct iovec iov;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct cmsghdr *cmsg;
+  uint32_t magic = AGENT_MAGIC;
+
+  memset( &msg, 0, sizeof(msg) );
+  memset( control, 0, sizeof(control) );
+
+  iov.iov_base = &magic;
+  iov.iov_len  = sizeof(magic);
+
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+  memcpy( CMSG_DATA(cmsg), &fd, sizeof(int) );
+
+  return sendmsg( sock, &msg, 0 ) == sizeof(magic);
+}
+
+static int client_gone( int sock ) {
+  char c;
+  return recv( sock, &c, 1, MSG_DONTWAIT | MSG_PEEK ) == 0;
+}
+
+static void serve( int sock ) {
+  unsigned int idle = 0;
+
+  while( 1 ){
+    uint64_t t = now_ns();
+    int busy = 0;
+
+    __header->heartbeat++;
+
+    while( __header->cmd_tail != __header->cmd_head ){
+      agent_command_t cmd;
+
+      __sync_synchronize();
+      cmd = __header->commands[ __header->cmd_tail % AGENT_MAX_COMMANDS ];
+      __sync_synchronize();
+      __header->cmd_tail++;
+
+      switch( cmd.type ){
+        case AGENT_CMD_READ:    do_read( &cmd ); break;
+        case AGENT_CMD_WATCH:   do_watch( &cmd ); break;
+        case AGENT_CMD_UNWATCH: do_unwatch( (uintptr_t)cmd.address ); break;
+        case AGENT_CMD_SEARCH:  do_search( &cmd ); break;
+        default:
+          ring_push( AGENT_REC_ERROR, cmd.id, 0, (uintptr_t)cmd.address, NULL, 0, RING_WAIT );
+      }
+      busy = 1;
+    }
+
+    sample_watches( t );
+
+    // spin for a while after some work, then back off
+    if( busy ){
+      idle = 0;
+    }
+    else if( ++idle > 1000 ){
+      if( ( idle & 255 ) == 0 && client_gone( sock ) ){
+        break;
+      }
+      usleep( 200 );
+    }
+  }
+}
+
+static void *agent_main( void *arg ) {
+  struct sockaddr_un addr;
+  socklen_t len;
+  // don't leak anything into programs the process might exec
+  int server = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  // abstract namespace, nothing to clean up on the filesystem
+  snprintf( addr.sun_path + 1, sizeof(addr.sun_path) - 1, AGENT_SOCKET_NAME, getpid() );
+  len = offsetof( struct sockaddr_un, sun_path ) + 1 + strlen( addr.sun_path + 1 );
+
+  if( server < 0 || bind( server, (struct sockaddr *)&addr, len ) != 0 || listen( server, 1 ) != 0 ){
+    LOG( "Could not listen on @%s.\n", addr.sun_path + 1 );
+    return NULL;
+  }
+
+  LOG( "Agent listening on @%s.\n", addr.sun_path + 1 );
+
+  while( 1 ){
+    struct ucred cred;
+    socklen_t clen = sizeof(cred);
+    int client = accept( server, NULL, NULL );
+
+    if( client < 0 ){
+      continue;
+    }
+    fcntl( client, F_SETFD, FD_CLOEXEC );
+
+    // abstract sockets are reachable by any app, only talk to root
+    if( getsockopt( client, SOL_SOCKET, SO_PEERCRED, &cred, &clen ) != 0 || cred.uid != 0 ){
+      close( client );
+      continue;
+    }
+
+    reset();
+
+    if( send_fd( client, __fd ) ){
+      serve( client );
+    }
+
+    close( client );
+    do_unwatch( 0 );
+  }
+
+  return NULL;
+}
+
+static int create_shm() {
+  char path[0xFF];
+  int fd = syscall( __NR_memfd_create, "androswat-agent", MFD_CLOEXEC_ );
+
+  // kernels older than 3.17, use an unlinked file instead
+  if( fd < 0 ){
+    snprintf( path, sizeof(path), "/data/local/tmp/.androswat-agent.%d", getpid() );
+    fd = open( path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600 );
+    unlink( path );
+  }
+
+  return fd;
+}
+
+void __attribute__ ((constructor)) agent_init() {
+  pthread_t tid;
+
+  __fd = create_shm();
+  if( __fd < 0 || ftruncate( __fd, AGENT_SHM_SIZE ) != 0 ){
+    LOG( "Could not create the shared memory.\n" );
+    return;
+  }
+
+  __shm = (unsigned char *)mmap( NULL, AGENT_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, __fd, 0 );
+  if( __shm == MAP_FAILED ){
+    LOG( "Could not map the shared memory.\n" );
+    return;
+  }
+
+  __header = (agent_header_t *)__shm;
+  __input  = __shm + AGENT_HEADER_SIZE;
+  __ring   = __input + AGENT_INPUT_SIZE;
+
+  __header->magic     = AGENT_MAGIC;
+  __header->version   = AGENT_VERSION;
+  __header->pid       = getpid();
+  __header->ring_size = AGENT_RING_SIZE;
+
+  if( pthread_create( &tid, NULL, agent_main, NULL ) == 0 ){
+    pthread_detach( tid );
+  }
+}
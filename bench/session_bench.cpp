@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "androswat.h"
+
+// Per call cost of libandroswat against spawning the androswat binary for
+// each operation, which is what an external collector had to do before.
+//
+//   session_bench PID /data/local/tmp/androswat [ITERATIONS]
+
+#define BENCH_READ_SIZE 4096
+#define BENCH_PATTERN   "deadbeefcafebabe"
+#define BENCH_FILTER    "[stack]"
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class Counter : public MatchSink {
+public:
+
+  size_t count;
+
+  Counter() : count(0) {
+
+  }
+
+  virtual bool match( const MemoryMap& region, uintptr_t offset, size_t length, const unsigned char *context, size_t size ) {
+    ++count;
+    return true;
+  }
+};
+
+static bool spawn( const char *binary, char * const argv[] ) {
+  pid_t child = fork();
+  if( child == -1 ){
+    perror("fork");
+    return false;
+  }
+  else if( child == 0 ){
+    int null = open( "/dev/null", O_WRONLY );
+    dup2( null, 1 );
+    dup2( null, 2 );
+    execv( binary, argv );
+    _exit(127);
+  }
+
+  int status = 0;
+  waitpid( child, &status, 0 );
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void report( const char *what, double elapsed, size_t iterations, size_t failed, double baseline ) {
+  double per_call = elapsed * 1000.0 / iterations;
+
+  printf( "  %-28s : %10.3f ms per call", what, per_call );
+  if( baseline > 0 ){
+    printf( " ( %.1fx )", baseline / per_call );
+  }
+  if( failed ){
+    printf( ", %u failed", failed );
+  }
+  printf( "\n" );
+}
+
+int main( int argc, char **argv ) {
+  if( argc < 3 ){
+    fprintf( stderr, "Usage: %s PID ANDROSWAT [ITERATIONS]\n", argv[0] );
+    return 1;
+  }
+
+  pid_t pid = strtol( argv[1], NULL, 10 );
+  const char *binary = argv[2];
+  size_t iterations = argc > 3 ? strtoul( argv[3], NULL, 10 ) : 100;
+  Session *session = NULL;
+  swat_error_t error = Session::open( pid, session, TRACER_NOSTOP );
+
+  if( error != SWAT_OK ){
+    fprintf( stderr, "Could not open pid %d: %s.\n", pid, swat_strerror(error) );
+    return 1;
+  }
+
+  // the stack is always there and always readable
+  const MemoryMap *stack = NULL;
+  PROCESS_FOREACH_MAP_CONST( session->process() ){
+    if( i->name() == "[stack]" ){
+      stack = &(*i);
+    }
+  }
+  if( stack == NULL ){
+    fprintf( stderr, "Could not find the stack of pid %d.\n", pid );
+    return 1;
+  }
+
+  uintptr_t address = stack->end() - BENCH_READ_SIZE;
+  unsigned char buffer[BENCH_READ_SIZE];
+  unsigned char pattern[] = { 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe };
+  PatternMatcher matcher( pattern, sizeof(pattern) );
+  RegionFilter filter;
+  string parse_error;
+  char pid_s[32] = {0}, address_s[32] = {0}, size_s[32] = {0};
+  size_t failed = 0;
+  double start = 0, spawn_read = 0, spawn_search = 0;
+
+  filter.compile( BENCH_FILTER, parse_error );
+  sprintf( pid_s, "%d", pid );
+  sprintf( address_s, "%lx", (unsigned long)address );
+  sprintf( size_s, "%d", BENCH_READ_SIZE );
+
+  printf( "Reading %d bytes @ %p and searching %s of pid %d, %u iterations ...\n\n", BENCH_READ_SIZE, (void *)address, BENCH_FILTER, pid, iterations );
+
+  char *read_argv[] = { (char *)binary, (char *)"--pid", pid_s, (char *)"--read", address_s, (char *)"--size", size_s, NULL };
+  char *search_argv[] = { (char *)binary, (char *)"--pid", pid_s, (char *)"--search", (char *)BENCH_PATTERN, (char *)"--filter", (char *)BENCH_FILTER, NULL };
+
+  start = now();
+  for( size_t i = 0; i < iterations; ++i ){
+    failed += !spawn( binary, read_argv );
+  }
+  spawn_read = ( now() - start ) * 1000.0 / iterations;
+  report( "read, spawning androswat", now() - start, iterations, failed, 0 );
+
+  failed = 0;
+  start = now();
+  for( size_t i = 0; i < iterations; ++i ){
+    Session *fresh = NULL;
+    if( Session::open( pid, fresh, TRACER_NOSTOP ) != SWAT_OK || fresh->read( address, buffer, sizeof(buffer) ) != SWAT_OK ){
+      ++failed;
+    }
+    delete fresh;
+  }
+  report( "read, new session", now() - start, iterations, failed, spawn_read );
+
+  failed = 0;
+  start = now();
+  for( size_t i = 0; i < iterations; ++i ){
+    failed += session->read( address, buffer, sizeof(buffer) ) != SWAT_OK;
+  }
+  report( "read, same session", now() - start, iterations, failed, spawn_read );
+
+  failed = 0;
+  start = now();
+  for( size_t i = 0; i < iterations; ++i ){
+    failed += !spawn( binary, search_argv );
+  }
+  spawn_search = ( now() - start ) * 1000.0 / iterations;
+  report( "search, spawning androswat", now() - start, iterations, failed, 0 );
+
+  failed = 0;
+  start = now();
+  for( size_t i = 0; i < iterations; ++i ){
+    Counter counter;
+    failed += session->search( matcher, &filter, counter ) != SWAT_OK;
+  }
+  report( "search, same session", now() - start, iterations, failed, spawn_search );
+
+  printf( "\n" );
+  session->stats();
+
+  delete session;
+  return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __AGENT_PROTOCOL_H__
+#define __AGENT_PROTOCOL_H__
+
+/*
+ * Layout of the memory shared between androswat and the injected agent,
+ * this header is included by both sides and must stay plain C.
+ *
+ * The agent creates a memfd, maps it and hands it over the abstract unix
+ * socket AGENT_SOCKET_NAME with SCM_RIGHTS. From then on androswat posts
+ * commands into the command queue and the agent answers with records in
+ * the ring, both single producer / single consumer with free running
+ * 32 bit head and tail counters, so no syscall is needed to move data.
+ */
+#include <stdint.h>
+
+#define AGENT_MAGIC        0x54415753
+#define AGENT_VERSION      2
+// abstract socket name, formatted with the pid of the target
+#define AGENT_SOCKET_NAME  "androswat.agent.%d"
+// the header page is followed by the input area, where androswat writes
+// the arguments of commands too big for agent_command_t, and by the ring,
+// whose size must be a power of two.
+#define AGENT_HEADER_SIZE  4096
+#define AGENT_INPUT_SIZE   ( 256 * 1024 )
+#define AGENT_RING_SIZE    ( 4 * 1024 * 1024 )
+#define AGENT_SHM_SIZE     ( AGENT_HEADER_SIZE + AGENT_INPUT_SIZE + AGENT_RING_SIZE )
+// biggest payload of a single record
+#define AGENT_MAX_PAYLOAD  ( 256 * 1024 )
+#define AGENT_MAX_COMMANDS 64
+#define AGENT_MAX_WATCHES  16
+#define AGENT_MAX_PATTERNS 64
+#define AGENT_MAX_THREADS  8
+// regions are searched in chunks of this size by the agent threads
+#define AGENT_SEARCH_CHUNK ( 1024 * 1024 )
+
+// commands, androswat -> agent
+#define AGENT_CMD_READ     1
+#define AGENT_CMD_WATCH    2
+#define AGENT_CMD_UNWATCH  3
+// input holds an agent_search_t, size is how many bytes of it are used
+#define AGENT_CMD_SEARCH   4
+
+// records, agent -> androswat
+#define AGENT_REC_PAD      0
+#define AGENT_REC_DATA     1
+#define AGENT_REC_CHANGE   2
+#define AGENT_REC_ERROR    3
+// a search hit, the payload is the context and reserved the pattern index
+#define AGENT_REC_MATCH    4
+// end of a search, address is the number of bytes scanned
+#define AGENT_REC_DONE     5
+
+typedef struct {
+  uint32_t id;
+  uint32_t type;
+  uint64_t address;
+  uint64_t size;
+  // block size and sampling rate of AGENT_CMD_WATCH
+  uint32_t block;
+  uint32_t hz;
+}
+agent_command_t;
+
+// followed by 'size' bytes of payload, the whole record is 8 bytes aligned
+typedef struct {
+  uint32_t type;
+  // id of the command this record answers
+  uint32_t id;
+  uint64_t address;
+  uint32_t size;
+  uint32_t reserved;
+  // CLOCK_MONOTONIC nanoseconds in the agent
+  uint64_t timestamp;
+}
+agent_record_t;
+
+// Followed by npatterns lengths ( uint32_t ), the pattern bytes one after
+// the other, padded to 8 bytes, and by nregions agent_range_t .
+typedef struct {
+  uint32_t npatterns;
+  uint32_t nregions;
+  // bytes of context returned with every match
+  uint32_t context;
+  uint32_t threads;
+}
+agent_search_t;
+
+typedef struct {
+  uint64_t begin;
+  uint64_t end;
+}
+agent_range_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t ring_size;
+  // incremented by the agent at every loop, to tell if it's still alive
+  volatile uint32_t heartbeat;
+  // records which did not fit in the ring
+  volatile uint32_t dropped;
+  // written by androswat / by the agent
+  volatile uint32_t cmd_head;
+  volatile uint32_t cmd_tail;
+  // written by the agent / by androswat
+  volatile uint32_t ring_head;
+  volatile uint32_t ring_tail;
+  agent_command_t   commands[AGENT_MAX_COMMANDS];
+}
+agent_header_t;
+
+#define AGENT_ALIGN(n) ( ( (n) + 7 ) & ~7u )
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __ALLOCATOR_H__
+#define __ALLOCATOR_H__
+
+#include <stddef.h>
+#include <new>
+
+// Source of the big scratch buffers ( region reader chunks ), so that an
+// embedding application can serve them from its own pools.
+class Allocator {
+public:
+
+  virtual ~Allocator() {}
+
+  // NULL on failure.
+  virtual void *allocate( size_t size ) = 0;
+  virtual void release( void *ptr, size_t size ) = 0;
+};
+
+class HeapAllocator : public Allocator {
+public:
+
+  virtual void *allocate( size_t size ) {
+    return new (std::nothrow) unsigned char[size];
+  }
+
+  virtual void release( void *ptr, size_t size ) {
+    delete[] (unsigned char *)ptr;
+  }
+
+  // Shared by everything not given an allocator.
+  static HeapAllocator *instance() {
+    static HeapAllocator heap;
+    return &heap;
+  }
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __ANDROSWAT_H__
+#define __ANDROSWAT_H__
+
+#include "process.h"
+#include "tracer.h"
+#include "allocator.h"
+#include "file_cache.h"
+#include "region_reader.h"
+#include "region_filter.h"
+#include "search.h"
+#include "string_scanner.h"
+#include "pointer_scanner.h"
+#include "symbolizer.h"
+
+typedef enum {
+  SWAT_OK = 0,
+  // NULL buffer, empty pattern, etc
+  SWAT_EINVAL,
+  // the process does not exist or exited
+  SWAT_ENOPROC,
+  // ptrace attach failed: not root, already traced, ...
+  SWAT_EATTACH,
+  // the address is not in any mapping
+  SWAT_ENOREGION,
+  // some or all of the memory could not be read
+  SWAT_EREAD,
+  SWAT_EWRITE,
+  // the allocator failed
+  SWAT_ENOMEM
+}
+swat_error_t;
+
+const char *swat_strerror( swat_error_t error );
+
+// Told about every region a scan went through, for progress and per region
+// errors.
+class RegionObserver {
+public:
+
+  virtual ~RegionObserver() {}
+
+  // failed if nothing of the region could be read, otherwise unreadable
+  // bytes were skipped.
+  virtual void scanned( const MemoryMap& region, bool failed, size_t unreadable ) = 0;
+};
+
+// Entry point of libandroswat for applications embedding it: a handle on a
+// process which keeps its memory maps and tracer ( with the cache of the
+// unreadable pages ) across calls instead of setting them up for each one,
+// and returns errors instead of exiting.
+//
+// ptrace requests must come from the thread which attached, a session is
+// meant to be used by a single thread.
+class Session {
+private:
+
+  Process      *_process;
+  Tracer       *_tracer;
+  int           _flags;
+  Allocator    *_allocator;
+  FileCache    *_files;
+  bool          _own_files;
+  RegionFilter  _everything;
+  // kept across searches, rebuilt only if a bigger overlap is needed
+  RegionReader *_reader;
+  size_t        _calls;
+  size_t        _attaches;
+  uint64_t      _bytes;
+  double        _time;
+
+  Session( Process *process, int flags, Allocator *allocator );
+
+  swat_error_t reader( size_t overlap, RegionReader *& reader );
+  // Tell a vanished process apart from a plain read error.
+  swat_error_t failure( swat_error_t error ) const;
+
+public:
+
+  // flags are TRACER_* ones: with TRACER_NOSTOP the process keeps running
+  // if process_vm_readv is supported. Scratch buffers come from allocator,
+  // or from the heap if NULL.
+  static swat_error_t open( pid_t pid, Session *& session, int flags = 0, Allocator *allocator = NULL );
+  static swat_error_t find( const char *name, Session *& session, int flags = 0, Allocator *allocator = NULL );
+  virtual ~Session();
+
+  inline Process *process() const {
+    return _process;
+  }
+
+  // The tracer every call of the session goes through, attached on first
+  // use and until detach().
+  swat_error_t attach( Tracer *& tracer );
+  // Let the process run untraced until the next call.
+  void detach();
+  // Clean pages of file backed regions are copied from a cache of mapped
+  // files of the session's own, or from files shared with other sessions,
+  // or read from the process like everything else if NULL. Takes effect
+  // from the next attach.
+  void setFileCache( FileCache *files );
+  // Reload the memory maps after the process mapped or unmapped something,
+  // and forget which pages couldn't be read; pointers to previous regions
+  // are not valid anymore.
+  swat_error_t refresh();
+
+  // Read size bytes into the caller buffer, unreadable pages are zero
+  // filled and make it return SWAT_EREAD with got set to what was read.
+  swat_error_t read( uintptr_t address, void *buffer, size_t size, size_t *got = NULL );
+  swat_error_t write( uintptr_t address, const void *buffer, size_t size );
+  // Every region selected by filter ( every readable one if NULL ) is
+  // streamed through the scanner, matches and strings are handed to the
+  // sinks as they're found.
+  swat_error_t search( Matcher& matcher, RegionFilter *filter, MatchSink& sink, RegionObserver *observer = NULL );
+  swat_error_t strings( StringScanner& scanner, RegionFilter *filter, RegionObserver *observer = NULL );
+  // Scan the writable regions for pointers to [lo, hi), or to any mapped
+  // region if lo == hi, with jobs threads. The scanner goes through the
+  // session's tracer, the caller deletes it before the session.
+  swat_error_t pointers( PointerScanner *& scanner, size_t jobs, uintptr_t lo = 0, uintptr_t hi = 0 );
+
+  void stats() const;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CAPTURE_INDEX_H__
+#define __CAPTURE_INDEX_H__
+
+#include <stdint.h>
+#include <map>
+
+#include "page_store.h"
+#include "search.h"
+#include "region_filter.h"
+
+using std::map;
+
+#define CAPTURE_INDEX_MAGIC     "SWATIDX1"
+#define CAPTURE_INDEX_GRAM      4
+// only grams starting at offsets multiple of the stride are indexed, a
+// pattern of at least CAPTURE_INDEX_STRIDE + CAPTURE_INDEX_GRAM - 1 bytes
+// always contains one of them whatever its alignment.
+#define CAPTURE_INDEX_STRIDE    4
+#define CAPTURE_INDEX_MIN_BITS  16
+#define CAPTURE_INDEX_MAX_BITS  22
+// pages kept in memory while verifying candidates
+#define CAPTURE_INDEX_CACHE     1024
+
+typedef struct _IndexHeader {
+  char     magic[8];
+  uint32_t stride;
+  uint32_t bits;
+  uint32_t nregions;
+  uint32_t npostings;
+  uint64_t total;
+}
+IndexHeader;
+
+// Inverted index of the 4-grams of a capture, saved as indexes/NAME in the
+// page store: the regions of the capture are laid out one after the other
+// and every sampled gram position goes in the bucket of the gram's hash, so
+// a search only reads the pages around the positions of the rarest gram of
+// the pattern instead of the whole capture.
+class CaptureIndex {
+private:
+
+  PageStore&             _store;
+  string                 _name;
+  vector<CapturedRegion> _regions;
+  // position of every region in the flat layout
+  vector<uint64_t>       _starts;
+  uint64_t               _total;
+
+  int                    _fd;
+  unsigned char         *_map;
+  size_t                 _map_size;
+  const IndexHeader     *_header;
+  const uint32_t        *_buckets;
+  const uint32_t        *_postings;
+
+  map<string, vector<unsigned char> > _cache;
+
+  double                 _build_time;
+  double                 _query_time;
+  size_t                 _candidates;
+  size_t                 _pages_read;
+  bool                   _scanned;
+  bool                   _loaded;
+
+  string path() const;
+  // unmap and close a rejected index, search() then scans the capture
+  void unmap();
+  size_t findRegion( uint64_t position ) const;
+  const unsigned char *page( const string& hash );
+  // copy size bytes of region r from offset, false if any is unreadable
+  bool read( size_t r, uint64_t offset, unsigned char *buffer, size_t size );
+  void addMatch( size_t r, uint64_t offset, size_t size, vector<Matches>& matches );
+  void scan( const unsigned char *pattern, size_t size, const vector<bool>& allowed, vector<Matches>& matches );
+
+  // call fn( position, gram ) for every sampled position of the capture
+  template<typename T> void walk( T& fn );
+
+public:
+
+  CaptureIndex( PageStore& store, const string& name );
+  virtual ~CaptureIndex();
+
+  // False if the capture manifest could not be loaded.
+  inline bool valid() const {
+    return _loaded;
+  }
+
+  inline const vector<CapturedRegion>& regions() const {
+    return _regions;
+  }
+
+  bool build();
+  // Map the index, false if it was never built.
+  bool open();
+  // Matches are grouped by region, regions not selected by the filter are
+  // skipped.
+  bool search( const unsigned char *pattern, size_t size, RegionFilter& filter, vector<Matches>& matches );
+
+  void stats() const;
+};
+
+#endif
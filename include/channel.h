@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include "process.h"
+#include "agent_protocol.h"
+
+// how long to wait for the agent to answer, in ms
+#define CHANNEL_TIMEOUT 2000
+
+typedef struct _AgentMatch {
+  uintptr_t             address;
+  // index of the pattern which matched
+  uint32_t              pattern;
+  vector<unsigned char> context;
+}
+AgentMatch;
+
+typedef vector< vector<unsigned char> > Patterns;
+
+// Client side of the shared memory channel to an injected agent, see
+// agent_protocol.h and agent/agent.c .
+class Channel {
+private:
+
+  pid_t           _pid;
+  int             _socket;
+  int             _fd;
+  unsigned char  *_shm;
+  agent_header_t *_header;
+  unsigned char  *_input;
+  unsigned char  *_ring;
+  uint32_t        _next_id;
+  // size of the record returned by next(), released at the following call
+  uint32_t        _consumed;
+  size_t          _reads;
+  size_t          _bytes;
+  size_t          _skipped;
+  size_t          _received;
+
+  bool post( uint32_t type, uintptr_t address, uint64_t size, uint32_t block = 0, uint32_t hz = 0 );
+
+public:
+
+  Channel( pid_t pid );
+  virtual ~Channel();
+
+  // Connect to the agent and map its shared memory, retrying for timeout
+  // ms since the agent might still be starting.
+  bool connect( unsigned int timeout = CHANNEL_TIMEOUT );
+
+  // Copy size bytes from the agent, in pieces of at most AGENT_MAX_PAYLOAD,
+  // change notifications arriving in the meantime are skipped.
+  bool read( uintptr_t address, unsigned char *buffer, size_t size );
+  // Ask the agent to report blocks of the range as they change.
+  bool watch( uintptr_t address, size_t size, uint32_t block, uint32_t hz );
+  bool unwatch( uintptr_t address = 0 );
+
+  // Let the agent search the patterns in the regions with its own threads,
+  // only matches and their context come back. Regions the agent could not
+  // read are added to failed, scanned is the number of bytes searched.
+  bool search( const Patterns& patterns, const vector<const MemoryMap *>& regions, size_t context, size_t jobs,
+               vector<AgentMatch>& matches, vector<uintptr_t>& failed, uint64_t& scanned );
+
+  // Next record in the ring or NULL, the record and its payload are valid
+  // until the following call.
+  const agent_record_t *next();
+
+  void stats() const;
+};
+
+#endif
@@ -31,6 +31,9 @@
 
 #include <stdio.h>
 
-#define FATAL(...) fprintf (stderr, __VA_ARGS__); exit(EXIT_FAILURE)
+// CLI only, the library reports errors to its caller instead.
+#define FATAL(...) do { fprintf( stderr, __VA_ARGS__ ); exit(EXIT_FAILURE); } while(0)
+
+void dumphex( unsigned char *buffer, size_t base, size_t size, const char *padding = "", size_t step = 16 );
 
 #endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __DUMP_PIPELINE_H__
+#define __DUMP_PIPELINE_H__
+
+#include <pthread.h>
+
+#include "tracer.h"
+
+#define DUMP_CHUNK_SIZE ( 1024 * 1024 )
+#define DUMP_BUFFERS    8
+#define DUMP_READERS    2
+
+// Dump memory ranges to a file through a fixed pool of buffers: reader
+// threads fill them from the process while a writer thread drains them
+// with pwrite, so reads and disk I/O overlap and memory use is bounded
+// by buffers * chunk whatever the size of the ranges.
+class DumpPipeline {
+private:
+
+  typedef struct _DumpRange {
+    uintptr_t begin;
+    uintptr_t end;
+    // where the range starts in the output file, past 2 GB for big dumps
+    off64_t   offset;
+    // index of its first chunk
+    size_t    first;
+    string    name;
+  }
+  DumpRange;
+
+  typedef struct _Buffer {
+    unsigned char *data;
+    uintptr_t      address;
+    size_t         size;
+    off64_t        offset;
+  }
+  Buffer;
+
+  Tracer           *_tracer;
+  size_t            _readers;
+  size_t            _chunk;
+  vector<DumpRange> _ranges;
+  off64_t           _total;
+  int               _fd;
+
+  // chunk i of the dump is at _chunk * i in the file
+  size_t            _nchunks;
+  size_t            _next;
+  size_t            _running;
+  vector<Buffer>    _buffers;
+  vector<size_t>    _free;
+  vector<size_t>    _filled;
+  pthread_mutex_t   _lock;
+  pthread_cond_t    _can_read;
+  pthread_cond_t    _can_write;
+
+  size_t            _failed;
+  size_t            _unreadable;
+  size_t            _write_errors;
+  double            _read_busy;
+  double            _write_busy;
+  double            _elapsed;
+
+  bool locate( size_t chunk, uintptr_t& address, size_t& size, off64_t& offset ) const;
+
+  static void *reader( void *arg );
+  static void *writer( void *arg );
+
+  void readLoop();
+  void writeLoop();
+
+public:
+
+  // Without process_vm_readv only the thread which attached can read, the
+  // number of readers is forced to one.
+  DumpPipeline( Tracer *tracer, size_t readers = DUMP_READERS, size_t buffers = DUMP_BUFFERS, size_t chunk = DUMP_CHUNK_SIZE );
+  virtual ~DumpPipeline();
+
+  // Ranges are written one after the other in the order they're added.
+  void add( uintptr_t begin, uintptr_t end, const string& name = "" );
+
+  bool run( const char *output );
+  // Write "OFFSET BEGIN-END NAME" for every range, to find them in the dump.
+  bool saveIndex( const char *output ) const;
+  void stats() const;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __FILE_CACHE_H__
+#define __FILE_CACHE_H__
+
+#include <pthread.h>
+#include <map>
+
+#include "memory_map.h"
+
+using std::map;
+
+// address space we're willing to spend on mapped files, beyond it regions
+// are read from the process as usual.
+#define FILE_CACHE_MAX_MAPPED ( 512 * 1024 * 1024 )
+
+// /proc/<pid>/pagemap entry bits
+#define PAGEMAP_PRESENT ( 1ULL << 63 )
+#define PAGEMAP_SWAPPED ( 1ULL << 62 )
+#define PAGEMAP_FILE    ( 1ULL << 61 )
+
+// Read only mappings of the files behind file backed regions, shared by
+// every region and every process mapping the same file: pages which are
+// still the file's ( clean, or never touched ) are copied from here out of
+// our own page cache instead of being read from the process.
+class FileCache {
+private:
+
+  typedef struct _File {
+    const unsigned char *data;
+    size_t               size;
+  }
+  File;
+
+  // by device:inode, NULL data for files which can't be used
+  map<string, File> _files;
+  size_t            _mapped;
+  size_t            _max;
+  pthread_mutex_t   _lock;
+  size_t            _from_file;
+  size_t            _from_process;
+
+public:
+
+  FileCache( size_t max = FILE_CACHE_MAX_MAPPED );
+  virtual ~FileCache();
+
+  // The contents of the file behind region, NULL if it's not file backed,
+  // can't be mapped or is not the same file anymore.
+  const unsigned char *get( const MemoryMap& region, size_t& size );
+
+  // Whether a page of region can be copied from its file, given its
+  // pagemap entry and the file size.
+  static bool clean( const MemoryMap& region, uintptr_t page, uint64_t entry, size_t size );
+
+  // Bytes of file backed regions copied from the files and read from the
+  // process, can be called from many threads.
+  void account( size_t from_file, size_t from_process );
+
+  void stats() const;
+};
+
+#endif
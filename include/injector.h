@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INJECTOR_H__
+#define __INJECTOR_H__
+
+#include <map>
+#include <set>
+
+#include "tracer.h"
+
+using std::map;
+using std::set;
+
+// longest dlerror message we read back
+#define INJECT_MAX_ERROR    512
+
+// Inject a library into many processes at once from a single thread: every
+// target is a small state machine driven by the stops reported by
+// waitpid(-1), so while one process runs dlopen the others are attached,
+// called or detached. A process stopped inside libc or the linker runs in
+// short slices until it leaves them, dlopen could deadlock on their locks
+// otherwise, and fails if it doesn't within TRACER_SAFEPOINT_TIMEOUT.
+class MultiInject {
+private:
+
+  typedef enum {
+    INJECT_PENDING = 0,
+    INJECT_ATTACHING,
+    INJECT_SAFEPOINT,
+    INJECT_DLOPEN,
+    INJECT_DLERROR,
+    INJECT_DONE,
+    INJECT_FAILED
+  }
+  inject_state_t;
+
+  typedef struct _InjectTarget {
+    Process       *process;
+    Tracer        *tracer;
+    inject_state_t state;
+    uintptr_t      path;
+    uintptr_t      handle;
+    string         error;
+    bool           shared_symbols;
+    double         stopped_at;
+    double         stopped;
+    // running towards a safe point since slice_at, interrupted or not yet
+    double         slice_at;
+    bool           interrupted;
+    size_t         slices;
+    size_t         transfers;
+    size_t         syscalls;
+
+    _InjectTarget() :
+      process(NULL),
+      tracer(NULL),
+      state(INJECT_PENDING),
+      path(0),
+      handle(0),
+      shared_symbols(false),
+      stopped_at(0),
+      stopped(0),
+      slice_at(0),
+      interrupted(false),
+      slices(0),
+      transfers(0),
+      syscalls(0) {
+
+    }
+  }
+  InjectTarget;
+
+  string                _library;
+  size_t                _jobs;
+  vector<InjectTarget>  _targets;
+  map<pid_t, size_t>    _running;
+  size_t                _next;
+  // names of the local libraries exporting the symbols we need
+  set<string>           _libraries;
+  // symbols resolved so far, by libc and linker mapping
+  map<string, Symbols>  _symbols;
+  double                _elapsed;
+
+  string symbolsKey( const Process *process ) const;
+
+  void start();
+  void callDlopen( InjectTarget& target );
+  // Interrupt the targets whose slice towards a safe point is over, true
+  // if any is still running towards one.
+  bool slices();
+  void step( InjectTarget& target, int status );
+  void fail( InjectTarget& target, const char *error );
+  void finish( InjectTarget& target );
+
+public:
+
+  MultiInject( const vector<Process *>& targets, const string& library, size_t jobs );
+  virtual ~MultiInject();
+
+  void run();
+  // Print handle, dlerror and how long each process was stopped.
+  void dump() const;
+};
+
+#endif
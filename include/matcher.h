@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __MATCHER_H__
+#define __MATCHER_H__
+
+#include <stddef.h>
+
+// Something that can be searched for in a buffer.
+class Matcher {
+public:
+
+  virtual ~Matcher() {}
+
+  // Matchers might keep state while searching, every thread needs its own.
+  virtual Matcher *clone() const = 0;
+  // Upper bound of the length of a match.
+  virtual size_t maxLength() const = 0;
+  // Whether a match can start inside the previous one.
+  virtual bool overlapping() const {
+    return false;
+  }
+  // Called before searching a new buffer.
+  virtual void reset() {}
+  // Find the first match in data starting at or after offset 'from'.
+  virtual bool find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length ) = 0;
+};
+
+// Exact sequence of bytes.
+class PatternMatcher : public Matcher {
+private:
+
+  const unsigned char *_pattern;
+  size_t               _size;
+
+public:
+
+  PatternMatcher( const unsigned char *pattern, size_t size );
+
+  virtual Matcher *clone() const;
+  virtual size_t maxLength() const;
+  virtual bool overlapping() const;
+  virtual bool find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length );
+};
+
+#endif
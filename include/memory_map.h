@@ -58,6 +58,18 @@ public:
       return _permissions.find("x") != string::npos;
   }
 
+  inline bool isReadable() const {
+      return _permissions.find("r") != string::npos;
+  }
+
+  inline bool isWritable() const {
+      return _permissions.find("w") != string::npos;
+  }
+
+  inline bool isFileBacked() const {
+      return _inode != 0;
+  }
+
   inline bool contains( uintptr_t address ) const {
     return address >= _begin && address < _end;
   }
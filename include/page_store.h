@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PAGE_STORE_H__
+#define __PAGE_STORE_H__
+
+#include <set>
+
+#include "region_reader.h"
+
+using std::set;
+
+#define PAGE_STORE_PAGE_SIZE 4096
+
+// Manifest page entries for pages which are not stored as objects.
+#define PAGE_STORE_ZERO       "0"
+#define PAGE_STORE_UNREADABLE "-"
+
+typedef struct _CapturedRegion {
+  MemoryMap      region;
+  // one hash per page, or PAGE_STORE_ZERO / PAGE_STORE_UNREADABLE
+  vector<string> pages;
+}
+CapturedRegion;
+
+// Content addressed store of memory pages: every page is saved once as
+// objects/xx/yyyy... named after its SHA-256, and every capture is a text
+// manifest in captures/ listing the regions and the hashes of their pages.
+// Since every app is forked from zygote, most pages are shared across
+// processes and across captures of the same process.
+class PageStore {
+private:
+
+  string      _path;
+  set<string> _known;
+  size_t      _pages;
+  size_t      _stored;
+  size_t      _zero;
+  size_t      _unreadable;
+  bool        _valid;
+
+  string objectPath( const string& hash ) const;
+  string capturePath( const string& name ) const;
+
+  bool putRegion( RegionReader& reader, const MemoryMap& region, FILE *manifest );
+
+public:
+
+  PageStore( const string& path );
+
+  // False if the store directories could not be created.
+  inline bool valid() const {
+    return _valid;
+  }
+
+  // Store a page if not already there and return its hash.
+  string put( const unsigned char *page );
+  bool get( const string& hash, unsigned char *page ) const;
+
+  // Store the given regions of the process as the capture 'name'.
+  bool capture( Tracer& tracer, const Process *process, const vector<const MemoryMap *>& regions, const string& name );
+  // Parse the manifest of capture 'name'.
+  bool load( const string& name, vector<CapturedRegion>& regions ) const;
+  // Rebuild the captured region containing address into output.
+  bool restore( const string& name, uintptr_t address, const char *output ) const;
+
+  void stats() const;
+
+  inline const string& path() const {
+    return _path;
+  }
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PATCHER_H__
+#define __PATCHER_H__
+
+#include "tracer.h"
+
+typedef struct _Patch {
+  uintptr_t             address;
+  vector<unsigned char> bytes;
+
+  inline uintptr_t end() const {
+    return address + bytes.size();
+  }
+}
+Patch;
+
+// Apply a list of "ADDRESS HEXBYTES" patches to a process while attached
+// once, merging adjacent patches into runs written with vectored writes.
+class Patcher {
+private:
+
+  Process      *_process;
+  vector<Patch> _patches;
+  size_t        _loaded;
+  size_t        _bytes;
+  size_t        _written;
+  size_t        _syscalls;
+  size_t        _failed;
+
+  void coalesce();
+
+public:
+
+  Patcher( Process *process );
+
+  // Lines are "ADDRESS HEXBYTES", spaces and colons between bytes and
+  // everything after a '#' are ignored.
+  bool load( const char *filename );
+
+  bool apply();
+  void stats() const;
+};
+
+#endif
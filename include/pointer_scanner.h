@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __POINTER_SCANNER_H__
+#define __POINTER_SCANNER_H__
+
+#include <pthread.h>
+
+#include "tracer.h"
+#include "symbolizer.h"
+
+#define POINTERS_DEFAULT_MAX_OFFSET 4096
+#define POINTERS_MAX_CHAINS         100000
+
+typedef struct _PointerRef {
+  // where the pointer points to
+  uintptr_t target;
+  // where the pointer is stored
+  uintptr_t source;
+
+  inline bool operator<( const struct _PointerRef& other ) const {
+    return target < other.target || ( target == other.target && source < other.source );
+  }
+}
+PointerRef;
+
+// Regions sorted by address, to tell if a value points to mapped memory.
+class RegionIndex {
+private:
+
+  vector<const MemoryMap *> _regions;
+  uintptr_t                 _lo;
+  uintptr_t                 _hi;
+
+public:
+
+  RegionIndex( const Process *process );
+
+  const MemoryMap *find( uintptr_t address ) const;
+};
+
+// Scans the writable regions of a process for aligned pointer sized values
+// landing in a target range ( or anywhere mapped ), with one reader thread
+// per job. Results are kept in an array sorted by target, so that "who
+// points to X" is a binary search and pointer chains a few of them.
+class PointerScanner {
+private:
+
+  typedef struct _WorkItem {
+    uintptr_t begin;
+    uintptr_t end;
+  }
+  WorkItem;
+
+  typedef struct _ChainNode {
+    // where the pointer is stored
+    uintptr_t address;
+    // the pointer plus offset gives the parent node address
+    int       parent;
+    uintptr_t offset;
+    size_t    level;
+  }
+  ChainNode;
+
+  Process            *_process;
+  Tracer             *_tracer;
+  RegionIndex         _index;
+  size_t              _jobs;
+  uintptr_t           _lo;
+  uintptr_t           _hi;
+  vector<WorkItem>    _work;
+  size_t              _next;
+  pthread_mutex_t     _lock;
+  vector<PointerRef>  _refs;
+  size_t              _scanned;
+
+  static void *worker( void *arg );
+
+  void printLocation( uintptr_t address, const Annotation *annotation ) const;
+
+public:
+
+  PointerScanner( Process *process, Tracer *tracer, size_t jobs );
+  virtual ~PointerScanner();
+
+  // Collect pointers to [lo, hi), or to any mapped region if lo == hi.
+  void scan( uintptr_t lo = 0, uintptr_t hi = 0 );
+
+  inline const vector<PointerRef>& refs() const {
+    return _refs;
+  }
+  // Bytes the last scan could read.
+  inline size_t scanned() const {
+    return _scanned;
+  }
+
+  // Pointers whose target is in [lo, hi).
+  void find( uintptr_t lo, uintptr_t hi, vector<PointerRef>& found ) const;
+  // Print every chain of up to depth pointers leading to [lo, hi), where
+  // every level can point up to max_offset bytes before the next one; with
+  // a symbolizer the pointers in modules are annotated all at once.
+  void chains( uintptr_t lo, uintptr_t hi, size_t depth, size_t max_offset, Symbolizer *symbolizer = NULL ) const;
+  // Save the map as a sequence of ( target, source ) pairs.
+  bool save( const char *output ) const;
+  void stats() const;
+};
+
+#endif
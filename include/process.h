@@ -50,19 +50,32 @@ private:
   string            _name;
   vector<MemoryMap> _memory;
 
-  static string parseName(pid_t pid);
-  static vector<MemoryMap> parseMaps(pid_t pid);
+  Process();
+
+  static bool parseName( pid_t pid, string& name );
+  static bool parseMaps( pid_t pid, vector<MemoryMap>& memory );
 
 public:
 
-  Process( pid_t pid );
   void dump() const;
+  // Parse the memory maps again, false if the process is gone; pointers to
+  // the previous regions are not valid anymore.
+  bool refresh();
 
   const MemoryMap *findRegion( uintptr_t address );
+  // Ids of the threads currently in /proc/<pid>/task, false if the process
+  // is gone.
+  bool threads( vector<pid_t>& tids ) const;
   uintptr_t findLibrary( const char *name );
   uintptr_t findSymbol( uintptr_t local );
 
+  // NULL if no process has that name.
   static Process *find( const char *name );
+  // NULL if the process does not exist or vanished in the meantime.
+  static Process *open( pid_t pid );
+  // Return every process whose name matches the glob expression, or every
+  // userland process if glob is NULL, excluding ourselves.
+  static vector<Process *> findAll( const char *glob = NULL );
 
   inline const string& name() const {
     return _name;
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <signal.h>
+#include <map>
+
+#include "tracer.h"
+#include "symbolizer.h"
+
+using std::map;
+
+#define PROFILE_DEFAULT_DURATION 10
+// bytes read from the stack pointer of every thread at every sample
+#define PROFILE_STACK_WINDOW     8192
+#define PROFILE_MAX_DEPTH        64
+// functions shown in the flat profile
+#define PROFILE_TOP              25
+
+// Sampling profiler: every thread is seized once, then at every tick all of
+// them are interrupted, their registers and the top of their stacks copied,
+// and they're resumed right away; stacks are unwound through the frame
+// pointer chain after the threads are running again. Identical stacks are
+// aggregated in a hash table and symbolized only once at the end.
+class Profiler {
+private:
+
+  typedef struct _ProfiledThread {
+    pid_t                 tid;
+    bool                  stopped;
+    bool                  sampled;
+    struct pt_regs        regs;
+    uintptr_t             stack_begin;
+    vector<unsigned char> stack;
+    size_t                samples;
+
+    _ProfiledThread() : tid(-1), stopped(false), sampled(false), stack_begin(0), samples(0) { }
+  }
+  ProfiledThread;
+
+  typedef struct _Stack {
+    pid_t             tid;
+    // innermost frame first
+    vector<uintptr_t> frames;
+    size_t            count;
+  }
+  Stack;
+
+  Process                        *_process;
+  Tracer                         *_reader;
+  unsigned int                    _hz;
+  double                          _duration;
+  size_t                          _window;
+  map<pid_t, ProfiledThread>      _threads;
+  map<pid_t, string>              _names;
+  map<uint32_t, vector<Stack> >   _stacks;
+
+  size_t                          _ticks;
+  size_t                          _samples;
+  size_t                          _unique;
+  size_t                          _overruns;
+  size_t                          _depth;
+  double                          _stopped;
+  double                          _stopped_max;
+  double                          _elapsed;
+
+  void seizeNew();
+  bool waitStop( ProfiledThread& thread );
+  void tick();
+  bool word( const ProfiledThread& thread, uintptr_t address, uintptr_t& value ) const;
+  void unwind( const ProfiledThread& thread, vector<uintptr_t>& frames ) const;
+  void add( pid_t tid, const vector<uintptr_t>& frames );
+  void detachAll();
+
+public:
+
+  Profiler( Process *process, unsigned int hz, double duration = PROFILE_DEFAULT_DURATION, size_t window = PROFILE_STACK_WINDOW );
+  virtual ~Profiler();
+
+  // Sample for the given duration or until *stop becomes true.
+  bool run( volatile sig_atomic_t *stop );
+
+  // Functions by self and total samples.
+  void flat( Symbolizer& symbolizer, size_t top = PROFILE_TOP ) const;
+  // One "thread;outer;...;inner count" line per stack, for flamegraph.pl
+  void folded( Symbolizer& symbolizer, FILE *fp ) const;
+  void stats() const;
+};
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __REGEX_H__
+#define __REGEX_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "matcher.h"
+
+using std::string;
+using std::vector;
+using std::map;
+
+// longest match we report, also the overlap needed between chunks
+#define REGEX_MAX_MATCH  1024
+// upper bound of {m,n}
+#define REGEX_MAX_REPEAT 255
+// lazily built DFA states before the cache is flushed
+#define REGEX_MAX_STATES 4096
+
+#define REGEX_ASCII   ( 1 << 0 )
+#define REGEX_UTF16LE ( 1 << 1 )
+
+// Byte oriented regular expression, parsed into an NFA and lazily compiled
+// into a DFA while matching. Supports literals, '.', [classes], \d \w \s
+// \xHH escapes, grouping, alternation and * + ? {m,n} repetitions.
+//
+// In UTF-16LE mode every character of the expression matches a 16 bit code
+// unit, so "http" matches the way Java strings are stored in memory.
+class Regex {
+private:
+
+  typedef struct _ByteSet {
+    uint32_t bits[8];
+
+    _ByteSet() {
+      clear();
+    }
+
+    inline void clear() {
+      for( int i = 0; i < 8; ++i ) bits[i] = 0;
+    }
+
+    inline void fill() {
+      for( int i = 0; i < 8; ++i ) bits[i] = 0xffffffff;
+    }
+
+    inline void invert() {
+      for( int i = 0; i < 8; ++i ) bits[i] = ~bits[i];
+    }
+
+    inline void add( unsigned char c ) {
+      bits[c >> 5] |= 1u << ( c & 31 );
+    }
+
+    inline bool has( unsigned char c ) const {
+      return bits[c >> 5] & ( 1u << ( c & 31 ) );
+    }
+
+    int count() const;
+  }
+  ByteSet;
+
+  typedef enum {
+    NODE_SET = 0,
+    NODE_CAT,
+    NODE_ALT,
+    NODE_REPEAT,
+    NODE_EMPTY
+  }
+  node_type_t;
+
+  typedef struct _Node {
+    node_type_t type;
+    // low and high byte of the character for NODE_SET, high is only used
+    // in UTF-16LE mode.
+    ByteSet     low;
+    ByteSet     high;
+    int         left;
+    int         right;
+    int         min;
+    // -1 for unbounded repetitions
+    int         max;
+  }
+  Node;
+
+  typedef enum {
+    NFA_SET = 0,
+    NFA_SPLIT,
+    NFA_EMPTY,
+    NFA_MATCH
+  }
+  state_type_t;
+
+  typedef struct _State {
+    state_type_t type;
+    ByteSet      set;
+    int          out;
+    int          out1;
+  }
+  State;
+
+  typedef vector< std::pair<int, int> > Outs;
+
+  // States are built lazily from sets of NFA states, 0 is the dead state
+  // and 1 the start state.
+  typedef struct _Dfa {
+    int                    start;
+    // the NFA start state is added back after every byte, matches can
+    // begin anywhere
+    bool                   floating;
+    vector< vector<int> >  states;
+    map< vector<int>, int> index;
+    vector<int>            trans;
+    vector<char>           accept;
+  }
+  Dfa;
+
+  typedef struct _Fragment {
+    int  start;
+    Outs outs;
+  }
+  Fragment;
+
+  string               _expr;
+  bool                 _utf16;
+  string               _error;
+  const char          *_p;
+  vector<Node>         _ast;
+  vector<State>        _nfa;
+  int                  _start;
+  // start of the NFA compiled right to left, and whether compile() is
+  // building that one
+  int                  _rstart;
+  bool                 _reversed;
+  string               _prefix;
+  bool                 _first[256];
+
+  // anchored at the start of a match, for the end of the longest one
+  Dfa                  _forward;
+  // unanchored, for where the first match ends
+  Dfa                  _floating;
+  // anchored at the end of a match and fed backwards, for its start
+  Dfa                  _backward;
+
+  int node( node_type_t type, int left = -1, int right = -1 );
+  int setNode( const ByteSet& set, bool any_high = false );
+
+  int parseAlt();
+  int parseConcat();
+  int parseRepeat();
+  int parseAtom();
+  int parseClass();
+  // A byte of a class, escaped or not, or a class escape like \d merged
+  // into set; see CLASS_ESCAPE and CLASS_ERROR.
+  int parseClassByte( ByteSet& set );
+  bool parseEscape( ByteSet& set );
+
+  int state( state_type_t type, int out = -1, int out1 = -1 );
+  void patch( const Outs& outs, int target );
+  Fragment compile( int node );
+  bool literalPrefix( int node );
+
+  void closure( int s, vector<int>& set, vector<bool>& seen ) const;
+  void reset( Dfa& dfa );
+  int dstate( Dfa& dfa, const vector<int>& set );
+  int step( Dfa& dfa, int d, unsigned char c );
+  void flush();
+
+public:
+
+  Regex( const char *expr, bool utf16 = false );
+
+  inline bool valid() const {
+    return _error.empty();
+  }
+
+  inline const string& error() const {
+    return _error;
+  }
+
+  inline const string& expr() const {
+    return _expr;
+  }
+
+  // Find the first non empty and longest match starting at or after 'from'.
+  bool find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length );
+};
+
+// Matches a regular expression in ASCII, UTF-16LE or both encodings.
+class RegexMatcher : public Matcher {
+private:
+
+  typedef enum {
+    CACHE_UNKNOWN = 0,
+    CACHE_FOUND,
+    CACHE_NONE
+  }
+  cache_state_t;
+
+  // next match of each encoding in the current buffer
+  typedef struct _Cached {
+    cache_state_t state;
+    size_t        start;
+    size_t        length;
+  }
+  Cached;
+
+  string  _expr;
+  int     _encodings;
+  Regex  *_ascii;
+  Regex  *_utf16;
+  Cached  _cached[2];
+
+public:
+
+  RegexMatcher( const char *expr, int encodings );
+  virtual ~RegexMatcher();
+
+  bool valid( string& error ) const;
+
+  virtual Matcher *clone() const;
+  virtual size_t maxLength() const;
+  virtual void reset();
+  virtual bool find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length );
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __REGION_FILTER_H__
+#define __REGION_FILTER_H__
+
+#include <vector>
+
+#include "memory_map.h"
+
+using std::vector;
+
+// Condition on a memory region, nodes of a compiled filter.
+class RegionPredicate {
+public:
+
+  virtual ~RegionPredicate() {}
+
+  virtual bool matches( const MemoryMap& region ) const = 0;
+};
+
+// Decides which regions are worth reading before anything is read, from
+// the region table alone: regions which are not readable, device mappings
+// other than ashmem and those not matching the --filter expression are
+// pruned. Expressions are made of terms, juxtaposed or ',' separated terms
+// must all match, '|' separates alternatives, '!' negates and parens group:
+//
+//   perm:rw      has all the given permissions ( r w x s p )
+//   type:anon    not backed by a file, type:file is the opposite
+//   size:RANGE   RANGE is N, N-M, <N, >N ( inclusive, K M G suffixes )
+//   addr:RANGE   overlaps the RANGE of hex addresses
+//   offset:RANGE file offset, in hex
+//   inode:N      inode of the backing file
+//   name:GLOB    the whole name matches the shell GLOB
+//   re:REGEX     the name contains a match of REGEX
+//   WORD         the name contains WORD, as --filter always did
+//
+// Values may be double quoted, e.g. 'perm:rw !name:"*.so" size:>1M'.
+class RegionFilter {
+private:
+
+  typedef enum {
+    PRUNED_UNREADABLE = 0,
+    PRUNED_DEVICE,
+    PRUNED_FILTER,
+    PRUNED_REASONS
+  }
+  prune_reason_t;
+
+  RegionPredicate *_root;
+  string           _expression;
+  size_t           _selected;
+  // summed over every process of a MultiSearch, past 4 GB
+  uint64_t         _selected_bytes;
+  size_t           _pruned[PRUNED_REASONS];
+  uint64_t         _pruned_bytes[PRUNED_REASONS];
+
+  void prune( prune_reason_t reason, const MemoryMap& region );
+
+public:
+
+  RegionFilter();
+  virtual ~RegionFilter();
+
+  bool compile( const string& expression, string& error );
+
+  // Whether the expression matches the region, true if there's none.
+  bool matches( const MemoryMap& region ) const;
+  // Whether the region must be read at all, counted for stats(); can be
+  // called from many threads.
+  bool select( const MemoryMap& region );
+
+  inline const string& expression() const {
+    return _expression;
+  }
+
+  void stats() const;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __REGION_READER_H__
+#define __REGION_READER_H__
+
+#include "tracer.h"
+#include "allocator.h"
+
+#define REGION_READER_CHUNK_SIZE ( 1024 * 1024 )
+
+// Streams a memory region through a fixed size buffer instead of reading
+// it all at once, so that huge regions ( dalvik heap, etc ) do not require
+// the same amount of memory on our side.
+//
+// Unreadable pages don't stop the stream: they're zero filled and reported
+// by readable(), chunks with nothing readable at all are skipped.
+class RegionReader {
+private:
+
+  typedef std::pair<uintptr_t, uintptr_t> Hole;
+
+  Tracer        *_tracer;
+  Allocator     *_allocator;
+  size_t         _chunk;
+  size_t         _overlap;
+  unsigned char *_buffer;
+  uintptr_t      _begin;
+  uintptr_t      _next;
+  uintptr_t      _end;
+  size_t         _size;
+  size_t         _unreadable;
+  // the last chunk was only the tail of the one before a fully unreadable
+  // chunk, handed out once more so that its overlap gets scanned
+  bool           _tail;
+  vector<bool>   _pages;
+  // unreadable ranges of the buffer, sorted
+  vector<Hole>   _holes;
+
+public:
+
+  // Every chunk but the first one starts with the last 'overlap' bytes of
+  // the previous one, so that a pattern up to overlap + 1 bytes long can't
+  // be missed across chunk boundaries.
+  // The buffer comes from allocator, or from the heap if NULL.
+  RegionReader( Tracer *tracer, size_t overlap = 0, size_t chunk = REGION_READER_CHUNK_SIZE, Allocator *allocator = NULL );
+  virtual ~RegionReader();
+
+  // False if the buffer could not be allocated, nothing can be read then.
+  inline bool valid() const {
+    return _buffer != NULL;
+  }
+
+  void reset( uintptr_t begin, uintptr_t end );
+  // Read the next chunk, returns false when the region is over.
+  bool next( uintptr_t& address, const unsigned char *& data, size_t& size );
+  // How many of the size bytes from address, inside the last chunk, were
+  // actually read.
+  size_t readable( uintptr_t address, size_t size ) const;
+
+  // Nothing follows the last chunk, or not before a hole: everything in it
+  // has to be handled now.
+  inline bool last() const {
+    return _next >= _end || _tail;
+  }
+
+  // Nothing of the region could be read.
+  inline bool failed() const {
+    return _end > _begin && _unreadable == _end - _begin;
+  }
+
+  inline size_t unreadable() const {
+    return _unreadable;
+  }
+
+  inline size_t overlap() const {
+    return _overlap;
+  }
+};
+
+#endif
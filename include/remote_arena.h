@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __REMOTE_ARENA_H__
+#define __REMOTE_ARENA_H__
+
+#include <map>
+
+#include "tracer.h"
+
+// size of every block reserved in the remote process
+#define ARENA_DEFAULT_SIZE  ( 64 * 1024 )
+#define ARENA_ALIGNMENT     8
+
+// Sub allocates strings, argument structs and code from a few big blocks
+// mapped in the remote process with a single remote mmap each, so that
+// only the real work needs a remote call and setting up memory never runs
+// the allocator of the process, whatever lock it might hold.
+class RemoteArena {
+private:
+
+  typedef std::map<uintptr_t, size_t> Blocks;
+
+  Tracer   *_tracer;
+  size_t    _size;
+  // remote blocks we reserved, by base address
+  Blocks    _chunks;
+  // free ranges inside the chunks and live allocations, by address
+  Blocks    _free;
+  Blocks    _used;
+  // bump pointer of the last chunk
+  uintptr_t _base;
+  uintptr_t _top;
+  uintptr_t _end;
+  size_t    _remote_calls;
+
+  bool reserve( size_t size );
+  uintptr_t chunkOf( uintptr_t address ) const;
+
+public:
+
+  RemoteArena( Tracer *tracer, size_t size = ARENA_DEFAULT_SIZE );
+  // Unmaps every chunk with one remote munmap each.
+  virtual ~RemoteArena();
+
+  // Returns 0 if the remote process could not give us more memory.
+  uintptr_t alloc( size_t size );
+  void free( uintptr_t address );
+
+  // Allocate and fill with a single bulk write.
+  uintptr_t copy( const void *data, size_t size );
+  inline uintptr_t string( const char *s ) {
+    return copy( s, strlen(s) + 1 );
+  }
+
+  inline size_t remoteCalls() const {
+    return _remote_calls;
+  }
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include <pthread.h>
+#include <algorithm>
+#include <map>
+
+#include "region_reader.h"
+#include "matcher.h"
+#include "region_filter.h"
+#include "symbolizer.h"
+
+using std::map;
+
+#define SEARCH_CONTEXT_SIZE 64
+#define SEARCH_DEFAULT_JOBS 4
+
+typedef struct _Match {
+  // offset of the match from the beginning of the region
+  uintptr_t             offset;
+  size_t                length;
+  // the match and what follows it, at least SEARCH_CONTEXT_SIZE bytes if
+  // the region is big enough.
+  vector<unsigned char> context;
+}
+Match;
+
+typedef vector<Match> Matches;
+
+// Receives matches as they're found instead of collecting them, context
+// points into the reader buffer and is only valid during the call.
+class MatchSink {
+public:
+
+  virtual ~MatchSink() {}
+
+  // Return false to stop scanning.
+  virtual bool match( const MemoryMap& region, uintptr_t offset, size_t length, const unsigned char *context, size_t size ) = 0;
+};
+
+class Searcher {
+private:
+
+  Matcher *_matcher;
+
+public:
+
+  Searcher( Matcher *matcher );
+
+  inline size_t overlap() const {
+    return std::max( _matcher->maxLength(), (size_t)SEARCH_CONTEXT_SIZE );
+  }
+
+  // Stream the region through the reader and collect every match, returns
+  // false if the region could not be read.
+  bool scan( RegionReader& reader, const MemoryMap& region, Matches& matches ) const;
+  bool scan( RegionReader& reader, const MemoryMap& region, MatchSink& sink ) const;
+};
+
+// Search a pattern in many processes at once, using a bounded number of
+// worker threads, hence never stopping more than 'jobs' processes at a time.
+class MultiSearch {
+private:
+
+  typedef enum {
+    SHARED_SCANNING = 0,
+    SHARED_DONE,
+    SHARED_FAILED
+  }
+  shared_state_t;
+
+  // File backed and non writable mappings ( libraries, zygote preloaded
+  // stuff, etc ) have the same contents in every process mapping them, so
+  // they are scanned once and the results attributed to all of them.
+  typedef struct _SharedRegion {
+    shared_state_t state;
+    Matches        matches;
+
+    _SharedRegion() : state(SHARED_SCANNING) {
+
+    }
+  }
+  SharedRegion;
+
+  typedef struct _RegionHits {
+    const MemoryMap *region;
+    bool             failed;
+    // NULL for private regions
+    SharedRegion    *shared;
+    Matches          matches;
+
+    _RegionHits() : region(NULL), failed(false), shared(NULL) {
+
+    }
+  }
+  RegionHits;
+
+  typedef struct _TargetResult {
+    Process           *process;
+    bool               attached;
+    vector<RegionHits> regions;
+
+    _TargetResult() : process(NULL), attached(false) {
+
+    }
+  }
+  TargetResult;
+
+  const Matcher             *_matcher;
+  RegionFilter              *_filter;
+  size_t                     _jobs;
+  pthread_mutex_t            _lock;
+  size_t                     _next;
+  vector<TargetResult>       _results;
+  map<string, SharedRegion*> _shared;
+  size_t                     _shared_hits;
+  // shared by the targets as much as the regions above, but per page
+  FileCache                  _files;
+
+  static void *worker( void *arg );
+
+  static string sharedKey( const MemoryMap& region );
+
+  void searchTarget( const Searcher& searcher, TargetResult& target );
+  SharedRegion *claimShared( const MemoryMap& region, bool& owner );
+
+public:
+
+  MultiSearch( const vector<Process *>& targets, const Matcher *matcher, RegionFilter *filter, size_t jobs = SEARCH_DEFAULT_JOBS );
+  virtual ~MultiSearch();
+
+  void run();
+  // Print the results grouped by process.
+  void dump() const;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __STRING_SCANNER_H__
+#define __STRING_SCANNER_H__
+
+#include "region_reader.h"
+
+#define STRINGS_MIN_LENGTH     4
+// longer strings are split
+#define STRINGS_MAX_LENGTH     1024
+// memory used by --unique, in MB
+#define STRINGS_DEFAULT_BUDGET 16
+
+// Fixed size open addressing set of 64 bit string hashes, once it's full
+// new strings are not remembered anymore.
+class StringSet {
+private:
+
+  uint64_t *_table;
+  size_t    _mask;
+  size_t    _used;
+  size_t    _limit;
+
+public:
+
+  StringSet( size_t budget );
+  virtual ~StringSet();
+
+  // Returns false if the hash was already in the set.
+  bool insert( uint64_t hash );
+
+  inline bool full() const {
+    return _used >= _limit;
+  }
+};
+
+// Receives the strings instead of them being printed.
+class StringSink {
+public:
+
+  virtual ~StringSink() {}
+
+  virtual void found( uintptr_t address, const MemoryMap& region, bool wide, const string& s ) = 0;
+};
+
+// Like strings(1), but on the live process memory: finds runs of printable
+// ASCII characters and of UTF-16LE code units in the printable ASCII range.
+class StringScanner {
+private:
+
+  size_t      _min;
+  StringSink *_sink;
+  StringSet  *_unique;
+  size_t      _found;
+  size_t      _duplicates;
+
+  size_t scanAscii( const unsigned char *data, size_t size, size_t from, size_t limit, uintptr_t address, const MemoryMap& region );
+  size_t scanWide( const unsigned char *data, size_t size, size_t from, size_t limit, uintptr_t address, const MemoryMap& region );
+  void emit( uintptr_t address, const MemoryMap& region, bool wide, const unsigned char *p, size_t length );
+
+public:
+
+  // A budget of 0 MB disables deduplication, strings are printed to stdout
+  // if there's no sink.
+  StringScanner( size_t min_length = STRINGS_MIN_LENGTH, size_t budget = 0, StringSink *sink = NULL );
+  virtual ~StringScanner();
+
+  inline size_t overlap() const {
+    return STRINGS_MAX_LENGTH * 2;
+  }
+
+  bool scan( RegionReader& reader, const MemoryMap& region );
+  void stats() const;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SYMBOLIZER_H__
+#define __SYMBOLIZER_H__
+
+#include <map>
+
+#include "process.h"
+
+using std::map;
+
+// Function and object symbols of an ELF module, from .symtab if it wasn't
+// stripped and from .dynsym otherwise, sorted by address for binary
+// searches and merge joins.
+class ModuleSymbols {
+public:
+
+  typedef struct _Symbol {
+    uintptr_t value;
+    size_t    size;
+    string    name;
+  }
+  Symbol;
+
+private:
+
+  string         _path;
+  vector<Symbol> _symbols;
+  // lowest virtual address of the PT_LOAD segments
+  uintptr_t      _min_vaddr;
+  bool           _loaded;
+
+  static bool less( const Symbol& a, const Symbol& b );
+
+public:
+
+  ModuleSymbols( const string& path );
+
+  inline bool loaded() const {
+    return _loaded;
+  }
+
+  inline uintptr_t minVaddr() const {
+    return _min_vaddr;
+  }
+
+  inline size_t size() const {
+    return _symbols.size();
+  }
+
+  inline const Symbol& symbol( size_t i ) const {
+    return _symbols[i];
+  }
+
+  // Find the symbol containing the virtual address vaddr of the module.
+  bool find( uintptr_t vaddr, string& name, uintptr_t& offset ) const;
+};
+
+// Symbol tables by module file, loaded the first time they're needed and
+// shared by the symbolizers of every process mapping the same files.
+class SymbolCache {
+private:
+
+  map<string, ModuleSymbols *> _modules;
+
+public:
+
+  virtual ~SymbolCache();
+
+  ModuleSymbols *get( const MemoryMap& region );
+
+  // Modules loaded successfully and their symbols.
+  size_t loaded( size_t& symbols ) const;
+
+  inline size_t size() const {
+    return _modules.size();
+  }
+};
+
+// Where an address is: module+offset from the load base and the nearest
+// symbol at or before it, both empty if it's not in a file mapping.
+typedef struct _Annotation {
+  string    module;
+  uintptr_t offset;
+  string    symbol;
+  uintptr_t delta;
+
+  _Annotation() : offset(0), delta(0) {
+
+  }
+
+  // "libc.so+0x1234 ( malloc+0x20 )", or "" if not in a module.
+  string str() const;
+}
+Annotation;
+
+// Resolve addresses of a process to "module`function", or "module`0xVADDR"
+// outside of known functions, or annotate many of them at once.
+class Symbolizer {
+private:
+
+  Process      *_process;
+  SymbolCache  *_symbols;
+  bool          _owned;
+  map<uintptr_t, string> _cache;
+  size_t        _annotated;
+  size_t        _joined;
+  double        _annotate_time;
+
+  // Where the module of region is loaded, from its mapping at offset 0.
+  uintptr_t base( const MemoryMap *region ) const;
+
+public:
+
+  // Symbol tables come from symbols, or from a cache of our own if NULL.
+  Symbolizer( Process *process, SymbolCache *symbols = NULL );
+  virtual ~Symbolizer();
+
+  const string& resolve( uintptr_t address );
+  // annotations[i] is where addresses[i] is. Addresses are sorted once and
+  // joined against the regions, then against the sorted symbols of every
+  // module in a single merge pass: O( addresses + symbols ) besides the
+  // sort, instead of a lookup per address.
+  void annotate( const vector<uintptr_t>& addresses, vector<Annotation>& annotations );
+
+  void stats() const;
+};
+
+#endif
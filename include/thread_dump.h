@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __THREAD_DUMP_H__
+#define __THREAD_DUMP_H__
+
+#include "tracer.h"
+
+// bytes read from the stack pointer of every thread
+#define THREADS_STACK_WINDOW 1024
+#define THREADS_DEFAULT_JOBS 4
+
+// Registers and top of the stack of every thread of a process at one
+// moment: all threads are seized and interrupted back to back before
+// waiting for any of them, so they stop within a few microseconds of each
+// other, then registers are fetched, stacks are read by a pool of threads
+// and everything is released as soon as possible.
+class ThreadDump {
+private:
+
+  typedef struct _ThreadState {
+    pid_t                 tid;
+    string                name;
+    bool                  seized;
+    bool                  stopped;
+    // signal which stopped the thread instead of the interrupt, delivered
+    // again on release.
+    int                   signal;
+    bool                  has_regs;
+    struct pt_regs        regs;
+    uintptr_t             stack_begin;
+    vector<unsigned char> stack;
+    bool                  stack_ok;
+    double                interrupted;
+    double                stopped_at;
+    double                released;
+
+    _ThreadState() :
+      tid(-1),
+      seized(false),
+      stopped(false),
+      signal(0),
+      has_regs(false),
+      stack_begin(0),
+      stack_ok(false),
+      interrupted(0),
+      stopped_at(0),
+      released(0) {
+
+    }
+  }
+  ThreadState;
+
+  Process            *_process;
+  size_t              _window;
+  size_t              _jobs;
+  vector<ThreadState> _threads;
+  Tracer             *_reader;
+  size_t              _next;
+  bool                _released;
+
+  double              _seize_time;
+  double              _regs_time;
+  double              _stack_time;
+
+  bool seizeAll();
+  void waitStop( ThreadState& thread );
+  void readStack( ThreadState& thread );
+  void release();
+
+  static void *worker( void *arg );
+
+public:
+
+  ThreadDump( Process *process, size_t window = THREADS_STACK_WINDOW, size_t jobs = THREADS_DEFAULT_JOBS );
+  virtual ~ThreadDump();
+
+  bool run();
+  void dump() const;
+  void stats() const;
+};
+
+#endif
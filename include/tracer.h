@@ -31,10 +31,38 @@
 
 #include <sys/ptrace.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <stdarg.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <map>
 
 #include "process.h"
+#include "file_cache.h"
+
+using std::map;
+
+// don't stop the process if memory can be read without attaching to it
+#define TRACER_NOSTOP   ( 1 << 1 )
+// don't wait for the process to stop after attaching, the caller will
+#define TRACER_ASYNC    ( 1 << 2 )
+
+// max number of vectors per process_vm_writev call
+#define TRACER_IOV_MAX 1024
+// granularity of salvage() and of the unreadable ranges cache
+#define TRACER_PAGE_SIZE 4096
+// how long safePoint() lets the process run between two looks at where it
+// is, in microseconds, and for how long at most, in seconds
+#define TRACER_SAFEPOINT_SLICE    500
+#define TRACER_SAFEPOINT_TIMEOUT  1.0
+// libc calls a thread may sleep in holding none of the locks of libc, how
+// far past their entry the svc of their stub is, and how far the call to
+// the stub is in the wrappers around one
+#define TRACER_BLOCKING_FUNCTIONS 12
+#define TRACER_STUB_SIZE          16
+#define TRACER_WRAPPER_SIZE       64
+
+class RemoteArena;
 
 typedef struct _Symbols {
   uintptr_t _dlopen;
@@ -42,9 +70,16 @@ typedef struct _Symbols {
   uintptr_t _dlerror;
   uintptr_t _calloc;
   uintptr_t _free;
-
-  _Symbols() : _dlopen(0), _dlsym(0), _dlerror(0), _calloc(0), _free(0) {
-
+  // an svc instruction of libc, 0 if none was found; not needed by valid()
+  uintptr_t _syscall;
+  // the blocking calls atSafePoint() trusts, 0 where not found; not needed
+  // by valid() either
+  uintptr_t _blocking[TRACER_BLOCKING_FUNCTIONS];
+
+  _Symbols() : _dlopen(0), _dlsym(0), _dlerror(0), _calloc(0), _free(0), _syscall(0) {
+    for( int i = 0; i < TRACER_BLOCKING_FUNCTIONS; ++i ){
+      _blocking[i] = 0;
+    }
   }
 
   inline bool valid() const {
@@ -58,25 +93,147 @@ private:
 
   Process *_process;
   Symbols  _symbols;
+  bool     _attached;
+  bool     _nostop;
+  int      _mem_fd;
+  int      _pagemap_fd;
+  FileCache *_files;
+  RemoteArena *_arena;
+  // registers of the process saved before the first remote call, and put
+  // back once when it's resumed or detached rather than after every call
+  struct pt_regs _backup;
+  bool     _saved;
+  bool     _dirty;
+  bool     _calling;
+  bool     _sysgood;
+  size_t   _transfers;
+  size_t   _syscalls;
+  // pages which failed to read, begin -> end, coalesced; reads overlapping
+  // them fail without a syscall.
+  map<uintptr_t, uintptr_t> _bad;
+  size_t          _bad_bytes;
+  pthread_mutex_t _bad_lock;
 
   long trace( int request, void *addr = 0, void *data = 0 );
-  bool attach();
+  bool attach( bool wait );
   void detach();
 
+  bool peek( size_t addr, unsigned char *buf, size_t blen );
+  bool isBad( uintptr_t addr, size_t blen );
+  void setBad( uintptr_t begin, uintptr_t end );
+  size_t salvageRange( uintptr_t addr, unsigned char *buf, size_t blen, uintptr_t base, vector<bool> *readable );
+  size_t salvageFile( const MemoryMap& region, uintptr_t addr, unsigned char *buf, size_t blen, uintptr_t base, vector<bool> *readable );
+  bool poke( size_t addr, unsigned char *buf, size_t blen );
+  bool openPagemap();
+
+  bool saveRegisters();
+  bool setRegisters( struct pt_regs& regs );
+  bool restoreRegisters();
+  bool readResult( uintptr_t& ret );
+  // whether address is inside libc, the linker or any library exporting
+  // the functions we call
+  bool inLibraries( uintptr_t address );
+
 public:
 
-  Tracer( Process* process );
+  // A failed attach leaves the tracer unusable, check ready().
+  Tracer( Process* process, int flags = 0 );
   virtual ~Tracer();
 
+  inline bool isAttached() const {
+    return _attached;
+  }
+
+  // Whether memory can be accessed, either attached or through
+  // process_vm_readv with TRACER_NOSTOP.
+  inline bool ready() const {
+    return _attached || _nostop;
+  }
+
+  // True if the kernel supports process_vm_readv, in which case reads
+  // neither need to stop the process nor to be issued one word at a time.
+  static bool canReadWithoutStopping();
+  static bool canWriteWithoutStopping();
+
   bool dumpRegion( uintptr_t address, const char *output );
 
+  // Continue a stopped process, delivering sig if not 0.
+  bool resume( int sig = 0 );
+  // Stop the traced thread alone, the SIGSTOP is reported and must not be
+  // delivered.
+  bool interrupt();
+
+  // NULL if dlopen and friends could not be found in the process.
   const Symbols *getSymbols();
+  // Use symbols already resolved for another process with the same libc
+  // and linker mappings.
+  void setSymbols( const Symbols& symbols );
 
   bool read( size_t addr, unsigned char *buf, size_t blen );
-  bool write( size_t addr, unsigned char *buf, size_t blen);
+  // Read whatever can be read of the range: a failed read is split in
+  // halves down to single pages, unreadable pages are zero filled, cleared
+  // in 'readable' ( one entry per page the range touches ) and remembered.
+  // Returns the number of bytes read.
+  size_t salvage( size_t addr, unsigned char *buf, size_t blen, vector<bool> *readable = NULL );
+  // Bytes known to be unreadable so far.
+  size_t unreadable();
+  // Forget them, the process might have mapped or unprotected memory there.
+  void forgetUnreadable();
+  // From now on salvage() copies the pages of file backed regions which are
+  // still identical to their file from files, false if the pagemap of the
+  // process can't be read.
+  bool useFileCache( FileCache *files );
+  // Whether no page of a file backed region diverged from its file, so that
+  // every process mapping it sees the same bytes. False if the pagemap of
+  // the process can't be read.
+  bool isPristine( const MemoryMap& region );
+  // Uses process_vm_writev, or /proc/<pid>/mem for read only pages, or
+  // PTRACE_POKETEXT preserving the bytes around partial words.
+  bool write( size_t addr, unsigned char *buf, size_t blen );
+  // Write many buffers with as few process_vm_writev calls as possible,
+  // returns how many of them were written, starting from the first one.
+  size_t writev( const struct iovec *local, const struct iovec *remote, size_t count );
+  // Remote memory for strings and arguments, reserved on first use and
+  // released when the tracer detaches.
+  RemoteArena *arena();
+  // Copy s into the arena, release it with arena()->free().
   uintptr_t writeString( const char *s );
   uintptr_t call( uintptr_t function, int nargs, ... );
 
+  // The two halves of call(), for callers waiting on many processes: the
+  // process is resumed by beginCall and endCall must be called once it
+  // stopped again ( SIGSEGV returning to address 0 ).
+  bool beginCall( uintptr_t function, int nargs, const uintptr_t *args );
+  bool endCall( uintptr_t& ret );
+
+  // Execute a single syscall in the process without running any of its
+  // code: the svc of libc found by getSymbols() is run between
+  // PTRACE_SYSCALL stops. Returns what the kernel did, -errno on failure,
+  // -ENOSYS if libc has no svc to borrow.
+  long syscall( int number, int nargs, ... );
+  // Anonymous private memory, 0 on failure.
+  uintptr_t mapMemory( size_t size, int prot );
+  bool unmapMemory( uintptr_t address, size_t size );
+  bool protectMemory( uintptr_t address, size_t size, int prot );
+  // A memory file descriptor of the process, -1 on failure.
+  int createMemfd( const char *name, unsigned int flags = 0 );
+
+  // Whether the process stopped where calling into libc and the linker
+  // can't deadlock on a lock it holds itself: outside of them, or blocked
+  // in one of the libc calls resolved by getSymbols() which take none.
+  bool atSafePoint();
+  // Let the process run in short slices until atSafePoint(), false if it
+  // didn't get there within timeout seconds.
+  bool safePoint( double timeout = TRACER_SAFEPOINT_TIMEOUT );
+
+  // GETREGS, SETREGS and PEEKUSER requests issued so far.
+  inline size_t registerTransfers() const {
+    return _transfers;
+  }
+  inline size_t syscalls() const {
+    return _syscalls;
+  }
+
 };
 
 #endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __WATCHER_H__
+#define __WATCHER_H__
+
+#include <signal.h>
+
+#include "tracer.h"
+
+#define WATCHER_DEFAULT_HZ    100
+#define WATCHER_DEFAULT_BLOCK 256
+
+// Periodically sample a memory range and report which blocks of it changed
+// since the previous sample, comparing block hashes rather than the whole
+// buffers.
+class MemoryWatcher {
+private:
+
+  Process          *_process;
+  Tracer           *_tracer;
+  uintptr_t         _address;
+  size_t            _size;
+  size_t            _block;
+  unsigned int      _hz;
+  unsigned char    *_current;
+  unsigned char    *_previous;
+  vector<uint32_t>  _hashes;
+
+  bool sample( unsigned char *buffer );
+  void report( double timestamp, size_t block ) const;
+
+public:
+
+  MemoryWatcher( Process *process, uintptr_t address, size_t size, size_t block = WATCHER_DEFAULT_BLOCK, unsigned int hz = WATCHER_DEFAULT_HZ );
+  virtual ~MemoryWatcher();
+
+  // Run until *stop becomes true.
+  void run( volatile sig_atomic_t *stop );
+};
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "androswat.h"
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char *swat_strerror( swat_error_t error ) {
+  switch( error ){
+    case SWAT_OK:        return "success";
+    case SWAT_EINVAL:    return "invalid argument";
+    case SWAT_ENOPROC:   return "no such process";
+    case SWAT_EATTACH:   return "could not attach to the process";
+    case SWAT_ENOREGION: return "address not mapped";
+    case SWAT_EREAD:     return "could not read memory";
+    case SWAT_EWRITE:    return "could not write memory";
+    case SWAT_ENOMEM:    return "out of memory";
+  }
+  return "unknown error";
+}
+
+// Stops the region loop of search() too, not only the current region.
+class StoppableSink : public MatchSink {
+private:
+
+  MatchSink& _sink;
+  bool       _stopped;
+
+public:
+
+  StoppableSink( MatchSink& sink ) : _sink(sink), _stopped(false) {
+
+  }
+
+  inline bool stopped() const {
+    return _stopped;
+  }
+
+  virtual bool match( const MemoryMap& region, uintptr_t offset, size_t length, const unsigned char *context, size_t size ) {
+    _stopped = !_sink.match( region, offset, length, context, size );
+    return !_stopped;
+  }
+};
+
+Session::Session( Process *process, int flags, Allocator *allocator ) :
+  _process(process),
+  _tracer(NULL),
+  _flags(flags),
+  _allocator( allocator ? allocator : HeapAllocator::instance() ),
+  _files( new FileCache() ),
+  _own_files(true),
+  _reader(NULL),
+  _calls(0),
+  _attaches(0),
+  _bytes(0),
+  _time(0) {
+
+}
+
+Session::~Session() {
+  delete _reader;
+  delete _tracer;
+  delete _process;
+  if( _own_files ){
+    delete _files;
+  }
+}
+
+swat_error_t Session::open( pid_t pid, Session *& session, int flags /* = 0 */, Allocator *allocator /* = NULL */ ) {
+  Process *process = Process::open( pid );
+  if( process == NULL ){
+    return SWAT_ENOPROC;
+  }
+
+  session = new Session( process, flags, allocator );
+  return SWAT_OK;
+}
+
+swat_error_t Session::find( const char *name, Session *& session, int flags /* = 0 */, Allocator *allocator /* = NULL */ ) {
+  if( name == NULL ){
+    return SWAT_EINVAL;
+  }
+
+  Process *process = Process::find( name );
+  if( process == NULL ){
+    return SWAT_ENOPROC;
+  }
+
+  session = new Session( process, flags, allocator );
+  return SWAT_OK;
+}
+
+swat_error_t Session::failure( swat_error_t error ) const {
+  if( kill( _process->pid(), 0 ) == -1 && errno == ESRCH ){
+    return SWAT_ENOPROC;
+  }
+  return error;
+}
+
+swat_error_t Session::attach( Tracer *& tracer ) {
+  if( _tracer == NULL ){
+    _tracer = new Tracer( _process, _flags );
+    ++_attaches;
+
+    if( _tracer->ready() == false ){
+      delete _tracer;
+      _tracer = NULL;
+      return failure( SWAT_EATTACH );
+    }
+    else if( _files ){
+      _tracer->useFileCache( _files );
+    }
+  }
+
+  tracer = _tracer;
+  return SWAT_OK;
+}
+
+void Session::detach() {
+  // the reader points to the tracer
+  delete _reader;
+  delete _tracer;
+  _reader = NULL;
+  _tracer = NULL;
+}
+
+void Session::setFileCache( FileCache *files ) {
+  if( _own_files ){
+    delete _files;
+  }
+  _files     = files;
+  _own_files = false;
+  detach();
+}
+
+swat_error_t Session::refresh() {
+  // pages which failed to read before might be mapped or readable now
+  if( _tracer ){
+    _tracer->forgetUnreadable();
+  }
+  return _process->refresh() ? SWAT_OK : SWAT_ENOPROC;
+}
+
+swat_error_t Session::reader( size_t overlap, RegionReader *& reader ) {
+  Tracer *tracer = NULL;
+  swat_error_t error = attach( tracer );
+
+  if( error != SWAT_OK ){
+    return error;
+  }
+
+  if( _reader == NULL || _reader->overlap() < overlap ){
+    delete _reader;
+    _reader = new RegionReader( tracer, overlap, REGION_READER_CHUNK_SIZE, _allocator );
+    if( _reader->valid() == false ){
+      delete _reader;
+      _reader = NULL;
+      return SWAT_ENOMEM;
+    }
+  }
+
+  reader = _reader;
+  return SWAT_OK;
+}
+
+swat_error_t Session::read( uintptr_t address, void *buffer, size_t size, size_t *got /* = NULL */ ) {
+  double start = now();
+  Tracer *tracer = NULL;
+  size_t done = 0;
+
+  if( got ){
+    *got = 0;
+  }
+
+  if( buffer == NULL ){
+    return SWAT_EINVAL;
+  }
+  else if( _process->findRegion( address ) == NULL ){
+    return SWAT_ENOREGION;
+  }
+
+  swat_error_t error = attach( tracer );
+  if( error != SWAT_OK ){
+    return error;
+  }
+
+  // a whole read in the common case, page by page only if it fails
+  if( tracer->read( address, (unsigned char *)buffer, size ) ){
+    done = size;
+  }
+  else {
+    done = tracer->salvage( address, (unsigned char *)buffer, size );
+  }
+
+  if( got ){
+    *got = done;
+  }
+
+  ++_calls;
+  _bytes += done;
+  _time  += now() - start;
+
+  return done == size ? SWAT_OK : failure( SWAT_EREAD );
+}
+
+swat_error_t Session::write( uintptr_t address, const void *buffer, size_t size ) {
+  Tracer *tracer = NULL;
+
+  if( buffer == NULL ){
+    return SWAT_EINVAL;
+  }
+  else if( _process->findRegion( address ) == NULL ){
+    return SWAT_ENOREGION;
+  }
+
+  swat_error_t error = attach( tracer );
+  if( error != SWAT_OK ){
+    return error;
+  }
+
+  ++_calls;
+
+  return tracer->write( address, (unsigned char *)buffer, size ) ? SWAT_OK : failure( SWAT_EWRITE );
+}
+
+swat_error_t Session::search( Matcher& matcher, RegionFilter *filter, MatchSink& sink, RegionObserver *observer /* = NULL */ ) {
+  double start = now();
+  Searcher searcher( &matcher );
+  StoppableSink stoppable( sink );
+  RegionReader *reader = NULL;
+  size_t failed = 0, selected = 0;
+
+  if( matcher.maxLength() == 0 ){
+    return SWAT_EINVAL;
+  }
+
+  swat_error_t error = this->reader( searcher.overlap(), reader );
+  if( error != SWAT_OK ){
+    return error;
+  }
+
+  if( filter == NULL ){
+    filter = &_everything;
+  }
+
+  PROCESS_FOREACH_MAP_CONST( _process ){
+    if( filter->select(*i) == false ){
+      continue;
+    }
+
+    bool ok = searcher.scan( *reader, *i, stoppable );
+
+    ++selected;
+    failed += !ok;
+    _bytes += i->size() - reader->unreadable();
+
+    if( observer ){
+      observer->scanned( *i, !ok, reader->unreadable() );
+    }
+
+    if( stoppable.stopped() ){
+      break;
+    }
+  }
+
+  ++_calls;
+  _time += now() - start;
+
+  // nothing at all could be read
+  return selected && failed == selected ? failure( SWAT_EREAD ) : SWAT_OK;
+}
+
+swat_error_t Session::strings( StringScanner& scanner, RegionFilter *filter, RegionObserver *observer /* = NULL */ ) {
+  double start = now();
+  RegionReader *reader = NULL;
+  size_t failed = 0, selected = 0;
+
+  swat_error_t error = this->reader( scanner.overlap(), reader );
+  if( error != SWAT_OK ){
+    return error;
+  }
+
+  if( filter == NULL ){
+    filter = &_everything;
+  }
+
+  PROCESS_FOREACH_MAP_CONST( _process ){
+    if( filter->select(*i) == false ){
+      continue;
+    }
+
+    bool ok = scanner.scan( *reader, *i );
+
+    ++selected;
+    failed += !ok;
+    _bytes += i->size() - reader->unreadable();
+
+    if( observer ){
+      observer->scanned( *i, !ok, reader->unreadable() );
+    }
+  }
+
+  ++_calls;
+  _time += now() - start;
+
+  return selected && failed == selected ? failure( SWAT_EREAD ) : SWAT_OK;
+}
+
+swat_error_t Session::pointers( PointerScanner *& scanner, size_t jobs, uintptr_t lo /* = 0 */, uintptr_t hi /* = 0 */ ) {
+  double start = now();
+  Tracer *tracer = NULL;
+
+  scanner = NULL;
+  if( lo > hi ){
+    return SWAT_EINVAL;
+  }
+
+  swat_error_t error = attach( tracer );
+  if( error != SWAT_OK ){
+    return error;
+  }
+
+  scanner = new PointerScanner( _process, tracer, jobs );
+  scanner->scan( lo, hi );
+
+  ++_calls;
+  _bytes += scanner->scanned();
+  _time  += now() - start;
+
+  // nothing at all could be read
+  return scanner->scanned() == 0 ? failure( SWAT_EREAD ) : SWAT_OK;
+}
+
+void Session::stats() const {
+  if( _files ){
+    _files->stats();
+  }
+  if( _calls == 0 ){
+    return;
+  }
+
+  printf( "Session  : %u calls, %llu KB, %.3f ms per call, attached %u times.\n",
+          _calls,
+          (unsigned long long)( _bytes / 1024 ),
+          _calls ? _time * 1000.0 / _calls : 0.0,
+          _attaches );
+}
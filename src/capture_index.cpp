@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "capture_index.h"
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint32_t load_gram( const unsigned char *p ) {
+  uint32_t gram;
+  memcpy( &gram, p, sizeof(gram) );
+  return gram;
+}
+
+// grams made of a single repeated byte ( zero filled areas, padding ... )
+// are everywhere, they're neither indexed nor used to search.
+static inline bool is_stop_gram( uint32_t gram ) {
+  return gram == ( gram & 0xff ) * 0x01010101u;
+}
+
+static inline uint32_t gram_bucket( uint32_t gram, uint32_t bits ) {
+  return ( gram * 2654435761u ) >> ( 32 - bits );
+}
+
+static bool match_less( const Match& a, const Match& b ) {
+  return a.offset < b.offset;
+}
+
+struct GramCounter {
+  uint32_t *counts;
+  uint32_t  bits;
+  uint32_t  n;
+
+  GramCounter( uint32_t *c, uint32_t b ) : counts(c), bits(b), n(0) { }
+
+  inline void operator()( uint64_t, uint32_t gram ) {
+    ++counts[ gram_bucket( gram, bits ) ];
+    ++n;
+  }
+};
+
+struct GramFiller {
+  uint32_t *cursors;
+  uint32_t *postings;
+  uint32_t  bits;
+
+  GramFiller( uint32_t *c, uint32_t *p, uint32_t b ) : cursors(c), postings(p), bits(b) { }
+
+  inline void operator()( uint64_t position, uint32_t gram ) {
+    postings[ cursors[ gram_bucket( gram, bits ) ]++ ] = (uint32_t)position;
+  }
+};
+
+CaptureIndex::CaptureIndex( PageStore& store, const string& name ) :
+  _store(store),
+  _name(name),
+  _total(0),
+  _fd(-1),
+  _map(NULL),
+  _map_size(0),
+  _header(NULL),
+  _buckets(NULL),
+  _postings(NULL),
+  _build_time(0),
+  _query_time(0),
+  _candidates(0),
+  _pages_read(0),
+  _scanned(false),
+  _loaded(false) {
+
+  if( _store.load( _name, _regions ) == false ){
+    return;
+  }
+
+  _loaded = true;
+
+  for( vector<CapturedRegion>::iterator i = _regions.begin(), e = _regions.end(); i != e; ++i ){
+    _starts.push_back(_total);
+    _total += (uint64_t)i->pages.size() * PAGE_STORE_PAGE_SIZE;
+  }
+}
+
+CaptureIndex::~CaptureIndex() {
+  unmap();
+}
+
+void CaptureIndex::unmap() {
+  if( _map ){
+    munmap( _map, _map_size );
+  }
+  if( _fd != -1 ){
+    close(_fd);
+  }
+
+  _fd       = -1;
+  _map      = NULL;
+  _map_size = 0;
+  _header   = NULL;
+  _buckets  = NULL;
+  _postings = NULL;
+}
+
+string CaptureIndex::path() const {
+  return _store.path() + "/indexes/" + _name;
+}
+
+size_t CaptureIndex::findRegion( uint64_t position ) const {
+  return std::upper_bound( _starts.begin(), _starts.end(), position ) - _starts.begin() - 1;
+}
+
+template<typename T> void CaptureIndex::walk( T& fn ) {
+  // the last GRAM - 1 bytes of the previous page, then the current one
+  unsigned char buffer[ CAPTURE_INDEX_GRAM - 1 + PAGE_STORE_PAGE_SIZE ];
+  unsigned char *data = buffer + CAPTURE_INDEX_GRAM - 1;
+
+  for( size_t r = 0; r < _regions.size(); ++r ){
+    const vector<string>& pages = _regions[r].pages;
+    bool tail = false;
+
+    for( size_t n = 0; n < pages.size(); ++n ){
+      if( _store.get( pages[n], data ) == false ){
+        tail = false;
+        continue;
+      }
+      ++_pages_read;
+
+      uint64_t start = _starts[r] + (uint64_t)n * PAGE_STORE_PAGE_SIZE,
+               from  = tail ? start - ( CAPTURE_INDEX_GRAM - 1 ) : start,
+               to    = start + PAGE_STORE_PAGE_SIZE - CAPTURE_INDEX_GRAM;
+
+      from = ( from + CAPTURE_INDEX_STRIDE - 1 ) / CAPTURE_INDEX_STRIDE * CAPTURE_INDEX_STRIDE;
+
+      for( uint64_t p = from; p <= to; p += CAPTURE_INDEX_STRIDE ){
+        uint32_t gram = load_gram( data + ( p - start ) );
+        if( is_stop_gram(gram) == false ){
+          fn( p, gram );
+        }
+      }
+
+      memcpy( buffer, data + PAGE_STORE_PAGE_SIZE - ( CAPTURE_INDEX_GRAM - 1 ), CAPTURE_INDEX_GRAM - 1 );
+      tail = true;
+    }
+  }
+}
+
+bool CaptureIndex::build() {
+  double start = now();
+
+  if( _loaded == false ){
+    return false;
+  }
+
+  if( _total > 0xffffffffULL ){
+    fprintf( stderr, "Capture '%s' is too big to be indexed ( %llu MB ).\n", _name.c_str(), (unsigned long long)( _total >> 20 ) );
+    return false;
+  }
+
+  // count at the finest resolution, the bucket of a gram with fewer bits
+  // is the same hash shifted, so counts fold into about four positions
+  // per bucket once the number of positions is known.
+  vector<uint32_t> counts( 1 << CAPTURE_INDEX_MAX_BITS, 0 );
+  GramCounter counter( &counts[0], CAPTURE_INDEX_MAX_BITS );
+
+  walk(counter);
+
+  uint32_t bits = CAPTURE_INDEX_MIN_BITS;
+  while( bits < CAPTURE_INDEX_MAX_BITS && ( 4ULL << bits ) < counter.n ){
+    ++bits;
+  }
+
+  size_t nbuckets = 1 << bits,
+         fold = CAPTURE_INDEX_MAX_BITS - bits;
+
+  for( size_t b = 0; b < nbuckets; ++b ){
+    uint32_t sum = 0;
+    for( size_t k = b << fold; k < ( b + 1 ) << fold; ++k ){
+      sum += counts[k];
+    }
+    counts[b] = sum;
+  }
+  counts.resize(nbuckets);
+
+  string dir = _store.path() + "/indexes",
+         output = path(),
+         tmp = output + ".tmp";
+
+  if( mkdir( dir.c_str(), 0755 ) != 0 && errno != EEXIST ){
+    perror("mkdir");
+    return false;
+  }
+
+  _map_size = sizeof(IndexHeader) + ( nbuckets + 1 + counter.n ) * sizeof(uint32_t);
+  _fd = ::open( tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+  if( _fd == -1 || ftruncate( _fd, _map_size ) != 0 ){
+    perror("open");
+    fprintf( stderr, "Could not create '%s'.\n", tmp.c_str() );
+    return false;
+  }
+
+  _map = (unsigned char *)mmap( NULL, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0 );
+  if( _map == MAP_FAILED ){
+    perror("mmap");
+    _map = NULL;
+    return false;
+  }
+
+  IndexHeader *header = (IndexHeader *)_map;
+  uint32_t *buckets = (uint32_t *)( header + 1 ),
+           *postings = buckets + nbuckets + 1;
+
+  memcpy( header->magic, CAPTURE_INDEX_MAGIC, sizeof(header->magic) );
+  header->stride    = CAPTURE_INDEX_STRIDE;
+  header->bits      = bits;
+  header->nregions  = _regions.size();
+  header->npostings = counter.n;
+  header->total     = _total;
+
+  // counts become the write cursor of every bucket
+  buckets[0] = 0;
+  for( size_t b = 0; b < nbuckets; ++b ){
+    buckets[b + 1] = buckets[b] + counts[b];
+    counts[b] = buckets[b];
+  }
+
+  GramFiller filler( &counts[0], postings, bits );
+
+  walk(filler);
+
+  munmap( _map, _map_size );
+  close(_fd);
+  _map = NULL;
+  _fd  = -1;
+
+  if( rename( tmp.c_str(), output.c_str() ) != 0 ){
+    perror("rename");
+    unlink( tmp.c_str() );
+    return false;
+  }
+
+  _build_time = now() - start;
+  _pages_read = 0;
+
+  return open();
+}
+
+bool CaptureIndex::open() {
+  string input = path();
+  struct stat st;
+
+  _fd = ::open( input.c_str(), O_RDONLY );
+  if( _fd == -1 ){
+    return false;
+  }
+  else if( fstat( _fd, &st ) != 0 || (size_t)st.st_size < sizeof(IndexHeader) ){
+    fprintf( stderr, "Index '%s' is corrupted.\n", input.c_str() );
+    unmap();
+    return false;
+  }
+
+  _map_size = st.st_size;
+  _map = (unsigned char *)mmap( NULL, _map_size, PROT_READ, MAP_SHARED, _fd, 0 );
+  if( _map == MAP_FAILED ){
+    perror("mmap");
+    _map = NULL;
+    unmap();
+    return false;
+  }
+
+  // nothing is published before the whole header checked out
+  const IndexHeader *header = (const IndexHeader *)_map;
+
+  if( memcmp( header->magic, CAPTURE_INDEX_MAGIC, sizeof(header->magic) ) != 0 ||
+      header->stride != CAPTURE_INDEX_STRIDE ||
+      header->bits < CAPTURE_INDEX_MIN_BITS || header->bits > CAPTURE_INDEX_MAX_BITS ||
+      _map_size != sizeof(IndexHeader) + ( ( (uint64_t)1 << header->bits ) + 1 + header->npostings ) * sizeof(uint32_t) ){
+    fprintf( stderr, "Index '%s' is corrupted.\n", input.c_str() );
+    unmap();
+    return false;
+  }
+  else if( header->nregions != _regions.size() || header->total != _total ){
+    fprintf( stderr, "Index '%s' does not match the capture anymore, rebuild it with --index.\n", input.c_str() );
+    unmap();
+    return false;
+  }
+
+  _header   = header;
+  _buckets  = (const uint32_t *)( _header + 1 );
+  _postings = _buckets + ( 1 << _header->bits ) + 1;
+
+  return true;
+}
+
+const unsigned char *CaptureIndex::page( const string& hash ) {
+  map<string, vector<unsigned char> >::iterator i = _cache.find(hash);
+  if( i != _cache.end() ){
+    return &i->second[0];
+  }
+
+  if( _cache.size() >= CAPTURE_INDEX_CACHE ){
+    _cache.clear();
+  }
+
+  vector<unsigned char>& data = _cache[hash];
+  data.resize( PAGE_STORE_PAGE_SIZE );
+
+  if( _store.get( hash, &data[0] ) == false ){
+    _cache.erase(hash);
+    return NULL;
+  }
+
+  ++_pages_read;
+  return &data[0];
+}
+
+bool CaptureIndex::read( size_t r, uint64_t offset, unsigned char *buffer, size_t size ) {
+  const vector<string>& pages = _regions[r].pages;
+
+  while( size ){
+    size_t n = offset / PAGE_STORE_PAGE_SIZE,
+           off = offset % PAGE_STORE_PAGE_SIZE,
+           chunk = std::min( size, (size_t)( PAGE_STORE_PAGE_SIZE - off ) );
+
+    if( n >= pages.size() ){
+      return false;
+    }
+
+    const unsigned char *data = page( pages[n] );
+    if( data == NULL ){
+      return false;
+    }
+
+    memcpy( buffer, data + off, chunk );
+    buffer += chunk;
+    offset += chunk;
+    size   -= chunk;
+  }
+
+  return true;
+}
+
+void CaptureIndex::addMatch( size_t r, uint64_t offset, size_t size, vector<Matches>& matches ) {
+  uint64_t left = (uint64_t)_regions[r].pages.size() * PAGE_STORE_PAGE_SIZE - offset;
+  Match m;
+
+  m.offset = offset;
+  m.length = size;
+  m.context.resize( std::min( (uint64_t)std::max( size, (size_t)SEARCH_CONTEXT_SIZE ), left ) );
+
+  // the context may run into an unreadable page, the match itself can't.
+  if( read( r, offset, &m.context[0], m.context.size() ) == false ){
+    m.context.resize(size);
+    read( r, offset, &m.context[0], size );
+  }
+
+  matches[r].push_back(m);
+}
+
+void CaptureIndex::scan( const unsigned char *pattern, size_t size, const vector<bool>& allowed, vector<Matches>& matches ) {
+  vector<unsigned char> window;
+  unsigned char data[PAGE_STORE_PAGE_SIZE];
+
+  _scanned = true;
+
+  for( size_t r = 0; r < _regions.size(); ++r ){
+    const vector<string>& pages = _regions[r].pages;
+    if( allowed[r] == false ){
+      continue;
+    }
+
+    // window is the last size - 1 bytes of the previous pages, then this one
+    window.clear();
+
+    for( size_t n = 0; n < pages.size(); ++n ){
+      if( _store.get( pages[n], data ) == false ){
+        window.clear();
+        continue;
+      }
+      ++_pages_read;
+
+      window.insert( window.end(), data, data + PAGE_STORE_PAGE_SIZE );
+
+      uint64_t base = (uint64_t)( n + 1 ) * PAGE_STORE_PAGE_SIZE - window.size();
+      const unsigned char *p = &window[0],
+                          *e = &window[0] + window.size();
+
+      while( (size_t)( e - p ) >= size && ( p = (const unsigned char *)memchr( p, pattern[0], e - p - size + 1 ) ) != NULL ){
+        if( memcmp( p, pattern, size ) == 0 ){
+          addMatch( r, base + ( p - &window[0] ), size, matches );
+        }
+        ++p;
+      }
+
+      if( window.size() >= size ){
+        window.erase( window.begin(), window.end() - ( size - 1 ) );
+      }
+    }
+  }
+}
+
+bool CaptureIndex::search( const unsigned char *pattern, size_t size, RegionFilter& filter, vector<Matches>& matches ) {
+  double start = now();
+
+  matches.assign( _regions.size(), Matches() );
+  if( _loaded == false ){
+    return false;
+  }
+  _candidates = 0;
+  _pages_read = 0;
+  _scanned = false;
+
+  if( size == 0 ){
+    return false;
+  }
+
+  vector<bool> allowed( _regions.size() );
+  for( size_t r = 0; r < _regions.size(); ++r ){
+    allowed[r] = filter.select( _regions[r].region );
+  }
+
+  // the gram to look up for every alignment of the pattern, the one with
+  // the shortest posting list.
+  size_t best[CAPTURE_INDEX_STRIDE];
+  bool usable = _header != NULL && size >= CAPTURE_INDEX_STRIDE + CAPTURE_INDEX_GRAM - 1;
+
+  for( size_t r = 0; usable && r < CAPTURE_INDEX_STRIDE; ++r ){
+    uint32_t least = 0xffffffff;
+
+    best[r] = size;
+    for( size_t j = r; j + CAPTURE_INDEX_GRAM <= size; j += CAPTURE_INDEX_STRIDE ){
+      uint32_t gram = load_gram( pattern + j );
+      if( is_stop_gram(gram) ){
+        continue;
+      }
+
+      uint32_t b = gram_bucket( gram, _header->bits ),
+               count = _buckets[b + 1] - _buckets[b];
+      if( count < least ){
+        least = count;
+        best[r] = j;
+      }
+    }
+
+    usable = best[r] != size;
+  }
+
+  if( usable == false ){
+    scan( pattern, size, allowed, matches );
+  }
+  else {
+    vector<unsigned char> buffer(size);
+
+    // every position p holding the gram at j of the pattern is a candidate
+    // match at p - j, every alignment is covered by exactly one gram.
+    for( size_t r = 0; r < CAPTURE_INDEX_STRIDE; ++r ){
+      uint32_t b = gram_bucket( load_gram( pattern + best[r] ), _header->bits );
+
+      for( uint32_t k = _buckets[b]; k < _buckets[b + 1]; ++k ){
+        uint64_t position = _postings[k];
+        if( position < best[r] ){
+          continue;
+        }
+
+        position -= best[r];
+        ++_candidates;
+
+        size_t region = findRegion(position);
+        uint64_t offset = position - _starts[region];
+
+        if( allowed[region] == false || offset + size > (uint64_t)_regions[region].pages.size() * PAGE_STORE_PAGE_SIZE ){
+          continue;
+        }
+        else if( read( region, offset, &buffer[0], size ) && memcmp( &buffer[0], pattern, size ) == 0 ){
+          addMatch( region, offset, size, matches );
+        }
+      }
+    }
+
+    for( vector<Matches>::iterator i = matches.begin(), e = matches.end(); i != e; ++i ){
+      std::sort( i->begin(), i->end(), match_less );
+    }
+  }
+
+  _query_time = now() - start;
+
+  return true;
+}
+
+void CaptureIndex::stats() const {
+  if( _build_time ){
+    printf( "Indexed %u regions ( %llu KB ) in %.2f ms : %u positions in %u buckets, %u KB on disk.\n",
+            _regions.size(),
+            (unsigned long long)( _total / 1024 ),
+            _build_time * 1000.0,
+            _header ? _header->npostings : 0,
+            _header ? 1 << _header->bits : 0,
+            _map_size / 1024 );
+  }
+  else {
+    printf( "Query took %.2f ms ( %s ) : %u candidates verified, %u pages read.\n",
+            _query_time * 1000.0,
+            _scanned ? "linear scan" : "index",
+            _candidates,
+            _pages_read );
+  }
+}
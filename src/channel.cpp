@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <algorithm>
+
+#include "channel.h"
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Channel::Channel( pid_t pid ) :
+  _pid(pid),
+  _socket(-1),
+  _fd(-1),
+  _shm(NULL),
+  _header(NULL),
+  _input(NULL),
+  _ring(NULL),
+  _next_id(1),
+  _consumed(0),
+  _reads(0),
+  _bytes(0),
+  _skipped(0),
+  _received(0) {
+
+}
+
+Channel::~Channel() {
+  if( _shm ){
+    munmap( _shm, AGENT_SHM_SIZE );
+  }
+  if( _fd != -1 ){
+    close( _fd );
+  }
+  // the agent drops every watch once we hang up
+  if( _socket != -1 ){
+    close( _socket );
+  }
+}
+
+bool Channel::connect( unsigned int timeout /* = CHANNEL_TIMEOUT */ ) {
+  struct sockaddr_un addr;
+  socklen_t len;
+  double deadline = now() + timeout / 1000.0;
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  snprintf( addr.sun_path + 1, sizeof(addr.sun_path) - 1, AGENT_SOCKET_NAME, _pid );
+  len = offsetof( struct sockaddr_un, sun_path ) + 1 + strlen( addr.sun_path + 1 );
+
+  while( true ){
+    _socket = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( _socket < 0 ){
+      perror("socket");
+      return false;
+    }
+
+    if( ::connect( _socket, (struct sockaddr *)&addr, len ) == 0 ){
+      break;
+    }
+
+    close( _socket );
+    _socket = -1;
+
+    if( now() > deadline ){
+      fprintf( stderr, "Could not connect to the agent on @%s.\n", addr.sun_path + 1 );
+      return false;
+    }
+    usleep( 10000 );
+  }
+
+  // a stale socket might accept us without anybody answering
+  struct timeval tv = { CHANNEL_TIMEOUT / 1000, ( CHANNEL_TIMEOUT % 1000 ) * 1000 };
+  setsockopt( _socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+
+  // the agent sends its magic with the memfd attached
+  struct msghdr msg;
+  struct iovec iov;
+  char control[CMSG_SPACE(sizeof(int))];
+  uint32_t magic = 0;
+
+  memset( &msg, 0, sizeof(msg) );
+  iov.iov_base = &magic;
+  iov.iov_len  = sizeof(magic);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  if( recvmsg( _socket, &msg, 0 ) != sizeof(magic) || magic != AGENT_MAGIC ){
+    fprintf( stderr, "Unexpected handshake from the agent.\n" );
+    return false;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if( cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ){
+    fprintf( stderr, "The agent did not send the shared memory.\n" );
+    return false;
+  }
+  memcpy( &_fd, CMSG_DATA(cmsg), sizeof(int) );
+
+  _shm = (unsigned char *)mmap( NULL, AGENT_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0 );
+  if( _shm == MAP_FAILED ){
+    _shm = NULL;
+    perror("mmap");
+    return false;
+  }
+
+  _header = (agent_header_t *)_shm;
+  _input  = _shm + AGENT_HEADER_SIZE;
+  _ring   = _input + AGENT_INPUT_SIZE;
+
+  if( _header->magic != AGENT_MAGIC || _header->version != AGENT_VERSION || _header->ring_size != AGENT_RING_SIZE ){
+    fprintf( stderr, "Agent version mismatch.\n" );
+    return false;
+  }
+
+  return true;
+}
+
+bool Channel::post( uint32_t type, uintptr_t address, uint64_t size, uint32_t block /* = 0 */, uint32_t hz /* = 0 */ ) {
+  double deadline = now() + CHANNEL_TIMEOUT / 1000.0;
+
+  while( _header->cmd_head - _header->cmd_tail >= AGENT_MAX_COMMANDS ){
+    if( now() > deadline ){
+      fprintf( stderr, "The agent is not responding.\n" );
+      return false;
+    }
+    sched_yield();
+  }
+
+  agent_command_t *cmd = &_header->commands[ _header->cmd_head % AGENT_MAX_COMMANDS ];
+
+  cmd->id      = _next_id++;
+  cmd->type    = type;
+  cmd->address = address;
+  cmd->size    = size;
+  cmd->block   = block;
+  cmd->hz      = hz;
+
+  // publish the command only once it's complete
+  __sync_synchronize();
+  _header->cmd_head++;
+
+  return true;
+}
+
+const agent_record_t *Channel::next() {
+  // the previous record is consumed, the agent can overwrite it
+  if( _consumed ){
+    __sync_synchronize();
+    _header->ring_tail += _consumed;
+    _consumed = 0;
+  }
+
+  while( _header->ring_tail != _header->ring_head ){
+    uint32_t tail = _header->ring_tail,
+             pos  = tail & ( AGENT_RING_SIZE - 1 ),
+             left = AGENT_RING_SIZE - pos;
+
+    __sync_synchronize();
+
+    const agent_record_t *record = (const agent_record_t *)( _ring + pos );
+
+    if( left < sizeof(agent_record_t) || record->type == AGENT_REC_PAD ){
+      _header->ring_tail = tail + left;
+      continue;
+    }
+
+    _consumed = AGENT_ALIGN( sizeof(agent_record_t) + record->size );
+    _received += _consumed;
+
+    return record;
+  }
+
+  return NULL;
+}
+
+bool Channel::read( uintptr_t address, unsigned char *buffer, size_t size ) {
+  size_t done = 0;
+
+  while( done < size ){
+    size_t chunk = std::min( size - done, (size_t)AGENT_MAX_PAYLOAD );
+    uint32_t id = _next_id;
+    double deadline = now() + CHANNEL_TIMEOUT / 1000.0;
+
+    if( post( AGENT_CMD_READ, address + done, chunk ) == false ){
+      return false;
+    }
+
+    while( true ){
+      const agent_record_t *record = next();
+
+      if( record == NULL ){
+        if( now() > deadline ){
+          fprintf( stderr, "The agent is not responding.\n" );
+          return false;
+        }
+        sched_yield();
+        continue;
+      }
+      else if( record->id != id ){
+        ++_skipped;
+        continue;
+      }
+      else if( record->type != AGENT_REC_DATA ){
+        return false;
+      }
+
+      // copy out before the agent reuses the space
+      memcpy( buffer + done, record + 1, chunk );
+      break;
+    }
+
+    done += chunk;
+    ++_reads;
+  }
+
+  _bytes += size;
+  return true;
+}
+
+bool Channel::watch( uintptr_t address, size_t size, uint32_t block, uint32_t hz ) {
+  return post( AGENT_CMD_WATCH, address, size, block, hz );
+}
+
+bool Channel::unwatch( uintptr_t address /* = 0 */ ) {
+  return post( AGENT_CMD_UNWATCH, address, 0 );
+}
+
+bool Channel::search( const Patterns& patterns, const vector<const MemoryMap *>& regions, size_t context, size_t jobs,
+                      vector<AgentMatch>& matches, vector<uintptr_t>& failed, uint64_t& scanned ) {
+  size_t lengths = AGENT_ALIGN( patterns.size() * sizeof(uint32_t) ), bytes = 0;
+
+  for( Patterns::const_iterator i = patterns.begin(), e = patterns.end(); i != e; ++i ){
+    bytes += i->size();
+  }
+
+  size_t used = sizeof(agent_search_t) + lengths + AGENT_ALIGN(bytes) + regions.size() * sizeof(agent_range_t);
+
+  if( patterns.empty() || patterns.size() > AGENT_MAX_PATTERNS || used > AGENT_INPUT_SIZE ){
+    fprintf( stderr, "Too many patterns or regions for the agent.\n" );
+    return false;
+  }
+
+  // the agent copies what it needs before answering, so the input area is
+  // free again once the search is over.
+  agent_search_t *args = (agent_search_t *)_input;
+  uint32_t *plengths = (uint32_t *)( _input + sizeof(agent_search_t) );
+  unsigned char *pbytes = (unsigned char *)plengths + lengths;
+  agent_range_t *pregions = (agent_range_t *)( pbytes + AGENT_ALIGN(bytes) );
+
+  args->npatterns = patterns.size();
+  args->nregions  = regions.size();
+  args->context   = context;
+  args->threads   = jobs;
+
+  for( size_t i = 0; i < patterns.size(); ++i ){
+    plengths[i] = patterns[i].size();
+    memcpy( pbytes, &patterns[i][0], patterns[i].size() );
+    pbytes += patterns[i].size();
+  }
+
+  for( size_t i = 0; i < regions.size(); ++i ){
+    pregions[i].begin = regions[i]->begin();
+    pregions[i].end   = regions[i]->end();
+  }
+
+  uint32_t id = _next_id;
+
+  if( post( AGENT_CMD_SEARCH, 0, used ) == false ){
+    return false;
+  }
+
+  // no deadline as long as the agent shows signs of life
+  uint32_t heartbeat = _header->heartbeat;
+  double deadline = now() + CHANNEL_TIMEOUT / 1000.0;
+
+  while( true ){
+    const agent_record_t *record = next();
+
+    if( record == NULL ){
+      if( _header->heartbeat != heartbeat ){
+        heartbeat = _header->heartbeat;
+        deadline = now() + CHANNEL_TIMEOUT / 1000.0;
+      }
+      else if( now() > deadline ){
+        fprintf( stderr, "The agent is not responding.\n" );
+        return false;
+      }
+      sched_yield();
+      continue;
+    }
+    else if( record->id != id ){
+      ++_skipped;
+      continue;
+    }
+
+    deadline = now() + CHANNEL_TIMEOUT / 1000.0;
+
+    if( record->type == AGENT_REC_MATCH ){
+      AgentMatch match;
+      const unsigned char *data = (const unsigned char *)( record + 1 );
+
+      match.address = record->address;
+      match.pattern = record->reserved;
+      match.context.assign( data, data + record->size );
+      matches.push_back( match );
+    }
+    else if( record->type == AGENT_REC_ERROR ){
+      // invalid arguments
+      if( record->address == 0 ){
+        return false;
+      }
+      failed.push_back( record->address );
+    }
+    else if( record->type == AGENT_REC_DONE ){
+      scanned = record->address;
+      return true;
+    }
+  }
+}
+
+void Channel::stats() const {
+  printf( "Agent pid     : %u\n", _header ? _header->pid : 0 );
+  printf( "Ring size     : %u KB\n", AGENT_RING_SIZE / 1024 );
+  printf( "Reads         : %u ( %u KB )\n", _reads, _bytes / 1024 );
+  printf( "Dropped       : %u records\n", _header ? _header->dropped : 0 );
+  printf( "Skipped       : %u records\n", _skipped );
+  printf( "Received      : %u KB\n", _received / 1024 );
+}
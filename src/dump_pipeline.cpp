@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "dump_pipeline.h"
+
+// dumps go past 2 GB, where off_t ends on 32 bit targets
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+DumpPipeline::DumpPipeline( Tracer *tracer, size_t readers /* = DUMP_READERS */, size_t buffers /* = DUMP_BUFFERS */, size_t chunk /* = DUMP_CHUNK_SIZE */ ) :
+  _tracer(tracer),
+  _readers( readers ? readers : 1 ),
+  _chunk( chunk ? chunk : DUMP_CHUNK_SIZE ),
+  _total(0),
+  _fd(-1),
+  _nchunks(0),
+  _next(0),
+  _running(0),
+  _failed(0),
+  _unreadable(0),
+  _write_errors(0),
+  _read_busy(0),
+  _write_busy(0),
+  _elapsed(0) {
+
+  if( Tracer::canReadWithoutStopping() == false ){
+    _readers = 1;
+  }
+
+  // at least one buffer being read and one being written per reader
+  _buffers.resize( std::max( buffers, _readers + 1 ) );
+  for( size_t i = 0; i < _buffers.size(); ++i ){
+    _buffers[i].data = new unsigned char[ _chunk ];
+  }
+
+  pthread_mutex_init( &_lock, NULL );
+  pthread_cond_init( &_can_read, NULL );
+  pthread_cond_init( &_can_write, NULL );
+}
+
+DumpPipeline::~DumpPipeline() {
+  for( size_t i = 0; i < _buffers.size(); ++i ){
+    delete[] _buffers[i].data;
+  }
+
+  pthread_mutex_destroy( &_lock );
+  pthread_cond_destroy( &_can_read );
+  pthread_cond_destroy( &_can_write );
+}
+
+void DumpPipeline::add( uintptr_t begin, uintptr_t end, const string& name /* = "" */ ) {
+  DumpRange range;
+
+  if( end <= begin ){
+    return;
+  }
+
+  range.begin  = begin;
+  range.end    = end;
+  range.offset = _total;
+  range.first  = _nchunks;
+  range.name   = name;
+
+  _ranges.push_back( range );
+  _total   += end - begin;
+  _nchunks += ( end - begin + _chunk - 1 ) / _chunk;
+}
+
+bool DumpPipeline::locate( size_t chunk, uintptr_t& address, size_t& size, off64_t& offset ) const {
+  size_t lo = 0, hi = _ranges.size();
+
+  // last range whose first chunk is <= chunk
+  while( hi - lo > 1 ){
+    size_t mid = ( lo + hi ) / 2;
+    if( _ranges[mid].first <= chunk ){
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  if( _ranges.empty() ){
+    return false;
+  }
+
+  const DumpRange& range = _ranges[lo];
+  size_t delta = ( chunk - range.first ) * _chunk;
+
+  address = range.begin + delta;
+  size    = std::min( _chunk, (size_t)( range.end - address ) );
+  offset  = range.offset + delta;
+
+  return true;
+}
+
+void *DumpPipeline::reader( void *arg ) {
+  ((DumpPipeline *)arg)->readLoop();
+  return NULL;
+}
+
+void *DumpPipeline::writer( void *arg ) {
+  ((DumpPipeline *)arg)->writeLoop();
+  return NULL;
+}
+
+void DumpPipeline::readLoop() {
+  while( true ){
+    pthread_mutex_lock( &_lock );
+    if( _next >= _nchunks ){
+      break;
+    }
+
+    size_t chunk = _next++;
+    while( _free.empty() ){
+      pthread_cond_wait( &_can_read, &_lock );
+    }
+    size_t index = _free.back();
+    _free.pop_back();
+    pthread_mutex_unlock( &_lock );
+
+    Buffer& buffer = _buffers[index];
+    locate( chunk, buffer.address, buffer.size, buffer.offset );
+
+    double t = now();
+    size_t got = _tracer->salvage( buffer.address, buffer.data, buffer.size );
+    t = now() - t;
+
+    pthread_mutex_lock( &_lock );
+    _read_busy += t;
+    // unreadable pages of the chunk are zero filled
+    _unreadable += buffer.size - got;
+    if( got ){
+      _filled.push_back( index );
+      pthread_cond_signal( &_can_write );
+    }
+    else {
+      // leave a hole in the file, the other chunks keep their offsets
+      fprintf( stderr, "  Could not read %u bytes @ %p.\n", buffer.size, buffer.address );
+      ++_failed;
+      _free.push_back( index );
+      pthread_cond_signal( &_can_read );
+    }
+    pthread_mutex_unlock( &_lock );
+  }
+
+  // the lock is still held here
+  --_running;
+  pthread_cond_signal( &_can_write );
+  pthread_mutex_unlock( &_lock );
+}
+
+void DumpPipeline::writeLoop() {
+  while( true ){
+    pthread_mutex_lock( &_lock );
+    while( _filled.empty() && _running > 0 ){
+      pthread_cond_wait( &_can_write, &_lock );
+    }
+    if( _filled.empty() ){
+      pthread_mutex_unlock( &_lock );
+      break;
+    }
+    size_t index = _filled.back();
+    _filled.pop_back();
+    pthread_mutex_unlock( &_lock );
+
+    Buffer& buffer = _buffers[index];
+    size_t done = 0;
+    double t = now();
+
+    while( done < buffer.size ){
+      ssize_t n = pwrite64( _fd, buffer.data + done, buffer.size - done, buffer.offset + done );
+      if( n <= 0 ){
+        if( n < 0 && errno == EINTR ){
+          continue;
+        }
+        perror("pwrite");
+        break;
+      }
+      done += n;
+    }
+    t = now() - t;
+
+    pthread_mutex_lock( &_lock );
+    _write_busy += t;
+    if( done < buffer.size ){
+      ++_write_errors;
+    }
+    _free.push_back( index );
+    pthread_cond_signal( &_can_read );
+    pthread_mutex_unlock( &_lock );
+  }
+}
+
+bool DumpPipeline::run( const char *output ) {
+  double start = now();
+  pthread_t writer_thread;
+  vector<pthread_t> threads;
+
+  _fd = open( output, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0755 );
+  if( _fd == -1 ){
+    perror("open");
+    fprintf( stderr, "Failed to create dump file.\n" );
+    return false;
+  }
+
+  _next = 0;
+  _free.clear();
+  _filled.clear();
+  for( size_t i = 0; i < _buffers.size(); ++i ){
+    _free.push_back(i);
+  }
+
+  // this thread is a reader too, the only one allowed to use ptrace
+  _running = _readers;
+
+  if( pthread_create( &writer_thread, NULL, DumpPipeline::writer, this ) != 0 ){
+    perror("pthread_create");
+    close( _fd );
+    return false;
+  }
+
+  for( size_t i = 1; i < _readers; ++i ){
+    pthread_t tid;
+    if( pthread_create( &tid, NULL, DumpPipeline::reader, this ) != 0 ){
+      pthread_mutex_lock( &_lock );
+      --_running;
+      pthread_mutex_unlock( &_lock );
+      continue;
+    }
+    threads.push_back( tid );
+  }
+
+  readLoop();
+
+  for( size_t i = 0; i < threads.size(); ++i ){
+    pthread_join( threads[i], NULL );
+  }
+  pthread_join( writer_thread, NULL );
+
+  // unreadable chunks at the end must still count in the file size
+  if( ftruncate64( _fd, _total ) != 0 ){
+    perror("ftruncate");
+  }
+  close( _fd );
+  _fd = -1;
+
+  // we're running as root, we need to chmod the file in order to pull it.
+  chmod( output, 0755 );
+
+  _elapsed = now() - start;
+
+  return _failed == 0 && _write_errors == 0;
+}
+
+bool DumpPipeline::saveIndex( const char *output ) const {
+  FILE *fp = fopen( output, "wt" );
+  if( !fp ){
+    perror("fopen");
+    return false;
+  }
+
+  for( vector<DumpRange>::const_iterator i = _ranges.begin(), e = _ranges.end(); i != e; ++i ){
+    fprintf( fp, "%08llx %p-%p %s\n", (unsigned long long)i->offset, (void *)i->begin, (void *)i->end, i->name.c_str() );
+  }
+
+  fclose(fp);
+  chmod( output, 0755 );
+  return true;
+}
+
+void DumpPipeline::stats() const {
+  double mb = _total / ( 1024.0 * 1024.0 );
+
+  printf( "Dumped        : %llu KB in %u ranges\n", (unsigned long long)( _total / 1024 ), _ranges.size() );
+  printf( "Time          : %.2f ms ( %.2f MB/s )\n", _elapsed * 1000.0, _elapsed > 0 ? mb / _elapsed : 0 );
+  printf( "Buffers       : %u x %u KB, %u readers\n", _buffers.size(), _chunk / 1024, _readers );
+  printf( "Reading       : %.2f ms busy\n", _read_busy * 1000.0 );
+  printf( "Writing       : %.2f ms busy\n", _write_busy * 1000.0 );
+  printf( "Unreadable    : %u KB\n", _unreadable / 1024 );
+  printf( "Failed chunks : %u\n", _failed + _write_errors );
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "file_cache.h"
+
+#ifndef major
+#include <sys/sysmacros.h>
+#endif
+
+FileCache::FileCache( size_t max /* = FILE_CACHE_MAX_MAPPED */ ) :
+  _mapped(0),
+  _max(max),
+  _from_file(0),
+  _from_process(0) {
+
+  pthread_mutex_init( &_lock, NULL );
+}
+
+FileCache::~FileCache() {
+  for( map<string, File>::iterator i = _files.begin(), e = _files.end(); i != e; ++i ){
+    if( i->second.data ){
+      munmap( (void *)i->second.data, i->second.size );
+    }
+  }
+  pthread_mutex_destroy( &_lock );
+}
+
+const unsigned char *FileCache::get( const MemoryMap& region, size_t& size ) {
+  // devices ( ashmem, etc ) have inodes too, but no file to map
+  if( region.isFileBacked() == false || region.name().compare( 0, 5, "/dev/" ) == 0 ){
+    return NULL;
+  }
+
+  char key[0xFF] = {0};
+  snprintf( key, sizeof(key), "%s:%lu", region.device().c_str(), (unsigned long)region.inode() );
+
+  pthread_mutex_lock( &_lock );
+
+  map<string, File>::iterator i = _files.find(key);
+  if( i != _files.end() ){
+    size = i->second.size;
+    pthread_mutex_unlock( &_lock );
+    return i->second.data;
+  }
+
+  File file = { NULL, 0 };
+  unsigned int dev_major = 0, dev_minor = 0;
+  struct stat st;
+  int fd = open( region.name().c_str(), O_RDONLY );
+
+  // the path might have been replaced since it was mapped, " (deleted)"
+  // ones don't even open.
+  if( fd != -1 &&
+      fstat( fd, &st ) == 0 &&
+      st.st_ino == region.inode() &&
+      sscanf( region.device().c_str(), "%x:%x", &dev_major, &dev_minor ) == 2 &&
+      major(st.st_dev) == dev_major && minor(st.st_dev) == dev_minor &&
+      st.st_size > 0 &&
+      _mapped + st.st_size <= _max ){
+
+    void *data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    if( data != MAP_FAILED ){
+      file.data = (const unsigned char *)data;
+      file.size = st.st_size;
+      _mapped  += st.st_size;
+    }
+  }
+
+  if( fd != -1 ){
+    close(fd);
+  }
+
+  _files[key] = file;
+  size = file.size;
+
+  pthread_mutex_unlock( &_lock );
+
+  return file.data;
+}
+
+bool FileCache::clean( const MemoryMap& region, uintptr_t page, uint64_t entry, size_t size ) {
+  uintptr_t offset = region.offset() + ( page - region.begin() );
+
+  // beyond the end of the file the process gets SIGBUS, so do we
+  if( offset >= size ){
+    return false;
+  }
+
+  // a present page is either the file's one or a private copy of it, a
+  // missing one is still in the file unless it's a private copy swapped out.
+  return ( entry & PAGEMAP_PRESENT ) ? ( entry & PAGEMAP_FILE ) != 0 : ( entry & PAGEMAP_SWAPPED ) == 0;
+}
+
+void FileCache::account( size_t from_file, size_t from_process ) {
+  __sync_fetch_and_add( &_from_file, from_file );
+  __sync_fetch_and_add( &_from_process, from_process );
+}
+
+void FileCache::stats() const {
+  size_t total = _from_file + _from_process, used = 0;
+
+  if( total == 0 ){
+    return;
+  }
+
+  for( map<string, File>::const_iterator i = _files.begin(), e = _files.end(); i != e; ++i ){
+    used += i->second.data != NULL;
+  }
+
+  printf( "File backed memory : %u KB, %u KB ( %.1f%% ) copied from %u mapped files, %u KB of dirty pages or unmapped files read from the process.\n",
+          total / 1024,
+          _from_file / 1024,
+          _from_file * 100.0 / total,
+          used,
+          _from_process / 1024 );
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include "hash.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define PRIME32_1 2654435761U
+#define PRIME32_2 2246822519U
+#define PRIME32_3 3266489917U
+#define PRIME32_4  668265263U
+#define PRIME32_5  374761393U
+
+static inline uint32_t rotl32( uint32_t x, int r ) {
+  return ( x << r ) | ( x >> ( 32 - r ) );
+}
+
+static inline uint32_t read32( const unsigned char *p ) {
+  uint32_t v;
+  memcpy( &v, p, sizeof(v) );
+  return v;
+}
+
+static inline uint32_t round32( uint32_t acc, uint32_t input ) {
+  acc += input * PRIME32_2;
+  acc  = rotl32( acc, 13 );
+  return acc * PRIME32_1;
+}
+
+uint32_t hash32( const unsigned char *data, size_t size, uint32_t seed /* = 0 */ ) {
+  const unsigned char *p = data, *end = data + size;
+  uint32_t h;
+
+  if( size >= 16 ){
+    const unsigned char *limit = end - 16;
+    uint32_t v[4] = { seed + PRIME32_1 + PRIME32_2, seed + PRIME32_2, seed, seed - PRIME32_1 };
+
+#if defined(__ARM_NEON__)
+    uint32x4_t acc = vld1q_u32(v),
+               p1  = vdupq_n_u32(PRIME32_1),
+               p2  = vdupq_n_u32(PRIME32_2);
+
+    do {
+      uint32x4_t input = vreinterpretq_u32_u8( vld1q_u8(p) );
+
+      acc = vmlaq_u32( acc, input, p2 );
+      acc = vorrq_u32( vshlq_n_u32( acc, 13 ), vshrq_n_u32( acc, 19 ) );
+      acc = vmulq_u32( acc, p1 );
+      p  += 16;
+    } while( p <= limit );
+
+    vst1q_u32( v, acc );
+#else
+    do {
+      v[0] = round32( v[0], read32(p) );
+      v[1] = round32( v[1], read32(p + 4) );
+      v[2] = round32( v[2], read32(p + 8) );
+      v[3] = round32( v[3], read32(p + 12) );
+      p += 16;
+    } while( p <= limit );
+#endif
+
+    h = rotl32( v[0], 1 ) + rotl32( v[1], 7 ) + rotl32( v[2], 12 ) + rotl32( v[3], 18 );
+  }
+  else {
+    h = seed + PRIME32_5;
+  }
+
+  h += (uint32_t)size;
+
+  for( ; p + 4 <= end; p += 4 ){
+    h += read32(p) * PRIME32_3;
+    h  = rotl32( h, 17 ) * PRIME32_4;
+  }
+
+  for( ; p < end; ++p ){
+    h += (*p) * PRIME32_5;
+    h  = rotl32( h, 11 ) * PRIME32_1;
+  }
+
+  h ^= h >> 15;
+  h *= PRIME32_2;
+  h ^= h >> 13;
+  h *= PRIME32_3;
+  h ^= h >> 16;
+
+  return h;
+}
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <algorithm>
+
+#include "injector.h"
+#include "remote_arena.h"
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+MultiInject::MultiInject( const vector<Process *>& targets, const string& library, size_t jobs ) :
+  _library(library),
+  _jobs( jobs ? jobs : 1 ),
+  _next(0),
+  _elapsed(0) {
+
+  for( vector<Process *>::const_iterator i = targets.begin(), e = targets.end(); i != e; ++i ){
+    InjectTarget target;
+    target.process = *i;
+    _targets.push_back( target );
+  }
+
+  // the same libraries Tracer::getSymbols resolves against
+  Process *self = Process::open( getpid() );
+  uintptr_t locals[] = { (uintptr_t)::dlopen, (uintptr_t)::dlsym, (uintptr_t)::dlerror, (uintptr_t)::calloc, (uintptr_t)::free };
+
+  for( size_t i = 0; self && i < sizeof(locals) / sizeof(locals[0]); ++i ){
+    const MemoryMap *region = self->findRegion( locals[i] );
+    if( region ){
+      _libraries.insert( region->name() );
+    }
+  }
+  delete self;
+}
+
+MultiInject::~MultiInject() {
+  for( vector<InjectTarget>::iterator i = _targets.begin(), e = _targets.end(); i != e; ++i ){
+    delete i->tracer;
+  }
+}
+
+// Processes forked from the same zygote map libc and the linker from the
+// same files at the same addresses, so they share the remote symbols.
+string MultiInject::symbolsKey( const Process *process ) const {
+  string key;
+  char buffer[0xFF] = {0};
+
+  PROCESS_FOREACH_MAP_CONST( process ){
+    if( i->isExecutable() && _libraries.count( i->name() ) ){
+      sprintf( buffer, "%s@%lx:%s:%lu;", i->name().c_str(), (unsigned long)i->begin(), i->device().c_str(), (unsigned long)i->inode() );
+      key += buffer;
+    }
+  }
+
+  return key;
+}
+
+void MultiInject::start() {
+  while( _running.size() < _jobs && _next < _targets.size() ){
+    size_t index = _next++;
+    InjectTarget& target = _targets[index];
+
+    target.tracer = new Tracer( target.process, TRACER_ASYNC );
+    if( target.tracer->isAttached() == false ){
+      fail( target, "could not attach" );
+      continue;
+    }
+
+    target.state = INJECT_ATTACHING;
+    _running[ target.process->pid() ] = index;
+  }
+}
+
+void MultiInject::fail( InjectTarget& target, const char *error ) {
+  target.error = error;
+  target.state = INJECT_FAILED;
+
+  target.transfers = target.tracer->registerTransfers();
+  target.syscalls  = target.tracer->syscalls();
+  delete target.tracer;
+  target.tracer = NULL;
+
+  if( target.stopped_at ){
+    target.stopped = now() - target.stopped_at;
+  }
+}
+
+void MultiInject::finish( InjectTarget& target ) {
+  target.tracer->arena()->free( target.path );
+  target.state = INJECT_DONE;
+
+  // not counting the munmap of the arena and the registers put back
+  target.transfers = target.tracer->registerTransfers();
+  target.syscalls  = target.tracer->syscalls();
+
+  // releases the arena and detaches
+  delete target.tracer;
+  target.tracer = NULL;
+
+  target.stopped = now() - target.stopped_at;
+}
+
+void MultiInject::callDlopen( InjectTarget& target ) {
+  Tracer *tracer = target.tracer;
+  uintptr_t args[] = { target.path, 0 };
+
+  if( tracer->beginCall( tracer->getSymbols()->_dlopen, 2, args ) == false ){
+    fail( target, "could not call dlopen" );
+    return;
+  }
+
+  target.state = INJECT_DLOPEN;
+}
+
+bool MultiInject::slices() {
+  bool waiting = false;
+  double t = now();
+
+  for( map<pid_t, size_t>::iterator i = _running.begin(), e = _running.end(); i != e; ++i ){
+    InjectTarget& target = _targets[i->second];
+
+    if( target.state != INJECT_SAFEPOINT ){
+      continue;
+    }
+
+    waiting = true;
+    if( target.interrupted == false && t - target.slice_at >= TRACER_SAFEPOINT_SLICE / 1e6 ){
+      target.interrupted = target.tracer->interrupt();
+    }
+  }
+
+  return waiting;
+}
+
+void MultiInject::step( InjectTarget& target, int status ) {
+  if( WIFEXITED(status) || WIFSIGNALED(status) ){
+    fail( target, "process terminated" );
+    return;
+  }
+  else if( !WIFSTOPPED(status) ){
+    return;
+  }
+
+  int sig = WSTOPSIG(status);
+  Tracer *tracer = target.tracer;
+
+  if( target.state == INJECT_ATTACHING ){
+    // some other signal arrived before the attach stop, deliver it
+    if( sig != SIGSTOP ){
+      tracer->resume( sig );
+      return;
+    }
+
+    target.stopped_at = now();
+
+    string key = symbolsKey( target.process );
+    map<string, Symbols>::iterator cached = _symbols.find( key );
+    if( cached != _symbols.end() ){
+      tracer->setSymbols( cached->second );
+      target.shared_symbols = true;
+    }
+    else if( tracer->getSymbols() == NULL ){
+      fail( target, "could not resolve process symbols" );
+      return;
+    }
+    else {
+      _symbols[key] = *tracer->getSymbols();
+    }
+
+    // remote syscalls, safe wherever the process stopped
+    target.path = tracer->writeString( _library.c_str() );
+    if( target.path == 0 ){
+      fail( target, "could not allocate remote memory" );
+      return;
+    }
+
+    if( tracer->atSafePoint() ){
+      callDlopen( target );
+    }
+    else if( tracer->resume() ){
+      target.state       = INJECT_SAFEPOINT;
+      target.slice_at    = now();
+      target.interrupted = false;
+    }
+    else {
+      fail( target, "could not resume the process" );
+    }
+    return;
+  }
+
+  if( target.state == INJECT_SAFEPOINT ){
+    // anything but our interruption is for the process itself
+    if( sig != SIGSTOP || target.interrupted == false ){
+      tracer->resume( sig );
+      return;
+    }
+
+    ++target.slices;
+    target.interrupted = false;
+
+    if( tracer->atSafePoint() ){
+      callDlopen( target );
+    }
+    // dlopen could deadlock on a lock the process holds, leave it alone
+    else if( now() - target.stopped_at >= TRACER_SAFEPOINT_TIMEOUT ){
+      char error[64] = {0};
+      snprintf( error, sizeof(error), "no safe point within %.0f ms", TRACER_SAFEPOINT_TIMEOUT * 1000.0 );
+      fail( target, error );
+    }
+    else if( tracer->resume() ){
+      target.slice_at = now();
+    }
+    else {
+      fail( target, "could not resume the process" );
+    }
+    return;
+  }
+
+  // a remote call returns to address 0, anything else is a signal for the
+  // process itself.
+  if( sig != SIGSEGV ){
+    tracer->resume( sig );
+    return;
+  }
+
+  if( target.state == INJECT_DLOPEN ){
+    if( tracer->endCall( target.handle ) == false ){
+      fail( target, "could not get dlopen result" );
+    }
+    else if( target.handle != 0 ){
+      finish( target );
+    }
+    else if( tracer->beginCall( tracer->getSymbols()->_dlerror, 0, NULL ) == false ){
+      fail( target, "could not call dlerror" );
+    }
+    else {
+      target.state = INJECT_DLERROR;
+    }
+  }
+  else if( target.state == INJECT_DLERROR ){
+    uintptr_t error = 0;
+
+    if( tracer->endCall( error ) == false || error == 0 ){
+      target.error = "unknown error";
+    }
+    else {
+      // one page at a time, the string might end right before an unmapped one
+      char buffer[INJECT_MAX_ERROR + 1] = {0};
+      size_t done = 0;
+
+      while( done < INJECT_MAX_ERROR && memchr( buffer, 0, done ) == NULL ){
+        size_t size = std::min( (size_t)INJECT_MAX_ERROR - done, 4096 - ( ( error + done ) & 4095 ) );
+        if( tracer->read( error + done, (unsigned char *)buffer + done, size ) == false ){
+          break;
+        }
+        done += size;
+      }
+
+      target.error = buffer;
+    }
+
+    finish( target );
+  }
+}
+
+void MultiInject::run() {
+  double started = now();
+
+  printf( "Injecting %s into %u processes, %u at a time ...\n\n", _library.c_str(), _targets.size(), std::min( _jobs, _targets.size() ) );
+
+  start();
+
+  while( _running.empty() == false ){
+    int status = 0;
+    // poll while some process runs towards a safe point, block otherwise
+    bool polling = slices();
+    pid_t pid = waitpid( -1, &status, __WALL | ( polling ? WNOHANG : 0 ) );
+
+    if( pid == 0 ){
+      usleep( TRACER_SAFEPOINT_SLICE / 10 );
+      continue;
+    }
+
+    if( pid == -1 ){
+      if( errno == EINTR ){
+        continue;
+      }
+
+      perror("waitpid");
+      for( map<pid_t, size_t>::iterator i = _running.begin(), e = _running.end(); i != e; ++i ){
+        fail( _targets[i->second], "lost track of the process" );
+      }
+      _running.clear();
+      break;
+    }
+
+    map<pid_t, size_t>::iterator running = _running.find( pid );
+    if( running == _running.end() ){
+      continue;
+    }
+
+    InjectTarget& target = _targets[ running->second ];
+
+    step( target, status );
+
+    if( target.state == INJECT_DONE || target.state == INJECT_FAILED ){
+      _running.erase( running );
+      start();
+    }
+  }
+
+  _elapsed = now() - started;
+}
+
+void MultiInject::dump() const {
+  size_t loaded = 0;
+
+  for( vector<InjectTarget>::const_iterator t = _targets.begin(), te = _targets.end(); t != te; ++t ){
+    printf( "Process: %s ( pid=%d )\n", t->process->name().c_str(), t->process->pid() );
+
+    if( t->state == INJECT_DONE && t->handle ){
+      printf( "  handle  : 0x%lx\n", (unsigned long)t->handle );
+      ++loaded;
+    }
+    else {
+      printf( "  error   : %s\n", t->error.c_str() );
+    }
+
+    printf( "  stopped : %.2f ms%s\n", t->stopped * 1000.0, t->shared_symbols ? " ( shared symbols )" : "" );
+    printf( "  ptrace  : %u register transfers, %u remote syscalls\n", t->transfers, t->syscalls );
+    if( t->slices ){
+      printf( "  safe    : reached after %u slices\n", t->slices );
+    }
+    printf( "\n" );
+  }
+
+  printf( "Loaded into %u/%u processes in %.2f ms, symbols resolved %u times.\n", loaded, _targets.size(), _elapsed * 1000.0, _symbols.size() );
+}
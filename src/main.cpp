@@ -29,9 +29,22 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <time.h>
 #include <algorithm>
 
-#include "tracer.h"
+#include "androswat.h"
+#include "watcher.h"
+#include "page_store.h"
+#include "regex.h"
+#include "patcher.h"
+#include "remote_arena.h"
+#include "injector.h"
+#include "channel.h"
+#include "dump_pipeline.h"
+#include "capture_index.h"
+#include "region_filter.h"
+#include "thread_dump.h"
+#include "profiler.h"
 
 typedef enum {
   ACTION_HELP = 0,
@@ -39,7 +52,18 @@ typedef enum {
   ACTION_SEARCH,
   ACTION_READ,
   ACTION_DUMP,
-  ACTION_INJECT
+  ACTION_INJECT,
+  ACTION_WATCH,
+  ACTION_CAPTURE,
+  ACTION_RESTORE,
+  ACTION_STRINGS,
+  ACTION_POINTERS_TO,
+  ACTION_POINTER_MAP,
+  ACTION_PATCH,
+  ACTION_AGENT,
+  ACTION_INDEX,
+  ACTION_THREADS,
+  ACTION_PROFILE
 }
 action_t;
 
@@ -49,19 +73,47 @@ static struct option options[] = {
   { "output", required_argument, 0, 'o' },
   { "size",   required_argument, 0, 's' },
   { "filter", required_argument, 0, 'f' },
+  { "all",       no_argument,       0, 'A' },
+  { "name-glob", required_argument, 0, 'g' },
+  { "jobs",      required_argument, 0, 'j' },
+  { "hz",         required_argument, 0, 'z' },
+  { "block-size", required_argument, 0, 'b' },
+  { "store",      required_argument, 0, 't' },
+  { "address",    required_argument, 0, 'a' },
+  { "encoding",   required_argument, 0, 'e' },
+  { "min-length", required_argument, 0, 'l' },
+  { "unique",     no_argument,       0, 'u' },
+  { "max-memory", required_argument, 0, 'M' },
+  { "depth",      required_argument, 0, 'd' },
+  { "max-offset", required_argument, 0, 'k' },
+  { "in-capture", required_argument, 0, 'Q' },
 
   { "help",   no_argument,       0, 'H' },
   { "show",   no_argument,       0, 'S' },
   { "search", required_argument, 0, 'X' },
+  { "regex",  required_argument, 0, 'E' },
   { "read",   required_argument, 0, 'R' },
   { "dump",   required_argument, 0, 'D' },
   { "inject", required_argument, 0, 'I' },
+  { "watch-mem", required_argument, 0, 'W' },
+  { "capture",   required_argument, 0, 'C' },
+  { "restore",   required_argument, 0, 'T' },
+  { "strings",   no_argument,       0, 'G' },
+  { "pointers-to", required_argument, 0, 'P' },
+  { "pointer-map", no_argument,       0, 'm' },
+  { "patch",       required_argument, 0, 'w' },
+  { "agent",       required_argument, 0, 'L' },
+  { "index",       required_argument, 0, 'Y' },
+  { "threads-dump", no_argument,      0, 'q' },
+  { "profile",     required_argument, 0, 'F' },
   {0,0,0,0}
 };
 
 static pid_t          __pid     = -1;
+static vector<pid_t>  __pids;
 static string         __name    = "";
 static action_t       __action  = ACTION_HELP;
+static Session       *__session = NULL;
 static Process       *__process = NULL;
 static string         __output  = "";
 static uintptr_t      __address = -1;
@@ -70,31 +122,73 @@ static string         __library = "";
 static string         __hex_pattern = "";
 static unsigned char *__pattern = NULL;
 static string         __filter  = "";
+static RegionFilter   __regions;
+static bool           __all     = false;
+static string         __name_glob = "";
+static size_t         __jobs    = SEARCH_DEFAULT_JOBS;
+static vector<Process *> __targets;
+static unsigned int   __hz      = WATCHER_DEFAULT_HZ;
+static size_t         __block_size = WATCHER_DEFAULT_BLOCK;
+static volatile sig_atomic_t __stop = 0;
+static string         __store   = "";
+static string         __capture = "";
+static string         __regex   = "";
+static int            __encodings = REGEX_ASCII;
+static size_t         __min_length = STRINGS_MIN_LENGTH;
+static bool           __unique  = false;
+static size_t         __max_memory = STRINGS_DEFAULT_BUDGET;
+static size_t         __range   = 1;
+static size_t         __depth   = 1;
+static size_t         __max_offset = POINTERS_DEFAULT_MAX_OFFSET;
+static string         __patch   = "";
+static string         __agent   = "";
+static bool           __dump_all = false;
+static double         __duration = PROFILE_DEFAULT_DURATION;
 
 void help( const char *name );
 void app_init( const char *name );
 
 unsigned char *parsehex( char *hex );
-void dumphex( unsigned char *buffer, size_t base, size_t size, const char *padding = "", size_t step = 16 );
 
 void action_show( const char *name );
 void action_search( const char *name );
 void action_read( const char *name );
 void action_dump( const char *name );
 void action_inject( const char *name );
+void action_watch( const char *name );
+void action_capture( const char *name );
+void action_restore( const char *name );
+void action_strings( const char *name );
+void action_pointers_to( const char *name );
+void action_pointer_map( const char *name );
+void action_patch( const char *name );
+void action_agent( const char *name );
+void action_index( const char *name );
+void action_threads( const char *name );
+void action_profile( const char *name );
 
 int main( int argc, char **argv )
 {
   int c, option_index = 0;
   while (1) {
-    c = getopt_long( argc, argv, "o:p:n:s:f:HSX:D:R:I:", options, &option_index );
+    c = getopt_long( argc, argv, "o:p:n:s:f:Ag:j:z:b:t:a:e:l:uM:d:k:Q:HSX:E:D:R:I:W:C:T:GP:mw:L:Y:qF:", options, &option_index );
     if( c == -1 ){
       break;
     }
 
     switch(c) {
-      case 'p':
-        __pid = strtol( optarg, NULL, 10 );
+      case 'p': {
+        // a comma separated list of pids selects many processes
+        char *p = optarg, *end = NULL;
+        while( *p ){
+          __pids.push_back( strtol( p, &end, 10 ) );
+          p = *end == ',' ? end + 1 : end;
+          if( end == p ){
+            break;
+          }
+        }
+        __pid = __pids.empty() ? -1 : __pids[0];
+      }
       break;
 
       case 'n':
@@ -113,6 +207,74 @@ int main( int argc, char **argv )
         __filter = optarg;
       break;
 
+      case 'A':
+        __all = true;
+      break;
+
+      case 'g':
+        __name_glob = optarg;
+      break;
+
+      case 'j':
+        __jobs = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 'z':
+        __hz = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 'b':
+        __block_size = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 't':
+        __store = optarg;
+      break;
+
+      case 'a':
+        __address = strtoul( optarg, NULL, 16 );
+      break;
+
+      case 'e':
+        if( strcmp( optarg, "ascii" ) == 0 ){
+          __encodings = REGEX_ASCII;
+        }
+        else if( strcmp( optarg, "utf16le" ) == 0 ){
+          __encodings = REGEX_UTF16LE;
+        }
+        else if( strcmp( optarg, "both" ) == 0 ){
+          __encodings = REGEX_ASCII | REGEX_UTF16LE;
+        }
+        else {
+          fprintf( stderr, "ERROR: Invalid encoding '%s'.\n\n", optarg );
+          help( argv[0] );
+        }
+      break;
+
+      case 'l':
+        __min_length = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 'u':
+        __unique = true;
+      break;
+
+      case 'M':
+        __max_memory = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 'd':
+        __depth = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 'k':
+        __max_offset = strtoul( optarg, NULL, 10 );
+      break;
+
+      case 'Q':
+        __capture = optarg;
+      break;
+
       case 'S':
         __action = ACTION_SHOW;
       break;
@@ -126,6 +288,11 @@ int main( int argc, char **argv )
         }
       break;
 
+      case 'E':
+        __action = ACTION_SEARCH;
+        __regex  = optarg;
+      break;
+
       case 'R':
         __action = ACTION_READ;
         __address = strtoul( optarg, NULL, 16 );
@@ -133,7 +300,8 @@ int main( int argc, char **argv )
 
       case 'D':
         __action  = ACTION_DUMP;
-        __address = strtoul( optarg, NULL, 16 );
+        __dump_all = strcmp( optarg, "all" ) == 0;
+        __address = __dump_all ? -1 : strtoul( optarg, NULL, 16 );
       break;
 
       case 'I':
@@ -141,6 +309,63 @@ int main( int argc, char **argv )
         __library = optarg;
       break;
 
+      case 'W':
+        __action  = ACTION_WATCH;
+        __address = strtoul( optarg, NULL, 16 );
+      break;
+
+      case 'C':
+        __action  = ACTION_CAPTURE;
+        __capture = optarg;
+      break;
+
+      case 'T':
+        __action  = ACTION_RESTORE;
+        __capture = optarg;
+      break;
+
+      case 'G':
+        __action = ACTION_STRINGS;
+      break;
+
+      case 'P': {
+        char *range = NULL;
+
+        __action  = ACTION_POINTERS_TO;
+        __address = strtoul( optarg, &range, 16 );
+        if( *range == ':' ){
+          __range = strtoul( range + 1, NULL, 0 );
+        }
+      }
+      break;
+
+      case 'm':
+        __action = ACTION_POINTER_MAP;
+      break;
+
+      case 'w':
+        __action = ACTION_PATCH;
+        __patch  = optarg;
+      break;
+
+      case 'L':
+        __agent = optarg;
+      break;
+
+      case 'Y':
+        __action  = ACTION_INDEX;
+        __capture = optarg;
+      break;
+
+      case 'q':
+        __action = ACTION_THREADS;
+      break;
+
+      case 'F':
+        __action   = ACTION_PROFILE;
+        __duration = strtod( optarg, NULL );
+      break;
+
       case 'H':
         help( argv[0] );
       break;
@@ -150,11 +375,26 @@ int main( int argc, char **argv )
     }
   }
 
+  string error;
+  if( __filter != "" && __regions.compile( __filter, error ) == false ){
+    fprintf( stderr, "ERROR: Invalid filter '%s': %s.\n\n", __filter.c_str(), error.c_str() );
+    help( argv[0] );
+  }
+
+  // on its own --agent is an action, with --search it pushes the search
+  // down into the agent.
+  if( __agent != "" && __action == ACTION_HELP ){
+    __action = ACTION_AGENT;
+  }
+
   if( __action == ACTION_HELP ){
     help( argv[0] );
   }
 
-  app_init( argv[0] );
+  // offline actions don't need a process
+  if( __action != ACTION_RESTORE && __action != ACTION_INDEX && ( __action != ACTION_SEARCH || __capture == "" ) ){
+    app_init( argv[0] );
+  }
 
   switch(__action) {
     case ACTION_SHOW:   action_show( argv[0] ); break;
@@ -162,9 +402,27 @@ int main( int argc, char **argv )
     case ACTION_SEARCH: action_search( argv[0] ); break;
     case ACTION_DUMP:   action_dump( argv[0] ); break;
     case ACTION_INJECT: action_inject( argv[0] ); break;
+    case ACTION_WATCH:  action_watch( argv[0] ); break;
+    case ACTION_CAPTURE: action_capture( argv[0] ); break;
+    case ACTION_RESTORE: action_restore( argv[0] ); break;
+    case ACTION_STRINGS: action_strings( argv[0] ); break;
+    case ACTION_POINTERS_TO: action_pointers_to( argv[0] ); break;
+    case ACTION_POINTER_MAP: action_pointer_map( argv[0] ); break;
+    case ACTION_PATCH: action_patch( argv[0] ); break;
+    case ACTION_AGENT: action_agent( argv[0] ); break;
+    case ACTION_INDEX: action_index( argv[0] ); break;
+    case ACTION_THREADS: action_threads( argv[0] ); break;
+    case ACTION_PROFILE: action_profile( argv[0] ); break;
   }
 
-  delete __process;
+  if( __session ){
+    __session->stats();
+  }
+
+  delete __session;
+  for( vector<Process *>::iterator i = __targets.begin(), e = __targets.end(); i != e; ++i ){
+    delete *i;
+  }
   if( __pattern != NULL ){
     delete[] __pattern;
   }
@@ -175,19 +433,45 @@ int main( int argc, char **argv )
 void help( const char *name ){
   printf( "Usage: %s <options> <action>\n\n", name );
   printf( "OPTIONS:\n\n" );
-  printf( "  --pid    | -p PID  : Select process by pid.\n" );
+  printf( "  --pid    | -p PID  : Select process by pid, or many processes with a comma separated list ( --search and --inject only ).\n" );
   printf( "  --name   | -n NAME : Select process by name.\n" );
   printf( "  --size   | -s SIZE : Set size.\n" );
   printf( "  --output | -o FILE : Set output file.\n" );
-  printf( "  --filter | -f EXPR : Specify a filter for the memory region name.\n" );
+  printf( "  --filter | -f EXPR : Select regions by name substring, or by an expression of perm:rwxsp type:anon|file size: addr: offset: inode: name:GLOB re:REGEX terms combined with , | ! ( ).\n" );
+  printf( "  --all    | -A      : Select every process ( --search only ).\n" );
+  printf( "  --name-glob | -g GLOB : Select every process whose name matches GLOB ( --search and --inject only ).\n" );
+  printf( "  --jobs   | -j N    : Number of processes to search or inject concurrently, default is %d.\n", SEARCH_DEFAULT_JOBS );
+  printf( "  --hz     | -z N    : Sampling rate of --watch-mem and --profile, default is %d.\n", WATCHER_DEFAULT_HZ );
+  printf( "  --block-size | -b N : Size of the blocks hashed by --watch-mem, default is %d.\n", WATCHER_DEFAULT_BLOCK );
+  printf( "  --store  | -t DIR  : Use DIR as content addressed page store for --dump, --capture, --restore and --index.\n" );
+  printf( "  --address | -a ADDRESS : Set address.\n" );
+  printf( "  --encoding | -e ENC : Encoding of --regex matches, one of ascii ( default ), utf16le or both.\n" );
+  printf( "  --min-length | -l N : Minimum length of --strings results, default is %d.\n", STRINGS_MIN_LENGTH );
+  printf( "  --unique | -u      : Don't show the same string twice in --strings results.\n" );
+  printf( "  --max-memory | -M MB : Memory used by --unique, default is %d MB.\n", STRINGS_DEFAULT_BUDGET );
+  printf( "  --depth  | -d N    : Length of the pointer chains reported by --pointers-to, default is 1.\n" );
+  printf( "  --max-offset | -k N : Maximum offset between pointer chain levels, default is %d.\n", POINTERS_DEFAULT_MAX_OFFSET );
+  printf( "  --in-capture | -Q NAME : Make --search look into capture NAME of the --store instead of a live process, through its index if built.\n" );
 
   printf( "\nACTIONS:\n\n" );
   printf( "  --help   | -H         : Show help menu.\n" );
   printf( "  --show   | -S         : Show process informations.\n" );
   printf( "  --search | -X HEX     : Search for the given pattern ( in hex ) in the process address space, might be used with --filter option.\n" );
+  printf( "  --regex  | -E EXPR   : Search for the given regular expression in the process address space, might be used with --filter and --encoding options.\n" );
+  printf( "  --strings | -G        : Print printable ASCII and UTF-16LE strings in the process address space, might be used with --filter option.\n" );
+  printf( "  --pointers-to | -P ADDRESS[:RANGE] : Find pointers to ADDRESS ( or anywhere in the RANGE bytes following it ) in writable memory, might be used with --depth and --jobs options.\n" );
+  printf( "  --pointer-map | -m    : Find every pointer to mapped memory in writable memory, saved to --output if set.\n" );
   printf( "  --read   | -R ADDRESS : Read SIZE bytes from address and prints them, requires -s option.\n" );
-  printf( "  --dump   | -D ADDRESS : Dump memory region containing a specific address to a file, requires -o option.\n" );
+  printf( "  --dump   | -D ADDRESS : Dump memory region containing a specific address to a file, requires -o option ( capture name if --store is used ), 'all' dumps every readable region, might be used with --filter and --jobs options.\n" );
   printf( "  --inject | -I LIBRARY : Inject the shared LIBRARY into the process.\n" );
+  printf( "  --agent  | -L LIBRARY : Inject the agent LIBRARY and connect to it, then watch SIZE bytes from --address through shared memory if set, with --search the agent searches inside the process.\n" );
+  printf( "  --patch  | -w FILE    : Write every \"ADDRESS HEXBYTES\" line of FILE into the process memory, code included.\n" );
+  printf( "  --threads-dump | -q   : Stop every thread at once and print its registers and the top SIZE bytes of its stack ( default %d ), stacks are read by --jobs threads.\n", THREADS_STACK_WINDOW );
+  printf( "  --profile | -F SECONDS : Sample the stacks of every thread at --hz for SECONDS, print the functions taking most samples and the folded stacks for flamegraph.pl, to --output if set.\n" );
+  printf( "  --watch-mem | -W ADDRESS : Watch SIZE bytes from address and report changes, requires -s option.\n" );
+  printf( "  --capture | -C NAME   : Save every readable region to the page store as capture NAME, requires --store, might be used with --filter option.\n" );
+  printf( "  --restore | -T NAME   : Rebuild the region of capture NAME containing --address to a file, requires --store and -o options.\n" );
+  printf( "  --index  | -Y NAME    : Build the n-gram index of capture NAME used by --search --in-capture, requires --store.\n" );
   exit(0);
 }
 
@@ -198,21 +482,60 @@ void app_init( const char *name ) {
     fprintf( stderr, "ERROR: This program must be runned as root.\n\n" );
     help( name );
   }
-  else if( __pid != -1 && __name != "" ){
-    fprintf( stderr, "ERROR: --pid and --name options are mutually exclusive.\n\n" );
+  else if( ( __pid != -1 ) + ( __name != "" ) + __all + ( __name_glob != "" ) > 1 ){
+    fprintf( stderr, "ERROR: --pid, --name, --all and --name-glob options are mutually exclusive.\n\n" );
     help( name );
   }
+  else if( __all || __name_glob != "" || __pids.size() > 1 ){
+    if( __action != ACTION_SEARCH && __action != ACTION_INJECT ){
+      fprintf( stderr, "ERROR: --all, --name-glob and multiple pids can only be used with --search and --inject.\n\n" );
+      help( name );
+    }
+    else if( __all && __action == ACTION_INJECT ){
+      fprintf( stderr, "ERROR: --all can't be used with --inject, use --name-glob or a list of pids.\n\n" );
+      help( name );
+    }
+
+    if( __pids.size() > 1 ){
+      for( vector<pid_t>::iterator i = __pids.begin(), e = __pids.end(); i != e; ++i ){
+        Process *process = Process::open( *i );
+        if( process == NULL ){
+          fprintf( stderr, "WARNING: Process %d not found.\n", *i );
+          continue;
+        }
+        __targets.push_back( process );
+      }
+      if( __targets.empty() ){
+        FATAL( "Could not find any of the given processes.\n" );
+      }
+    }
+    else {
+      __targets = Process::findAll( __all ? NULL : __name_glob.c_str() );
+      if( __targets.empty() ){
+        FATAL( "Could not find any process matching '%s'.\n", __all ? "*" : __name_glob.c_str() );
+      }
+    }
+
+    printf( "Processes: %u\n\n", __targets.size() );
+    return;
+  }
   else if( __pid != -1 ){
-    __process = new Process( __pid );
+    if( Session::open( __pid, __session ) != SWAT_OK ){
+      FATAL( "Could not find pid %u.\n", __pid );
+    }
   }
   else if( __name != "" ){
-    __process = Process::find( __name.c_str() );
+    if( Session::find( __name.c_str(), __session ) != SWAT_OK ){
+      FATAL( "Could not find process '%s'.\n", __name.c_str() );
+    }
   }
   else {
-    fprintf( stderr, "ERROR: One of --pid or --name options are required.\n\n" );
+    fprintf( stderr, "ERROR: One of --pid, --name, --all or --name-glob options are required.\n\n" );
     help( name );
   }
 
+  __process = __session->process();
+
   printf( "Process: %s ( pid=%d )\n\n", __process->name().c_str(), __process->pid() );
 }
 
@@ -240,27 +563,85 @@ unsigned char *parsehex( char *hex ) {
   return dst;
 }
 
-void dumphex( unsigned char *buffer, size_t base, size_t size, const char *padding, size_t step ) {
-  unsigned char *p = &buffer[0], *end = p + size;
+// The session tracer, attached on first use and kept until exit.
+static Tracer *tracer() {
+  Tracer *tracer = NULL;
+  swat_error_t error = __session->attach( tracer );
 
-  while( p < end ) {
-    unsigned int left = end - p;
-    step = std::min( step, left );
-    printf( "%s%08X | ", padding, base );
-    for( int i = 0; i < step; ++i ){
-      printf( "%02x ", p[i] );
-    }
-    printf( "| ");
-    for( int i = 0; i < step; ++i ){
-      printf( "%c", isprint(p[i]) ? p[i] : '.' );
-    }
+  if( error != SWAT_OK ){
+    FATAL( "Could not attach to process: %s.\n", swat_strerror(error) );
+  }
+  return tracer;
+}
 
-    printf( "\n" );
-    p += step;
-    base += step;
+typedef struct _Hit {
+  const MemoryMap *region;
+  Match            match;
+}
+Hit;
+
+// Matches are printed once the search is over, so that all of them are
+// annotated with their module and symbol in one pass.
+class HitCollector : public MatchSink {
+public:
+
+  vector<Hit> hits;
+
+  virtual bool match( const MemoryMap& region, uintptr_t offset, size_t length, const unsigned char *context, size_t size ) {
+    Hit hit;
+
+    hit.region       = &region;
+    hit.match.offset = offset;
+    hit.match.length = length;
+    hit.match.context.assign( context, context + size );
+
+    hits.push_back(hit);
+    return true;
+  }
+};
+
+static void print_hits( const vector<Hit>& hits, Symbolizer& symbolizer ) {
+  vector<uintptr_t> addresses;
+  vector<Annotation> annotations;
+
+  for( vector<Hit>::const_iterator h = hits.begin(), he = hits.end(); h != he; ++h ){
+    addresses.push_back( h->region->begin() + h->match.offset );
+  }
+
+  symbolizer.annotate( addresses, annotations );
+
+  for( size_t i = 0; i < hits.size(); ++i ){
+    const MemoryMap *region = hits[i].region;
+    const Match& match = hits[i].match;
+    string where = annotations[i].str();
+
+    printf( "Match @ offset %lu of %p-%p ( %s )%s%s:\n\n", match.offset, region->begin(), region->end(), region->name().c_str(), where.empty() ? "" : " at ", where.c_str() );
+    dumphex( (unsigned char *)&match.context[0], addresses[i], match.context.size(), "  " );
+    printf("\n");
   }
 }
 
+class RegionReport : public RegionObserver {
+private:
+
+  FILE *_fp;
+
+public:
+
+  RegionReport( FILE *fp ) : _fp(fp) {
+
+  }
+
+  virtual void scanned( const MemoryMap& region, bool failed, size_t unreadable ) {
+    if( failed ){
+      fprintf( _fp, "  Could not read %p-%p ( %s ).\n", region.begin(), region.end(), region.name().c_str() );
+    }
+    else if( unreadable ){
+      fprintf( _fp, "  Skipped %u KB of unreadable pages in %p-%p ( %s ).\n", unreadable / 1024, region.begin(), region.end(), region.name().c_str() );
+    }
+  }
+};
+
 void action_show( const char *name ) {
   __process->dump();
 }
@@ -276,57 +657,198 @@ void action_read( const char *name ) {
     FATAL( "Could not find address %p in the process space.\n", __address );
   }
 
-  Tracer tracer( __process );
-
   // align size
   __size = ( __size % sizeof(long) ? __size + (sizeof(long) - __size % sizeof(long)) : __size );
 
   printf( "Reading %lu bytes from %p ( %s ) ...\n\n", __size, __address, mem->name().c_str() );
 
   unsigned char *buffer = new unsigned char[ __size ];
-  if( tracer.read( __address, buffer, __size ) ){
+  swat_error_t error = __session->read( __address, buffer, __size );
+  if( error == SWAT_OK ){
     dumphex( buffer, __address, __size );
   }
   else {
-    perror("ptrace");
-    fprintf( stderr, "Could not read from process.\n" );
+    fprintf( stderr, "Could not read from process: %s.\n", swat_strerror(error) );
   }
 
   delete[] buffer;
 }
 
-void action_search( const char *name ) {
-  size_t pattern_size = __hex_pattern.size() / 2;
+static void connect_agent( const char *name, Channel& channel );
 
-  printf( "Searching for pattern :\n\n" );
-  dumphex( __pattern, 0, pattern_size, "  " );
-  printf("\n");
+static bool agent_match_less( const AgentMatch& a, const AgentMatch& b ) {
+  return a.address < b.address;
+}
 
-  Tracer tracer( __process );
+// Only match addresses and their context leave the process.
+static void search_agent( const char *name, const unsigned char *pattern, size_t size ) {
+  Channel channel( __process->pid() );
+  vector<const MemoryMap *> regions;
+  vector<AgentMatch> matches;
+  vector<uintptr_t> failed;
+  Patterns patterns( 1, vector<unsigned char>( pattern, pattern + size ) );
+  uint64_t scanned = 0;
+
+  connect_agent( name, channel );
 
   PROCESS_FOREACH_MAP_CONST( __process ){
-    if( __filter.size() != 0 && i->name().find(__filter) == string::npos ){
+    if( __regions.select(*i) == false ){
       continue;
     }
-    // printf( "  Searching in %p-%p ( %s ) ...\n", i->begin(), i->end(), i->name().c_str() );
-    unsigned char *buffer = new unsigned char[ i->size() ];
-
-    if( tracer.read( i->begin(), buffer, i->size() ) ){
-      size_t end_offset = i->size() - pattern_size;
-      for( size_t off = 0; off <= end_offset; ++off ){
-        if( buffer[off] == __pattern[0] && memcmp( &buffer[off], __pattern, pattern_size ) == 0 ){
-          printf( "Match @ offset %lu of %p-%p ( %s ):\n\n", off, i->begin(), i->end(), i->name().c_str() );
-          dumphex( &buffer[off], i->begin() + off, std::min( 64, (int)(end_offset - off) ), "  " );
-          printf("\n");
-        }
-      }
+    regions.push_back( &(*i) );
+  }
+
+  struct timespec start, end;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+
+  if( channel.search( patterns, regions, SEARCH_CONTEXT_SIZE, __jobs, matches, failed, scanned ) == false ){
+    FATAL( "The agent could not search the process.\n" );
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  for( vector<uintptr_t>::iterator i = failed.begin(), e = failed.end(); i != e; ++i ){
+    const MemoryMap *region = __process->findRegion( *i );
+    printf( "  Could not read %p ( %s ).\n", (void *)*i, region ? region->name().c_str() : "?" );
+  }
+
+  std::sort( matches.begin(), matches.end(), agent_match_less );
+
+  Symbolizer symbolizer( __process );
+  vector<uintptr_t> addresses;
+  vector<Annotation> annotations;
+
+  for( vector<AgentMatch>::iterator m = matches.begin(), me = matches.end(); m != me; ++m ){
+    addresses.push_back( m->address );
+  }
+
+  symbolizer.annotate( addresses, annotations );
+
+  for( size_t i = 0; i < matches.size(); ++i ){
+    const AgentMatch *m = &matches[i];
+    const MemoryMap *region = __process->findRegion( m->address );
+    uintptr_t begin = region ? region->begin() : m->address;
+    string where = annotations[i].str();
+
+    printf( "Match @ offset %lu of %p-%p ( %s )%s%s:\n\n", m->address - begin, begin, region ? region->end() : 0, region ? region->name().c_str() : "?", where.empty() ? "" : " at ", where.c_str() );
+    dumphex( (unsigned char *)&m->context[0], m->address, m->context.size(), "  " );
+    printf("\n");
+  }
+
+  printf( "%u matches in %llu KB searched by the agent in %.2f ms.\n\n",
+          matches.size(),
+          (unsigned long long)( scanned / 1024 ),
+          ( end.tv_sec - start.tv_sec ) * 1000.0 + ( end.tv_nsec - start.tv_nsec ) / 1e6 );
+  __regions.stats();
+  symbolizer.stats();
+  channel.stats();
+}
+
+// Captures are immutable, an index built once answers any number of
+// queries by reading only the pages around candidate positions.
+static void search_capture( const unsigned char *pattern, size_t size ) {
+  PageStore store( __store );
+  CaptureIndex index( store, __capture );
+  if( index.valid() == false ){
+    FATAL( "Could not load capture '%s'.\n", __capture.c_str() );
+  }
+  vector<Matches> matches;
+  size_t count = 0;
+
+  if( index.open() == false ){
+    printf( "No index for capture '%s', scanning it ( build one with --index ).\n\n", __capture.c_str() );
+  }
+
+  index.search( pattern, size, __regions, matches );
+
+  for( size_t r = 0; r < matches.size(); ++r ){
+    const MemoryMap& region = index.regions()[r].region;
+
+    for( Matches::iterator m = matches[r].begin(), me = matches[r].end(); m != me; ++m ){
+      printf( "Match @ offset %lu of %p-%p ( %s ):\n\n", m->offset, region.begin(), region.end(), region.name().c_str() );
+      dumphex( &m->context[0], region.begin() + m->offset, m->context.size(), "  " );
+      printf("\n");
+      ++count;
     }
-    else {
-      printf( "  Could not read %p-%p ( %s ).\n", i->begin(), i->end(), i->name().c_str() );
+  }
+
+  printf( "%u matches in capture '%s'.\n", count, __capture.c_str() );
+  __regions.stats();
+  index.stats();
+}
+
+void action_search( const char *name ) {
+  Matcher *matcher = NULL;
+
+  if( __regex != "" ){
+    RegexMatcher *regex = new RegexMatcher( __regex.c_str(), __encodings );
+    string error;
+
+    if( regex->valid(error) == false ){
+      FATAL( "Invalid regular expression '%s': %s.\n", __regex.c_str(), error.c_str() );
     }
 
-    delete[] buffer;
+    printf( "Searching for regex /%s/ ( %s%s%s ) :\n\n",
+            __regex.c_str(),
+            __encodings & REGEX_ASCII ? "ascii" : "",
+            __encodings == ( REGEX_ASCII | REGEX_UTF16LE ) ? ", " : "",
+            __encodings & REGEX_UTF16LE ? "utf16le" : "" );
+    matcher = regex;
   }
+  else {
+    size_t pattern_size = __hex_pattern.size() / 2;
+
+    printf( "Searching for pattern :\n\n" );
+    dumphex( __pattern, 0, pattern_size, "  " );
+    printf("\n");
+
+    matcher = new PatternMatcher( __pattern, pattern_size );
+  }
+
+  if( __capture != "" ){
+    if( __regex != "" || __store == "" ){
+      FATAL( "Only hex patterns can be searched in a capture, which requires --store.\n" );
+    }
+
+    search_capture( __pattern, __hex_pattern.size() / 2 );
+    delete matcher;
+    return;
+  }
+
+  if( __agent != "" ){
+    if( __regex != "" || __targets.empty() == false ){
+      FATAL( "The agent can only search hex patterns in a single process.\n" );
+    }
+
+    search_agent( name, __pattern, __hex_pattern.size() / 2 );
+    delete matcher;
+    return;
+  }
+
+  if( __targets.empty() == false ){
+    MultiSearch search( __targets, matcher, &__regions, __jobs );
+
+    search.run();
+    search.dump();
+    __regions.stats();
+    delete matcher;
+    return;
+  }
+
+  HitCollector collector;
+  RegionReport report( stdout );
+  Symbolizer symbolizer( __process );
+
+  swat_error_t error = __session->search( *matcher, &__regions, collector, &report );
+  if( error != SWAT_OK ){
+    FATAL( "Could not search the process: %s.\n", swat_strerror(error) );
+  }
+
+  print_hits( collector.hits, symbolizer );
+
+  __regions.stats();
+  symbolizer.stats();
+  delete matcher;
 }
 
 void action_dump( const char *name ) {
@@ -335,22 +857,362 @@ void action_dump( const char *name ) {
     help( name );
   }
 
-  Tracer tracer( __process );
-  tracer.dumpRegion( __address, __output.c_str() );
+  Tracer *tracer = ::tracer();
+
+  if( __store != "" && __dump_all ){
+    fprintf( stderr, "ERROR: use --capture to store every region.\n\n" );
+    help( name );
+  }
+  else if( __store != "" ){
+    const MemoryMap *mem = __process->findRegion(__address);
+    if( mem == NULL ){
+      FATAL( "Could not find address %p in the process space.\n", __address );
+    }
+
+    PageStore store( __store );
+    vector<const MemoryMap *> regions( 1, mem );
+
+    if( store.valid() == false ){
+      FATAL( "Could not create page store in '%s'.\n", __store.c_str() );
+    }
+
+    printf( "Storing %p-%p ( %s ) as '%s' ...\n", mem->begin(), mem->end(), mem->name().c_str(), __output.c_str() );
+
+    if( store.capture( *tracer, __process, regions, __output ) ){
+      store.stats();
+    }
+    return;
+  }
+
+  if( __dump_all ){
+    DumpPipeline pipeline( tracer, __jobs );
+    string index = __output + ".index";
+
+    PROCESS_FOREACH_MAP_CONST( __process ){
+      if( __regions.select(*i) == false ){
+        continue;
+      }
+      pipeline.add( i->begin(), i->end(), i->name() );
+    }
+
+    printf( "Dumping readable regions to '%s' ...\n\n", __output.c_str() );
+
+    pipeline.run( __output.c_str() );
+    pipeline.stats();
+    __regions.stats();
+
+    if( pipeline.saveIndex( index.c_str() ) ){
+      printf( "\nRegions index saved to '%s'.\n", index.c_str() );
+    }
+    return;
+  }
+
+  tracer->dumpRegion( __address, __output.c_str() );
 }
 
 void action_inject( const char *name ) {
-  Tracer tracer( __process );
+  if( __targets.empty() == false ){
+    MultiInject inject( __targets, __library, __jobs );
 
-  const Symbols *syms = tracer.getSymbols();
+    inject.run();
+    inject.dump();
+    return;
+  }
+
+  Tracer *tracer = ::tracer();
 
-  uintptr_t pstr = tracer.writeString( __library.c_str() );
+  const Symbols *syms = tracer->getSymbols();
+  if( syms == NULL ){
+    FATAL( "Could not resolve process symbols.\n" );
+  }
+
+  uintptr_t pstr = tracer->writeString( __library.c_str() );
 
   printf( "Library name string allocated @ %p\n", pstr );
 
-  uintptr_t ret = tracer.call( syms->_dlopen, 2, pstr, 0 );
+  // dlopen could deadlock on a lock the process holds
+  if( tracer->safePoint() == false ){
+    tracer->arena()->free( pstr );
+    __session->detach();
+    FATAL( "No safe point within %.0f ms, not calling dlopen.\n", TRACER_SAFEPOINT_TIMEOUT * 1000.0 );
+  }
 
-  printf( "dlopen returned 0x%x\n", ret );
+  uintptr_t ret = tracer->call( syms->_dlopen, 2, pstr, 0 );
+
+  printf( "dlopen returned 0x%x ( %u register transfers, %u remote syscalls )\n", ret, tracer->registerTransfers(), tracer->syscalls() );
+
+  // no remote call, the arena block is released once when detaching, which
+  // the agent needs anyway to run.
+  tracer->arena()->free( pstr );
+  __session->detach();
+}
+
+// Inject the agent library, if it's already loaded dlopen just returns its
+// handle, and connect to it.
+static void connect_agent( const char *name, Channel& channel ) {
+  __library = __agent;
+  action_inject( name );
+
+  if( channel.connect() == false ){
+    FATAL( "Could not connect to the agent.\n" );
+  }
+
+  printf( "Connected to the agent.\n\n" );
+}
+
+static void on_signal( int sig ) {
+  __stop = 1;
+}
+
+void action_watch( const char *name ) {
+  if( __size == -1 ){
+    fprintf( stderr, "ERROR: --watch-mem action require --size option to be set.\n\n" );
+    help( name );
+  }
+
+  MemoryWatcher watcher( __process, __address, __size, __block_size, __hz );
+
+  signal( SIGINT, on_signal );
+  signal( SIGTERM, on_signal );
+
+  watcher.run( &__stop );
+}
+
+void action_capture( const char *name ) {
+  if( __store == "" ){
+    fprintf( stderr, "ERROR: --capture action require --store option to be set.\n\n" );
+    help( name );
+  }
+
+  vector<const MemoryMap *> regions;
+  size_t total = 0;
+
+  PROCESS_FOREACH_MAP_CONST( __process ){
+    if( __regions.select(*i) == false ){
+      continue;
+    }
+    regions.push_back( &(*i) );
+    total += i->size();
+  }
+
+  PageStore store( __store );
+  if( store.valid() == false ){
+    FATAL( "Could not create page store in '%s'.\n", __store.c_str() );
+  }
+
+  printf( "Capturing %u regions ( %u KB ) as '%s' ...\n\n", regions.size(), total / 1024, __capture.c_str() );
+
+  if( store.capture( *tracer(), __process, regions, __capture ) ){
+    store.stats();
+    __regions.stats();
+  }
+}
+
+void action_restore( const char *name ) {
+  if( __store == "" || __output == "" || __address == -1 ){
+    fprintf( stderr, "ERROR: --restore action require --store, --address and --output options to be set.\n\n" );
+    help( name );
+  }
+
+  PageStore store( __store );
+  store.restore( __capture, __address, __output.c_str() );
+}
+
+void action_index( const char *name ) {
+  if( __store == "" ){
+    fprintf( stderr, "ERROR: --index action require --store option to be set.\n\n" );
+    help( name );
+  }
+
+  PageStore store( __store );
+  CaptureIndex index( store, __capture );
+  if( index.valid() == false ){
+    FATAL( "Could not load capture '%s'.\n", __capture.c_str() );
+  }
+
+  printf( "Indexing capture '%s' ...\n\n", __capture.c_str() );
+
+  if( index.build() ){
+    index.stats();
+  }
+}
+
+void action_threads( const char *name ) {
+  ThreadDump threads( __process, __size != -1 ? __size : THREADS_STACK_WINDOW, __jobs );
+
+  if( threads.run() ){
+    threads.dump();
+    threads.stats();
+  }
+}
+
+void action_profile( const char *name ) {
+  Profiler profiler( __process, __hz, __duration );
+
+  signal( SIGINT, on_signal );
+  signal( SIGTERM, on_signal );
+
+  if( profiler.run( &__stop ) == false ){
+    return;
+  }
+
+  Symbolizer symbolizer( __process );
+
+  profiler.stats();
+  profiler.flat( symbolizer );
+
+  if( __output != "" ){
+    FILE *fp = fopen( __output.c_str(), "w+t" );
+    if( fp == NULL ){
+      perror("fopen");
+      FATAL( "Could not create '%s'.\n", __output.c_str() );
+    }
+
+    profiler.folded( symbolizer, fp );
+    fclose(fp);
+
+    printf( "Folded stacks saved to '%s'.\n", __output.c_str() );
+  }
+  else {
+    profiler.folded( symbolizer, stdout );
+    printf( "\n" );
+  }
+
+  symbolizer.stats();
+}
+
+void action_strings( const char *name ) {
+  StringScanner scanner( __min_length, __unique ? __max_memory : 0 );
+  RegionReport report( stderr );
+
+  swat_error_t error = __session->strings( scanner, &__regions, &report );
+  if( error != SWAT_OK ){
+    FATAL( "Could not scan the process: %s.\n", swat_strerror(error) );
+  }
+
+  scanner.stats();
+  __regions.stats();
+}
+
+void action_pointers_to( const char *name ) {
+  PointerScanner *scanner = NULL;
+
+  printf( "Searching pointers to %p-%p ...\n\n", __address, __address + __range );
+
+  // chains need to know about pointers to the intermediate levels as well
+  swat_error_t error = __depth > 1 ? __session->pointers( scanner, __jobs ) :
+                                     __session->pointers( scanner, __jobs, __address, __address + __range );
+  if( error != SWAT_OK ){
+    delete scanner;
+    FATAL( "Could not scan the process: %s.\n", swat_strerror(error) );
+  }
+
+  Symbolizer symbolizer( __process );
+
+  scanner->chains( __address, __address + __range, __depth, __max_offset, &symbolizer );
+  scanner->stats();
+  symbolizer.stats();
+
+  delete scanner;
+}
+
+void action_pointer_map( const char *name ) {
+  PointerScanner *scanner = NULL;
+
+  printf( "Building pointer map ...\n" );
+
+  swat_error_t error = __session->pointers( scanner, __jobs );
+  if( error != SWAT_OK ){
+    delete scanner;
+    FATAL( "Could not scan the process: %s.\n", swat_strerror(error) );
+  }
+
+  scanner->stats();
+
+  if( __output != "" && scanner->save( __output.c_str() ) ){
+    printf( "Pointer map saved to '%s'.\n", __output.c_str() );
+  }
+
+  delete scanner;
+}
+
+void action_patch( const char *name ) {
+  Patcher patcher( __process );
+
+  if( patcher.load( __patch.c_str() ) == false ){
+    FATAL( "Could not load patches from '%s'.\n", __patch.c_str() );
+  }
+
+  printf( "Applying patches from '%s' ...\n\n", __patch.c_str() );
+
+  patcher.apply();
+  patcher.stats();
+}
+
+void action_agent( const char *name ) {
+  Channel channel( __process->pid() );
+
+  connect_agent( name, channel );
+
+  if( __address != -1 && __size != -1 ){
+    unsigned char *current = new unsigned char[ __size ];
+
+    if( channel.read( __address, current, __size ) == false || channel.watch( __address, __size, __block_size, __hz ) == false ){
+      delete[] current;
+      FATAL( "Could not watch %u bytes @ %p.\n", __size, __address );
+    }
+
+    printf( "Watching %u bytes @ %p at %u Hz through the agent, hit CTRL+C to stop ...\n\n", __size, __address, __hz );
+
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+
+    uint64_t start = 0;
+
+    while( __stop == 0 ){
+      const agent_record_t *record = channel.next();
+
+      if( record == NULL ){
+        usleep( 1000 );
+        continue;
+      }
+      else if( record->type == AGENT_REC_ERROR ){
+        fprintf( stderr, "The agent can't read %p anymore.\n", (void *)(uintptr_t)record->address );
+        break;
+      }
+      else if( record->type != AGENT_REC_CHANGE ){
+        continue;
+      }
+
+      size_t offset = record->address - __address,
+             begin  = 0,
+             end    = record->size;
+      const unsigned char *data = (const unsigned char *)( record + 1 );
+
+      if( start == 0 ){
+        start = record->timestamp;
+      }
+
+      // narrow down to the bytes which actually changed
+      while( begin < end && data[begin] == current[offset + begin] ){
+        ++begin;
+      }
+      while( end > begin && data[end - 1] == current[offset + end - 1] ){
+        --end;
+      }
+
+      if( begin < end ){
+        printf( "[%12.6f] +0x%08x ( %p ) %u bytes changed:\n", ( record->timestamp - start ) / 1e9, offset + begin, __address + offset + begin, end - begin );
+        dumphex( current + offset + begin, __address + offset + begin, end - begin, "  - " );
+        dumphex( (unsigned char *)data + begin, __address + offset + begin, end - begin, "  + " );
+      }
+
+      memcpy( current + offset, data, record->size );
+    }
+
+    channel.unwatch();
+    delete[] current;
+  }
 
-  tracer.call( syms->_free, 1, pstr );
+  channel.stats();
 }
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include "matcher.h"
+
+PatternMatcher::PatternMatcher( const unsigned char *pattern, size_t size ) :
+  _pattern(pattern),
+  _size(size) {
+
+}
+
+Matcher *PatternMatcher::clone() const {
+  return new PatternMatcher( _pattern, _size );
+}
+
+size_t PatternMatcher::maxLength() const {
+  return _size;
+}
+
+bool PatternMatcher::overlapping() const {
+  return true;
+}
+
+bool PatternMatcher::find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length ) {
+  const unsigned char *p = data + from, *end = data + size;
+
+  while( p < end && (p = (const unsigned char *)memchr( p, _pattern[0], end - p )) != NULL ){
+    if( (size_t)(end - p) >= _size && memcmp( p, _pattern, _size ) == 0 ){
+      start  = p - data;
+      length = _size;
+      return true;
+    }
+    ++p;
+  }
+
+  return false;
+}
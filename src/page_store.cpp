@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "page_store.h"
+#include "sha256.h"
+
+static bool mkdirs( const string& path ) {
+  for( size_t i = 1; i <= path.size(); ++i ){
+    if( i == path.size() || path[i] == '/' ){
+      if( mkdir( path.substr( 0, i ).c_str(), 0755 ) != 0 && errno != EEXIST ){
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool is_zero( const unsigned char *page ) {
+  const unsigned long *p = (const unsigned long *)page,
+                      *e = (const unsigned long *)( page + PAGE_STORE_PAGE_SIZE );
+  for( ; p < e; ++p ){
+    if( *p ){
+      return false;
+    }
+  }
+  return true;
+}
+
+PageStore::PageStore( const string& path ) :
+  _path(path),
+  _pages(0),
+  _stored(0),
+  _zero(0),
+  _unreadable(0),
+  _valid(true) {
+
+  if( !mkdirs( _path + "/objects" ) || !mkdirs( _path + "/captures" ) ){
+    perror("mkdir");
+    _valid = false;
+  }
+}
+
+string PageStore::objectPath( const string& hash ) const {
+  return _path + "/objects/" + hash.substr( 0, 2 ) + "/" + hash.substr(2);
+}
+
+string PageStore::capturePath( const string& name ) const {
+  return _path + "/captures/" + name;
+}
+
+string PageStore::put( const unsigned char *page ) {
+  ++_pages;
+
+  if( is_zero(page) ){
+    ++_zero;
+    return PAGE_STORE_ZERO;
+  }
+
+  string hash = SHA256::hex( page, PAGE_STORE_PAGE_SIZE );
+  if( _known.find(hash) != _known.end() ){
+    return hash;
+  }
+
+  string path = objectPath(hash);
+  struct stat st;
+
+  if( stat( path.c_str(), &st ) != 0 ){
+    string tmp = path + ".tmp";
+
+    mkdirs( path.substr( 0, path.rfind('/') ) );
+
+    // write and rename, so that a page is either there or not at all
+    FILE *fp = fopen( tmp.c_str(), "wb" );
+    if( fp == NULL || fwrite( page, 1, PAGE_STORE_PAGE_SIZE, fp ) != PAGE_STORE_PAGE_SIZE ){
+      perror("fwrite");
+      if( fp ){
+        fclose(fp);
+      }
+      unlink( tmp.c_str() );
+      ++_unreadable;
+      return PAGE_STORE_UNREADABLE;
+    }
+    fclose(fp);
+    rename( tmp.c_str(), path.c_str() );
+    ++_stored;
+  }
+
+  _known.insert(hash);
+  return hash;
+}
+
+bool PageStore::get( const string& hash, unsigned char *page ) const {
+  if( hash == PAGE_STORE_ZERO || hash == PAGE_STORE_UNREADABLE ){
+    memset( page, 0x00, PAGE_STORE_PAGE_SIZE );
+    return hash == PAGE_STORE_ZERO;
+  }
+
+  FILE *fp = fopen( objectPath(hash).c_str(), "rb" );
+  if( fp == NULL ){
+    return false;
+  }
+
+  bool ok = fread( page, 1, PAGE_STORE_PAGE_SIZE, fp ) == PAGE_STORE_PAGE_SIZE;
+  fclose(fp);
+
+  return ok;
+}
+
+bool PageStore::putRegion( RegionReader& reader, const MemoryMap& region, FILE *manifest ) {
+  uintptr_t address = 0, done = region.begin();
+  const unsigned char *data = NULL;
+  size_t size = 0;
+
+  fprintf( manifest, "region %lx-%lx %s %08lx %s %u %s\n",
+           region.begin(),
+           region.end(),
+           region.permissions().c_str(),
+           region.offset(),
+           region.device().c_str(),
+           region.inode(),
+           region.name().c_str() );
+
+  reader.reset( region.begin(), region.end() );
+  while( reader.next( address, data, size ) ){
+    // chunks the reader skipped entirely
+    for( ; done < address; done += PAGE_STORE_PAGE_SIZE ){
+      fprintf( manifest, "%s\n", PAGE_STORE_UNREADABLE );
+      ++_pages;
+      ++_unreadable;
+    }
+
+    for( size_t off = 0; off + PAGE_STORE_PAGE_SIZE <= size; off += PAGE_STORE_PAGE_SIZE ){
+      if( reader.readable( address + off, PAGE_STORE_PAGE_SIZE ) == PAGE_STORE_PAGE_SIZE ){
+        fprintf( manifest, "%s\n", put( data + off ).c_str() );
+      }
+      else {
+        fprintf( manifest, "%s\n", PAGE_STORE_UNREADABLE );
+        ++_pages;
+        ++_unreadable;
+      }
+    }
+    done = address + size;
+  }
+
+  // whatever we could not read is still listed, so that offsets match
+  for( ; done < region.end(); done += PAGE_STORE_PAGE_SIZE ){
+    fprintf( manifest, "%s\n", PAGE_STORE_UNREADABLE );
+    ++_pages;
+    ++_unreadable;
+  }
+
+  return !reader.failed();
+}
+
+bool PageStore::capture( Tracer& tracer, const Process *process, const vector<const MemoryMap *>& regions, const string& name ) {
+  string path = capturePath(name);
+  FILE *manifest = fopen( path.c_str(), "wt" );
+  if( manifest == NULL ){
+    perror("fopen");
+    fprintf( stderr, "Could not create manifest '%s'.\n", path.c_str() );
+    return false;
+  }
+
+  RegionReader reader( &tracer );
+
+  fprintf( manifest, "process %d %s\n", process->pid(), process->name().c_str() );
+
+  for( vector<const MemoryMap *>::const_iterator i = regions.begin(), e = regions.end(); i != e; ++i ){
+    if( putRegion( reader, **i, manifest ) == false ){
+      printf( "  Could not read %p-%p ( %s ).\n", (*i)->begin(), (*i)->end(), (*i)->name().c_str() );
+    }
+  }
+
+  fclose(manifest);
+  // we're running as root, we need to chmod the file in order to pull it.
+  chmod( path.c_str(), 0755 );
+
+  return true;
+}
+
+bool PageStore::load( const string& name, vector<CapturedRegion>& regions ) const {
+  string path = capturePath(name);
+  FILE *manifest = fopen( path.c_str(), "rt" );
+  if( manifest == NULL ){
+    perror("fopen");
+    fprintf( stderr, "Could not open manifest '%s'.\n", path.c_str() );
+    return false;
+  }
+
+  char line[4096] = {0};
+
+  while( fgets( line, sizeof(line), manifest ) ){
+    char *p = strrchr( line, '\n' );
+    if( p ){
+      *p = 0x00;
+    }
+
+    if( strncmp( line, "region ", 7 ) == 0 ){
+      regions.push_back( CapturedRegion() );
+      regions.back().region = MemoryMap::parse( line + 7 );
+    }
+    else if( strncmp( line, "process ", 8 ) != 0 && regions.empty() == false ){
+      regions.back().pages.push_back( line );
+    }
+  }
+
+  fclose(manifest);
+  return true;
+}
+
+bool PageStore::restore( const string& name, uintptr_t address, const char *output ) const {
+  string path = capturePath(name);
+  FILE *manifest = fopen( path.c_str(), "rt" );
+  if( manifest == NULL ){
+    perror("fopen");
+    fprintf( stderr, "Could not open manifest '%s'.\n", path.c_str() );
+    return false;
+  }
+
+  char line[4096] = {0};
+  MemoryMap region;
+  bool found = false;
+
+  while( fgets( line, sizeof(line), manifest ) ){
+    if( strncmp( line, "region ", 7 ) == 0 ){
+      char *p = strrchr( line, '\n' );
+      if( p ){
+        *p = 0x00;
+      }
+
+      region = MemoryMap::parse( line + 7 );
+      if( region.contains(address) ){
+        found = true;
+        break;
+      }
+    }
+  }
+
+  if( !found ){
+    fclose(manifest);
+    fprintf( stderr, "Could not find address 0x%x in capture '%s'.\n", address, name.c_str() );
+    return false;
+  }
+
+  FILE *fp = fopen( output, "w+b" );
+  if( fp == NULL ){
+    fclose(manifest);
+    perror("fopen");
+    fprintf( stderr, "Failed to create dump file.\n" );
+    return false;
+  }
+
+  printf( "Restoring %p-%p ( %s ) to '%s' ...\n", region.begin(), region.end(), region.name().c_str(), output );
+
+  unsigned char page[PAGE_STORE_PAGE_SIZE];
+  size_t npages = region.size() / PAGE_STORE_PAGE_SIZE, missing = 0;
+
+  for( size_t n = 0; n < npages && fgets( line, sizeof(line), manifest ); ++n ){
+    char *p = strrchr( line, '\n' );
+    if( p ){
+      *p = 0x00;
+    }
+
+    if( get( line, page ) == false ){
+      ++missing;
+    }
+    fwrite( page, 1, PAGE_STORE_PAGE_SIZE, fp );
+  }
+
+  fclose(fp);
+  fclose(manifest);
+  chmod( output, 0755 );
+
+  if( missing ){
+    printf( "%u pages were not readable at capture time or are missing from the store, zero filled.\n", missing );
+  }
+
+  return true;
+}
+
+void PageStore::stats() const {
+  printf( "%u pages, %u new ( %u KB written ), %u zero, %u unreadable, %u already in the store.\n",
+          _pages,
+          _stored,
+          _stored * PAGE_STORE_PAGE_SIZE / 1024,
+          _zero,
+          _unreadable,
+          _pages - _stored - _zero - _unreadable );
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <ctype.h>
+#include <algorithm>
+
+#include "patcher.h"
+
+static bool by_address( const Patch& a, const Patch& b ) {
+  return a.address < b.address;
+}
+
+Patcher::Patcher( Process *process ) :
+  _process(process),
+  _loaded(0),
+  _bytes(0),
+  _written(0),
+  _syscalls(0),
+  _failed(0) {
+
+}
+
+bool Patcher::load( const char *filename ) {
+  FILE *fp = fopen( filename, "rt" );
+  char line[0x1000] = {0};
+  size_t lineno = 0;
+
+  if( !fp ){
+    perror( filename );
+    return false;
+  }
+
+  while( fgets( line, sizeof(line), fp ) ){
+    char *p = line, *end = NULL;
+    Patch patch;
+
+    ++lineno;
+
+    if( ( end = strchr( line, '#' ) ) != NULL ){
+      *end = '\0';
+    }
+
+    while( isspace(*p) ) ++p;
+    if( *p == '\0' ){
+      continue;
+    }
+
+    patch.address = strtoul( p, &end, 16 );
+    if( end == p ){
+      fprintf( stderr, "%s:%u: invalid address.\n", filename, lineno );
+      fclose(fp);
+      return false;
+    }
+
+    for( p = end; *p; ){
+      unsigned int byte = 0;
+
+      if( isspace(*p) || *p == ':' ){
+        ++p;
+        continue;
+      }
+      else if( !isxdigit(p[0]) || !isxdigit(p[1]) || sscanf( p, "%2x", &byte ) != 1 ){
+        fprintf( stderr, "%s:%u: invalid hexadecimal bytes.\n", filename, lineno );
+        fclose(fp);
+        return false;
+      }
+
+      patch.bytes.push_back( byte & 0xff );
+      p += 2;
+    }
+
+    if( patch.bytes.empty() ){
+      fprintf( stderr, "%s:%u: no bytes to write.\n", filename, lineno );
+      fclose(fp);
+      return false;
+    }
+
+    _patches.push_back( patch );
+  }
+
+  fclose(fp);
+
+  _loaded = _patches.size();
+  coalesce();
+
+  return true;
+}
+
+void Patcher::coalesce() {
+  vector<Patch> sorted( _patches ), runs;
+
+  std::sort( sorted.begin(), sorted.end(), by_address );
+
+  // where the runs are first ...
+  for( vector<Patch>::iterator i = sorted.begin(), e = sorted.end(); i != e; ++i ){
+    if( runs.empty() || i->address > runs.back().end() ){
+      runs.push_back( *i );
+    }
+    else if( i->end() > runs.back().end() ){
+      runs.back().bytes.resize( i->end() - runs.back().address );
+    }
+  }
+
+  // ... then their bytes in file order, so later lines win where they overlap
+  for( vector<Patch>::iterator i = _patches.begin(), e = _patches.end(); i != e; ++i ){
+    vector<Patch>::iterator run = std::upper_bound( runs.begin(), runs.end(), *i, by_address ) - 1;
+
+    std::copy( i->bytes.begin(), i->bytes.end(), run->bytes.begin() + ( i->address - run->address ) );
+  }
+
+  _patches.swap( runs );
+  _bytes = 0;
+  for( vector<Patch>::const_iterator i = _patches.begin(), e = _patches.end(); i != e; ++i ){
+    _bytes += i->bytes.size();
+  }
+}
+
+bool Patcher::apply() {
+  Tracer tracer( _process );
+  vector<struct iovec> local( _patches.size() ), remote( _patches.size() );
+  size_t done = 0, count = _patches.size();
+
+  if( tracer.ready() == false ){
+    return false;
+  }
+
+  for( size_t i = 0; i < count; ++i ){
+    local[i].iov_base  = &_patches[i].bytes[0];
+    local[i].iov_len   = _patches[i].bytes.size();
+    remote[i].iov_base = (void *)_patches[i].address;
+    remote[i].iov_len  = _patches[i].bytes.size();
+  }
+
+  while( done < count ){
+    size_t n = 0;
+
+    if( Tracer::canWriteWithoutStopping() ){
+      // one batch at a time, so every call is exactly one syscall
+      n = tracer.writev( &local[done], &remote[done], std::min( count - done, (size_t)TRACER_IOV_MAX ) );
+      ++_syscalls;
+    }
+
+    for( size_t i = done; i < done + n; ++i ){
+      _written += _patches[i].bytes.size();
+    }
+    done += n;
+
+    // process_vm_writev stopped at this run ( read only page or no support
+    // at all ), write it through the slower paths and go on with the rest.
+    if( n == 0 ){
+      Patch& patch = _patches[done];
+
+      ++_syscalls;
+      if( tracer.write( patch.address, &patch.bytes[0], patch.bytes.size() ) ){
+        _written += patch.bytes.size();
+      }
+      else {
+        fprintf( stderr, "  Could not write %u bytes @ %p.\n", patch.bytes.size(), patch.address );
+        ++_failed;
+      }
+      ++done;
+    }
+  }
+
+  return _failed == 0;
+}
+
+void Patcher::stats() const {
+  printf( "Patches       : %u\n", _loaded );
+  printf( "Runs          : %u ( %u bytes )\n", _patches.size(), _bytes );
+  printf( "Write calls   : %u\n", _syscalls );
+  printf( "Written       : %u bytes\n", _written );
+  printf( "Failed runs   : %u\n", _failed );
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "pointer_scanner.h"
+#include "region_reader.h"
+
+static bool region_before( const MemoryMap *a, const MemoryMap *b ) {
+  return a->begin() < b->begin();
+}
+
+static bool region_ends_before( uintptr_t address, const MemoryMap *region ) {
+  return address < region->end();
+}
+
+RegionIndex::RegionIndex( const Process *process ) : _lo(0), _hi(0) {
+  PROCESS_FOREACH_MAP_CONST( process ){
+    _regions.push_back( &(*i) );
+  }
+
+  std::sort( _regions.begin(), _regions.end(), region_before );
+
+  if( _regions.empty() == false ){
+    _lo = _regions.front()->begin();
+    _hi = _regions.back()->end();
+  }
+}
+
+const MemoryMap *RegionIndex::find( uintptr_t address ) const {
+  // most values aren't pointers at all
+  if( address < _lo || address >= _hi ){
+    return NULL;
+  }
+
+  // first region ending after the address
+  vector<const MemoryMap *>::const_iterator i = std::upper_bound( _regions.begin(), _regions.end(), address, region_ends_before );
+  if( i != _regions.end() && (*i)->contains(address) ){
+    return *i;
+  }
+
+  return NULL;
+}
+
+PointerScanner::PointerScanner( Process *process, Tracer *tracer, size_t jobs ) :
+  _process(process),
+  _tracer(tracer),
+  _index(process),
+  _jobs( jobs ? jobs : 1 ),
+  _lo(0),
+  _hi(0),
+  _next(0),
+  _scanned(0) {
+
+  pthread_mutex_init( &_lock, NULL );
+
+  // ptrace requests can only come from the thread which attached.
+  if( Tracer::canReadWithoutStopping() == false ){
+    _jobs = 1;
+  }
+}
+
+PointerScanner::~PointerScanner() {
+  pthread_mutex_destroy( &_lock );
+}
+
+void *PointerScanner::worker( void *arg ) {
+  PointerScanner *scanner = (PointerScanner *)arg;
+  RegionReader reader( scanner->_tracer );
+  vector<PointerRef> found;
+  size_t scanned = 0;
+
+  while(1) {
+    pthread_mutex_lock( &scanner->_lock );
+    size_t idx = scanner->_next++;
+    pthread_mutex_unlock( &scanner->_lock );
+
+    if( idx >= scanner->_work.size() ){
+      break;
+    }
+
+    const WorkItem &item = scanner->_work[idx];
+    uintptr_t address = 0;
+    const unsigned char *data = NULL;
+    size_t size = 0;
+
+    reader.reset( item.begin, item.end );
+    while( reader.next( address, data, size ) ){
+      const uintptr_t *p = (const uintptr_t *)data, *end = p + size / sizeof(uintptr_t);
+
+      for( ; p < end; ++p ){
+        bool hit = scanner->_lo != scanner->_hi ?
+                     ( *p >= scanner->_lo && *p < scanner->_hi ) :
+                     scanner->_index.find(*p) != NULL;
+        if( hit ){
+          PointerRef ref;
+
+          ref.target = *p;
+          ref.source = address + ( (const unsigned char *)p - data );
+
+          found.push_back(ref);
+        }
+      }
+
+      scanned += size;
+    }
+  }
+
+  pthread_mutex_lock( &scanner->_lock );
+  scanner->_refs.insert( scanner->_refs.end(), found.begin(), found.end() );
+  scanner->_scanned += scanned;
+  pthread_mutex_unlock( &scanner->_lock );
+
+  return NULL;
+}
+
+void PointerScanner::scan( uintptr_t lo /* = 0 */, uintptr_t hi /* = 0 */ ) {
+  _lo = lo;
+  _hi = hi;
+  _next = 0;
+  _scanned = 0;
+  _work.clear();
+  _refs.clear();
+
+  // split regions in chunks so that a single huge heap is shared among jobs
+  PROCESS_FOREACH_MAP_CONST( _process ){
+    if( i->isReadable() == false || i->isWritable() == false ){
+      continue;
+    }
+
+    for( uintptr_t a = i->begin(); a < i->end(); a += REGION_READER_CHUNK_SIZE ){
+      WorkItem item;
+
+      item.begin = a;
+      item.end   = std::min( i->end(), a + REGION_READER_CHUNK_SIZE );
+
+      _work.push_back(item);
+    }
+  }
+
+  // this thread is a worker too, the only one allowed to use ptrace
+  size_t nthreads = std::max( std::min( _jobs, _work.size() ), (size_t)1 ) - 1;
+  vector<pthread_t> threads( nthreads );
+
+  for( size_t i = 0; i < nthreads; ++i ){
+    if( pthread_create( &threads[i], NULL, PointerScanner::worker, this ) != 0 ){
+      perror("pthread_create");
+      nthreads = i;
+      break;
+    }
+  }
+
+  PointerScanner::worker(this);
+
+  for( size_t i = 0; i < nthreads; ++i ){
+    pthread_join( threads[i], NULL );
+  }
+
+  std::sort( _refs.begin(), _refs.end() );
+}
+
+void PointerScanner::find( uintptr_t lo, uintptr_t hi, vector<PointerRef>& found ) const {
+  PointerRef key;
+
+  key.target = lo;
+  key.source = 0;
+
+  for( vector<PointerRef>::const_iterator i = std::lower_bound( _refs.begin(), _refs.end(), key ), e = _refs.end(); i != e && i->target < hi; ++i ){
+    found.push_back(*i);
+  }
+}
+
+void PointerScanner::printLocation( uintptr_t address, const Annotation *annotation ) const {
+  const MemoryMap *region = _index.find(address);
+
+  if( annotation && annotation->module.empty() == false ){
+    printf( "%p ( %s )", address, annotation->str().c_str() );
+  }
+  else if( region ){
+    printf( "%p ( %s+0x%lx )", address, region->name().empty() ? "-" : region->name().c_str(), address - region->begin() );
+  }
+  else {
+    printf( "%p", address );
+  }
+}
+
+void PointerScanner::chains( uintptr_t lo, uintptr_t hi, size_t depth, size_t max_offset, Symbolizer *symbolizer /* = NULL */ ) const {
+  vector<ChainNode> nodes;
+  vector<uintptr_t> addresses;
+  vector<Annotation> annotations;
+  size_t level_begin = 0, level_end = 0;
+
+  for( size_t level = 1; level <= depth && nodes.size() < POINTERS_MAX_CHAINS; ++level ){
+    level_begin = level_end;
+    level_end   = nodes.size();
+
+    // level 1 looks for the target range itself
+    size_t count = level == 1 ? 1 : level_end - level_begin;
+
+    for( size_t n = 0; n < count && nodes.size() < POINTERS_MAX_CHAINS; ++n ){
+      int parent = level == 1 ? -1 : level_begin + n;
+      uintptr_t from = level == 1 ? lo : nodes[parent].address - std::min( (uintptr_t)max_offset, nodes[parent].address ),
+                to   = level == 1 ? hi : nodes[parent].address + 1;
+      vector<PointerRef> found;
+
+      find( from, to, found );
+
+      for( vector<PointerRef>::iterator i = found.begin(), e = found.end(); i != e; ++i ){
+        ChainNode node;
+
+        node.address = i->source;
+        node.parent  = parent;
+        node.offset  = level == 1 ? i->target - lo : nodes[parent].address - i->target;
+        node.level   = level;
+
+        nodes.push_back(node);
+        addresses.push_back( node.address );
+      }
+    }
+
+    if( nodes.size() == level_end ){
+      break;
+    }
+  }
+
+  if( symbolizer ){
+    symbolizer->annotate( addresses, annotations );
+  }
+
+  // print every chain from the outermost pointer down to the target, every
+  // pointer plus its offset gives the next address.
+  for( size_t n = 0; n < nodes.size(); ++n ){
+    printf( "[%u] ", nodes[n].level );
+    for( int c = n; c != -1; c = nodes[c].parent ){
+      printLocation( nodes[c].address, annotations.empty() ? NULL : &annotations[c] );
+      if( nodes[c].parent == -1 ){
+        printf( " -> %p\n", lo + nodes[c].offset );
+      }
+      else {
+        printf( " -> +0x%lx -> ", nodes[c].offset );
+      }
+    }
+  }
+
+  if( nodes.size() >= POINTERS_MAX_CHAINS ){
+    printf( "\nStopped after %u chains.\n", POINTERS_MAX_CHAINS );
+  }
+}
+
+bool PointerScanner::save( const char *output ) const {
+  FILE *fp = fopen( output, "w+b" );
+  if( fp == NULL ){
+    perror("fopen");
+    fprintf( stderr, "Failed to create pointer map file.\n" );
+    return false;
+  }
+
+  for( vector<PointerRef>::const_iterator i = _refs.begin(), e = _refs.end(); i != e; ++i ){
+    fwrite( &i->target, sizeof(uintptr_t), 1, fp );
+    fwrite( &i->source, sizeof(uintptr_t), 1, fp );
+  }
+
+  fclose(fp);
+  // we're running as root, we need to chmod the file in order to pull it.
+  chmod( output, 0755 );
+
+  return true;
+}
+
+void PointerScanner::stats() const {
+  printf( "\n%u pointers found scanning %u KB of writable memory with %u jobs.\n", _refs.size(), _scanned / 1024, _jobs );
+}
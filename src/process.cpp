@@ -28,6 +28,7 @@
  */
 #include "process.h"
 #include <dirent.h>
+#include <fnmatch.h>
 
 inline bool is_numeric( const char *s ){
   for( const char *p = s; *p; p++ ){
@@ -45,25 +46,78 @@ Process *Process::find( const char *name ) {
   dir = opendir("/proc/");
   if( !dir ){
     perror("opendir");
-    FATAL( "Could not open /proc/.\n" );
+    return NULL;
   }
 
   while( (ent = readdir(dir)) != NULL ) {
     if( is_numeric( ent->d_name ) ){
       pid_t pid = strtoul( ent->d_name, NULL, 10 );
-      string proc_name = Process::parseName(pid);
-      if( proc_name == name ){
-        return new Process(pid);
+      string proc_name;
+      // the process might be gone already, just skip it
+      if( Process::parseName( pid, proc_name ) && proc_name == name ){
+        Process *process = Process::open(pid);
+        if( process != NULL ){
+          closedir(dir);
+          return process;
+        }
       }
     }
   }
   closedir(dir);
 
-  FATAL( "Could not find process '%s'.\n", name );
   return NULL;
 }
 
-string Process::parseName(pid_t pid) {
+Process *Process::open( pid_t pid ) {
+  Process *process = new Process();
+
+  process->_pid = pid;
+  if( !parseName( pid, process->_name ) || !parseMaps( pid, process->_memory ) ){
+    delete process;
+    return NULL;
+  }
+
+  return process;
+}
+
+vector<Process *> Process::findAll( const char *glob /* = NULL */ ) {
+  vector<Process *> processes;
+  DIR *dir = NULL;
+  struct dirent *ent = NULL;
+  pid_t self = getpid();
+
+  dir = opendir("/proc/");
+  if( !dir ){
+    perror("opendir");
+    return processes;
+  }
+
+  while( (ent = readdir(dir)) != NULL ) {
+    if( !is_numeric( ent->d_name ) ){
+      continue;
+    }
+
+    pid_t pid = strtoul( ent->d_name, NULL, 10 );
+    string proc_name;
+    // kernel threads have an empty command line and nothing to look at.
+    if( pid == self || !Process::parseName( pid, proc_name ) || proc_name.empty() ){
+      continue;
+    }
+    else if( glob != NULL && fnmatch( glob, proc_name.c_str(), 0 ) != 0 ){
+      continue;
+    }
+
+    Process *process = Process::open(pid);
+    if( process != NULL ){
+      processes.push_back(process);
+    }
+  }
+  closedir(dir);
+
+  return processes;
+}
+
+bool Process::parseName( pid_t pid, string& name ) {
   char procfile[0xFF] = {0},
        buffer[4096] = {0};
   FILE *fp = NULL;
@@ -71,22 +125,22 @@ string Process::parseName(pid_t pid) {
   sprintf( procfile, "/proc/%u/cmdline", pid );
   fp = fopen( procfile, "rt" );
   if( fp == NULL ){
-    FATAL( "Could not find pid %u.\n", pid );
+    return false;
   }
 
-  size_t read = fread( buffer, 1, sizeof(buffer), fp );
+  size_t read = fread( buffer, 1, sizeof(buffer) - 1, fp );
   if( read == 0 && !feof(fp) ){
     fclose(fp);
-    FATAL( "Error reading %s.\n", procfile );
+    return false;
   }
 
   fclose(fp);
 
-  return buffer;
+  name = buffer;
+  return true;
 }
 
-vector<MemoryMap> Process::parseMaps(pid_t pid) {
-  vector<MemoryMap> memory;
+bool Process::parseMaps( pid_t pid, vector<MemoryMap>& memory ) {
   char procfile[0xFF] = {0},
        buffer[4096] = {0};
   FILE *fp = NULL;
@@ -94,7 +148,7 @@ vector<MemoryMap> Process::parseMaps(pid_t pid) {
   sprintf( procfile, "/proc/%u/maps", pid );
   fp = fopen( procfile, "rt" );
   if( fp == NULL ){
-    FATAL( "Could not find %s.\n", procfile );
+    return false;
   }
 
   while( fgets( buffer, sizeof(buffer), fp ) ) {
@@ -108,12 +162,11 @@ vector<MemoryMap> Process::parseMaps(pid_t pid) {
   }
   fclose(fp);
 
-  return memory;
+  return true;
 }
 
-Process::Process( pid_t pid ) : _pid(pid) {
-  _name   = parseName(_pid);
-  _memory = parseMaps(_pid);
+Process::Process() : _pid(-1) {
+
 }
 
 void Process::dump() const {
@@ -125,6 +178,38 @@ void Process::dump() const {
   }
 }
 
+bool Process::refresh() {
+  vector<MemoryMap> memory;
+
+  if( !parseMaps( _pid, memory ) ){
+    return false;
+  }
+
+  _memory.swap( memory );
+  return true;
+}
+
+bool Process::threads( vector<pid_t>& tids ) const {
+  char path[0xFF] = {0};
+  struct dirent *ent = NULL;
+
+  sprintf( path, "/proc/%d/task", _pid );
+
+  DIR *dir = opendir(path);
+  if( dir == NULL ){
+    return false;
+  }
+
+  while( ( ent = readdir(dir) ) != NULL ){
+    if( ent->d_name[0] >= '0' && ent->d_name[0] <= '9' ){
+      tids.push_back( strtol( ent->d_name, NULL, 10 ) );
+    }
+  }
+
+  closedir(dir);
+  return true;
+}
+
 const MemoryMap *Process::findRegion( uintptr_t address ) {
   PROCESS_FOREACH_MAP_CONST(this){
     if( i->contains(address) ){
@@ -148,19 +233,27 @@ uintptr_t Process::findLibrary( const char *name ) {
 uintptr_t Process::findSymbol( uintptr_t local ) {
   // we need an instance for the local process to get the library name
   // given the symbol address
-  Process local_p(getpid());
+  Process *local_p = Process::open( getpid() );
+  if( local_p == NULL ){
+    fprintf( stderr, "Could not read our own memory map.\n" );
+    return 0;
+  }
 
   // printf( "Searching symbol %p\n", local );
 
-  const MemoryMap *local_mem = local_p.findRegion(local);
+  const MemoryMap *local_mem = local_p->findRegion(local);
   if(!local_mem){
     fprintf( stderr, "Could not find symbol locally.\n" );
+    delete local_p;
     return 0;
   }
 
   // printf( "Function found in %s %p\n", local_mem->name().c_str(), local_mem->begin() );
 
   string library_name = local_mem->name();
+  uintptr_t local_base = local_mem->begin();
+  delete local_p;
+
   uintptr_t library_handle = findLibrary( library_name.c_str() );
   if(!library_handle){
     fprintf( stderr, "Could not find library %s.\n", library_name.c_str() );
@@ -171,7 +264,7 @@ uintptr_t Process::findSymbol( uintptr_t local ) {
 
   // Compute the delta of the local and the remote modules and apply it to
   // the local address of the symbol ... BOOM, remote symbol address!
-  uintptr_t symbol = local + library_handle - local_mem->begin();
+  uintptr_t symbol = local + library_handle - local_base;
 
   // printf( "Found symbol %p\n", symbol );
 
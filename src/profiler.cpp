@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <set>
+#include <algorithm>
+
+#include "profiler.h"
+#include "hash.h"
+
+// older NDK headers lack these
+#ifndef PTRACE_SEIZE
+#define PTRACE_SEIZE      0x4206
+#endif
+#ifndef PTRACE_INTERRUPT
+#define PTRACE_INTERRUPT  0x4207
+#endif
+#ifndef PTRACE_EVENT_STOP
+#define PTRACE_EVENT_STOP 128
+#endif
+
+#define CPSR_T_MASK ( 1u << 5 )
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef std::pair<string, std::pair<size_t, size_t> > FlatEntry;
+
+static bool flat_more( const FlatEntry& a, const FlatEntry& b ) {
+  return a.second.first > b.second.first || ( a.second.first == b.second.first && a.second.second > b.second.second );
+}
+
+Profiler::Profiler( Process *process, unsigned int hz, double duration /* = PROFILE_DEFAULT_DURATION */, size_t window /* = PROFILE_STACK_WINDOW */ ) :
+  _process(process),
+  _reader(NULL),
+  _hz( hz ? hz : 1 ),
+  _duration(duration),
+  _window( window & ~( sizeof(long) - 1 ) ),
+  _ticks(0),
+  _samples(0),
+  _unique(0),
+  _overruns(0),
+  _depth(0),
+  _stopped(0),
+  _stopped_max(0),
+  _elapsed(0) {
+
+  // without process_vm_readv stacks are walked word by word while the
+  // threads are stopped, instead of being copied.
+  if( Tracer::canReadWithoutStopping() ){
+    _reader = new Tracer( _process, TRACER_NOSTOP );
+  }
+}
+
+Profiler::~Profiler() {
+  detachAll();
+  delete _reader;
+}
+
+void Profiler::seizeNew() {
+  vector<pid_t> tids;
+
+  if( _process->threads(tids) == false ){
+    return;
+  }
+
+  for( vector<pid_t>::iterator i = tids.begin(), e = tids.end(); i != e; ++i ){
+    if( _threads.find(*i) != _threads.end() ){
+      continue;
+    }
+    else if( ptrace( PTRACE_SEIZE, *i, 0, 0 ) != 0 ){
+      if( errno != ESRCH ){
+        perror("PTRACE_SEIZE");
+      }
+      continue;
+    }
+
+    ProfiledThread& thread = _threads[*i];
+    thread.tid = *i;
+
+    char path[0xFF] = {0}, name[0xFF] = {0};
+    sprintf( path, "/proc/%d/task/%d/comm", _process->pid(), *i );
+
+    FILE *fp = fopen( path, "rt" );
+    if( fp ){
+      if( fgets( name, sizeof(name), fp ) ){
+        char *p = strrchr( name, '\n' );
+        if( p ){
+          *p = 0x00;
+        }
+      }
+      fclose(fp);
+    }
+
+    _names[*i] = name;
+  }
+}
+
+bool Profiler::waitStop( ProfiledThread& thread ) {
+  int status = 0;
+
+  while(1) {
+    pid_t pid = waitpid( thread.tid, &status, __WALL );
+    if( pid == -1 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      return false;
+    }
+    else if( WIFEXITED(status) || WIFSIGNALED(status) ){
+      return false;
+    }
+    else if( ( status >> 16 ) == PTRACE_EVENT_STOP ){
+      return true;
+    }
+
+    // a signal for the thread, deliver it and wait for the interrupt
+    ptrace( PTRACE_CONT, thread.tid, 0, (void *)(uintptr_t)WSTOPSIG(status) );
+  }
+}
+
+bool Profiler::word( const ProfiledThread& thread, uintptr_t address, uintptr_t& value ) const {
+  if( address >= thread.stack_begin && address + sizeof(long) <= thread.stack_begin + thread.stack.size() ){
+    memcpy( &value, &thread.stack[ address - thread.stack_begin ], sizeof(long) );
+    return true;
+  }
+  else if( _reader == NULL ){
+    errno = 0;
+    value = ptrace( PTRACE_PEEKDATA, thread.tid, (void *)address, 0 );
+    return errno == 0;
+  }
+  return false;
+}
+
+void Profiler::unwind( const ProfiledThread& thread, vector<uintptr_t>& frames ) const {
+  const struct pt_regs& regs = thread.regs;
+  // Thumb code keeps the frame pointer in r7, ARM code in r11, and both
+  // save it right below the return address: [fp] = caller fp, [fp+4] = lr
+  uintptr_t fp = ( regs.ARM_cpsr & CPSR_T_MASK ) ? regs.ARM_r7 : regs.ARM_fp,
+            lr = regs.ARM_lr,
+            sp = regs.ARM_sp;
+
+  frames.clear();
+  frames.push_back( regs.ARM_pc );
+
+  size_t chain = frames.size();
+
+  while( frames.size() < PROFILE_MAX_DEPTH && fp >= sp && ( fp & ( sizeof(long) - 1 ) ) == 0 ){
+    uintptr_t next = 0, ret = 0;
+
+    if( word( thread, fp, next ) == false || word( thread, fp + sizeof(long), ret ) == false || ret == 0 ){
+      break;
+    }
+
+    frames.push_back(ret);
+
+    // frames go up the stack, anything else is not a frame chain
+    if( next <= fp ){
+      break;
+    }
+    fp = next;
+  }
+
+  // in a leaf function ( or before the prologue ) the caller is only in lr
+  if( lr && ( frames.size() == chain || frames[chain] != lr ) ){
+    const MemoryMap *region = _process->findRegion(lr);
+    if( region && region->isExecutable() ){
+      frames.insert( frames.begin() + chain, lr );
+    }
+  }
+}
+
+void Profiler::add( pid_t tid, const vector<uintptr_t>& frames ) {
+  uint32_t key = hash32( (const unsigned char *)&frames[0], frames.size() * sizeof(uintptr_t), tid );
+  vector<Stack>& bucket = _stacks[key];
+
+  ++_samples;
+  _depth += frames.size();
+
+  for( vector<Stack>::iterator i = bucket.begin(), e = bucket.end(); i != e; ++i ){
+    if( i->tid == tid && i->frames == frames ){
+      ++i->count;
+      return;
+    }
+  }
+
+  Stack stack;
+
+  stack.tid    = tid;
+  stack.frames = frames;
+  stack.count  = 1;
+
+  bucket.push_back(stack);
+  ++_unique;
+}
+
+void Profiler::tick() {
+  double start = now();
+  vector<pid_t> gone;
+
+  // interrupt everyone first, then collect the stops
+  for( map<pid_t, ProfiledThread>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    i->second.stopped = ptrace( PTRACE_INTERRUPT, i->first, 0, 0 ) == 0;
+    i->second.sampled = false;
+  }
+
+  for( map<pid_t, ProfiledThread>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    ProfiledThread& thread = i->second;
+
+    if( thread.stopped == false || waitStop(thread) == false ){
+      thread.stopped = false;
+      gone.push_back( i->first );
+      continue;
+    }
+
+    thread.sampled = ptrace( PTRACE_GETREGS, thread.tid, 0, &thread.regs ) == 0;
+    thread.stack.clear();
+
+    if( thread.sampled && _reader ){
+      uintptr_t sp = thread.regs.ARM_sp & ~( sizeof(long) - 1 ),
+                end = sp + _window;
+      const MemoryMap *region = _process->findRegion(sp);
+
+      if( region && region->end() < end ){
+        end = region->end();
+      }
+
+      thread.stack_begin = sp;
+      thread.stack.resize( end - sp );
+      if( thread.stack.empty() == false ){
+        thread.stack.resize( _reader->salvage( sp, &thread.stack[0], thread.stack.size() ) );
+      }
+    }
+    else if( thread.sampled ){
+      vector<uintptr_t> frames;
+      unwind( thread, frames );
+      add( thread.tid, frames );
+      ++thread.samples;
+      thread.sampled = false;
+    }
+  }
+
+  for( map<pid_t, ProfiledThread>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->second.stopped ){
+      ptrace( PTRACE_CONT, i->first, 0, 0 );
+    }
+  }
+
+  double stopped = now() - start;
+
+  _stopped    += stopped;
+  _stopped_max = std::max( _stopped_max, stopped );
+
+  for( vector<pid_t>::iterator i = gone.begin(), e = gone.end(); i != e; ++i ){
+    _threads.erase(*i);
+  }
+
+  // the expensive part runs while the threads do
+  vector<uintptr_t> frames;
+
+  for( map<pid_t, ProfiledThread>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->second.sampled ){
+      unwind( i->second, frames );
+      add( i->first, frames );
+      ++i->second.samples;
+    }
+  }
+}
+
+void Profiler::detachAll() {
+  for( map<pid_t, ProfiledThread>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    // a seized thread must be stopped to be detached
+    if( ptrace( PTRACE_INTERRUPT, i->first, 0, 0 ) == 0 && waitStop( i->second ) ){
+      ptrace( PTRACE_DETACH, i->first, 0, 0 );
+    }
+  }
+  _threads.clear();
+}
+
+bool Profiler::run( volatile sig_atomic_t *stop ) {
+  seizeNew();
+  if( _threads.empty() ){
+    fprintf( stderr, "Could not attach to any thread of process %d.\n", _process->pid() );
+    return false;
+  }
+
+  printf( "Profiling %u threads at %u Hz for %.1f s, hit CTRL+C to stop ...\n\n", _threads.size(), _hz, _duration );
+
+  double period = 1.0 / _hz,
+         start = now(),
+         next = start + period;
+
+  while( *stop == 0 && now() - start < _duration && _threads.empty() == false ){
+    double t = now();
+    if( t < next ){
+      struct timespec ts;
+      double wait = next - t;
+
+      ts.tv_sec  = (time_t)wait;
+      ts.tv_nsec = (long)( ( wait - ts.tv_sec ) * 1e9 );
+      nanosleep( &ts, NULL );
+    }
+    else if( t - next > period ){
+      // we're late, don't try to catch up with the missed samples
+      ++_overruns;
+      next = t;
+    }
+    next += period;
+
+    tick();
+
+    // pick up new threads about once per second
+    if( ++_ticks % _hz == 0 ){
+      seizeNew();
+    }
+  }
+
+  _elapsed = now() - start;
+
+  detachAll();
+
+  return _samples > 0;
+}
+
+void Profiler::flat( Symbolizer& symbolizer, size_t top /* = PROFILE_TOP */ ) const {
+  map<string, std::pair<size_t, size_t> > functions;
+
+  for( map<uint32_t, vector<Stack> >::const_iterator b = _stacks.begin(), be = _stacks.end(); b != be; ++b ){
+    for( vector<Stack>::const_iterator s = b->second.begin(), se = b->second.end(); s != se; ++s ){
+      std::set<string> seen;
+
+      functions[ symbolizer.resolve( s->frames[0] ) ].first += s->count;
+
+      // recursion counts once
+      for( vector<uintptr_t>::const_iterator f = s->frames.begin(), fe = s->frames.end(); f != fe; ++f ){
+        const string& name = symbolizer.resolve(*f);
+        if( seen.insert(name).second ){
+          functions[name].second += s->count;
+        }
+      }
+    }
+  }
+
+  vector<FlatEntry> sorted( functions.begin(), functions.end() );
+  std::sort( sorted.begin(), sorted.end(), flat_more );
+
+  printf( "\n    self    total  function\n\n" );
+
+  for( size_t i = 0; i < sorted.size() && i < top; ++i ){
+    printf( "  %5.1f%%   %5.1f%%  %s\n",
+            sorted[i].second.first * 100.0 / _samples,
+            sorted[i].second.second * 100.0 / _samples,
+            sorted[i].first.c_str() );
+  }
+
+  printf( "\n" );
+}
+
+void Profiler::folded( Symbolizer& symbolizer, FILE *fp ) const {
+  // stacks differing only by addresses inside the same functions merge
+  map<string, size_t> lines;
+
+  for( map<uint32_t, vector<Stack> >::const_iterator b = _stacks.begin(), be = _stacks.end(); b != be; ++b ){
+    for( vector<Stack>::const_iterator s = b->second.begin(), se = b->second.end(); s != se; ++s ){
+      map<pid_t, string>::const_iterator name = _names.find( s->tid );
+      string line = name != _names.end() && name->second.empty() == false ? name->second : "?";
+
+      for( vector<uintptr_t>::const_reverse_iterator f = s->frames.rbegin(), fe = s->frames.rend(); f != fe; ++f ){
+        line += ";" + symbolizer.resolve(*f);
+      }
+      lines[line] += s->count;
+    }
+  }
+
+  for( map<string, size_t>::iterator i = lines.begin(), e = lines.end(); i != e; ++i ){
+    fprintf( fp, "%s %u\n", i->first.c_str(), i->second );
+  }
+}
+
+void Profiler::stats() const {
+  printf( "%u samples of %u threads in %u ticks over %.2f s : %u unique stacks, %.1f frames per stack, %u overruns.\n",
+          _samples,
+          _names.size(),
+          _ticks,
+          _elapsed,
+          _unique,
+          _samples ? (double)_depth / _samples : 0.0,
+          _overruns );
+
+  printf( "Threads were stopped %.3f ms per tick on average, %.3f ms at most, %.2f%% of the time.\n",
+          _ticks ? _stopped * 1000.0 / _ticks : 0.0,
+          _stopped_max * 1000.0,
+          _elapsed > 0 ? _stopped * 100.0 / _elapsed : 0.0 );
+}
@@ -0,0 +1,795 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "regex.h"
+
+int Regex::_ByteSet::count() const {
+  int n = 0;
+  for( int i = 0; i < 256; ++i ){
+    n += has(i);
+  }
+  return n;
+}
+
+Regex::Regex( const char *expr, bool utf16 /* = false */ ) :
+  _expr(expr),
+  _utf16(utf16),
+  _p(expr),
+  _start(-1),
+  _rstart(-1),
+  _reversed(false) {
+
+  memset( _first, 0, sizeof(_first) );
+
+  int root = parseAlt();
+  if( _error.empty() && *_p != 0x00 ){
+    _error = "unexpected ')'";
+  }
+
+  if( _error.empty() == false ){
+    return;
+  }
+
+  Fragment f = compile(root);
+  int match  = state(NFA_MATCH);
+
+  patch( f.outs, match );
+  _start = f.start;
+
+  _reversed = true;
+  f = compile(root);
+  patch( f.outs, state(NFA_MATCH) );
+  _rstart = f.start;
+  _reversed = false;
+
+  literalPrefix(root);
+  flush();
+}
+
+int Regex::node( node_type_t type, int left /* = -1 */, int right /* = -1 */ ) {
+  Node n;
+
+  n.type  = type;
+  n.left  = left;
+  n.right = right;
+  n.min   = 0;
+  n.max   = 0;
+
+  _ast.push_back(n);
+  return _ast.size() - 1;
+}
+
+int Regex::setNode( const ByteSet& set, bool any_high /* = false */ ) {
+  int n = node(NODE_SET);
+
+  _ast[n].low = set;
+  if( any_high ){
+    _ast[n].high.fill();
+  }
+  else {
+    _ast[n].high.add(0x00);
+  }
+
+  return n;
+}
+
+int Regex::parseAlt() {
+  int left = parseConcat();
+
+  while( _error.empty() && *_p == '|' ){
+    ++_p;
+    int right = parseConcat();
+    left = node( NODE_ALT, left, right );
+  }
+
+  return left;
+}
+
+int Regex::parseConcat() {
+  int result = -1;
+
+  while( _error.empty() && *_p && *_p != '|' && *_p != ')' ){
+    int r = parseRepeat();
+    result = result == -1 ? r : node( NODE_CAT, result, r );
+  }
+
+  return result == -1 ? node(NODE_EMPTY) : result;
+}
+
+int Regex::parseRepeat() {
+  int atom = parseAtom();
+
+  while( _error.empty() ){
+    int min = 0, max = 0;
+
+    if( *_p == '*' ){
+      min = 0; max = -1;
+    }
+    else if( *_p == '+' ){
+      min = 1; max = -1;
+    }
+    else if( *_p == '?' ){
+      min = 0; max = 1;
+    }
+    else if( *_p == '{' ){
+      char *end = NULL;
+
+      min = max = strtol( _p + 1, &end, 10 );
+      if( end == _p + 1 ){
+        _error = "invalid repetition";
+        break;
+      }
+      else if( *end == ',' ){
+        const char *p = end + 1;
+        if( *p == '}' ){
+          max = -1;
+          end = (char *)p;
+        }
+        else {
+          max = strtol( p, &end, 10 );
+          // {n,x} is not {n,}
+          if( end == p ){
+            --end;
+          }
+        }
+      }
+
+      if( *end != '}' || min < 0 || ( max != -1 && max < min ) || min > REGEX_MAX_REPEAT || max > REGEX_MAX_REPEAT ){
+        _error = "invalid repetition";
+        break;
+      }
+      _p = end;
+    }
+    else {
+      break;
+    }
+
+    ++_p;
+    atom = node( NODE_REPEAT, atom );
+    _ast[atom].min = min;
+    _ast[atom].max = max;
+  }
+
+  return atom;
+}
+
+int Regex::parseAtom() {
+  ByteSet set;
+  char c = *_p++;
+
+  switch(c) {
+    case '(': {
+      // non capturing groups are the same thing for us
+      if( _p[0] == '?' && _p[1] == ':' ){
+        _p += 2;
+      }
+      int inner = parseAlt();
+      if( _error.empty() && *_p++ != ')' ){
+        _error = "missing ')'";
+      }
+      return inner;
+    }
+
+    case '[':
+      return parseClass();
+
+    case '.':
+      set.fill();
+      if( _utf16 == false ){
+        // any byte but new line
+        set.bits['\n' >> 5] &= ~( 1u << ( '\n' & 31 ) );
+      }
+      return setNode( set, true );
+
+    case '\\':
+      if( parseEscape(set) == false ){
+        return -1;
+      }
+      return setNode(set);
+
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      _error = "nothing to repeat";
+      return -1;
+
+    default:
+      set.add(c);
+      return setNode(set);
+  }
+}
+
+// what parseClassByte returns when there's no single byte
+#define CLASS_ESCAPE  -1
+#define CLASS_ERROR   -2
+
+int Regex::parseClassByte( ByteSet& set ) {
+  if( *_p != '\\' ){
+    return (unsigned char)*_p++;
+  }
+
+  ByteSet escaped;
+
+  ++_p;
+  if( parseEscape(escaped) == false ){
+    return CLASS_ERROR;
+  }
+
+  // \x41, \n ... are range endpoints as much as plain bytes
+  if( escaped.count() == 1 ){
+    for( int i = 0; i < 256; ++i ){
+      if( escaped.has(i) ){
+        return i;
+      }
+    }
+  }
+
+  for( int i = 0; i < 8; ++i ){
+    set.bits[i] |= escaped.bits[i];
+  }
+
+  return CLASS_ESCAPE;
+}
+
+int Regex::parseClass() {
+  ByteSet set;
+  bool negate = false;
+
+  if( *_p == '^' ){
+    negate = true;
+    ++_p;
+  }
+
+  // a ']' right after the '[' is a literal
+  for( bool first = true; *_p && ( first || *_p != ']' ); first = false ){
+    int lo = parseClassByte(set);
+    if( lo == CLASS_ERROR ){
+      return -1;
+    }
+    else if( lo == CLASS_ESCAPE ){
+      continue;
+    }
+
+    if( _p[0] == '-' && _p[1] && _p[1] != ']' ){
+      ByteSet escaped;
+
+      ++_p;
+      int hi = parseClassByte(escaped);
+      if( hi == CLASS_ERROR ){
+        return -1;
+      }
+      else if( hi == CLASS_ESCAPE || hi < lo ){
+        _error = "invalid range";
+        return -1;
+      }
+      for( int i = lo; i <= hi; ++i ){
+        set.add(i);
+      }
+    }
+    else {
+      set.add(lo);
+    }
+  }
+
+  if( *_p++ != ']' ){
+    _error = "missing ']'";
+    return -1;
+  }
+
+  if( negate ){
+    set.invert();
+  }
+
+  return setNode(set);
+}
+
+bool Regex::parseEscape( ByteSet& set ) {
+  char c = *_p++;
+  ByteSet escaped;
+  bool invert = false;
+
+  switch(c) {
+    case 0x00:
+      --_p;
+      _error = "trailing '\\'";
+      return false;
+
+    case 'D': invert = true;
+    // fall through
+    case 'd':
+      for( int i = '0'; i <= '9'; ++i ) escaped.add(i);
+    break;
+
+    case 'W': invert = true;
+    // fall through
+    case 'w':
+      for( int i = '0'; i <= '9'; ++i ) escaped.add(i);
+      for( int i = 'a'; i <= 'z'; ++i ) escaped.add(i);
+      for( int i = 'A'; i <= 'Z'; ++i ) escaped.add(i);
+      escaped.add('_');
+    break;
+
+    case 'S': invert = true;
+    // fall through
+    case 's':
+      escaped.add(' ');
+      escaped.add('\t');
+      escaped.add('\r');
+      escaped.add('\n');
+      escaped.add('\f');
+      escaped.add('\v');
+    break;
+
+    case 'n': escaped.add('\n'); break;
+    case 'r': escaped.add('\r'); break;
+    case 't': escaped.add('\t'); break;
+    case '0': escaped.add(0x00); break;
+
+    case 'x': {
+      unsigned int byte = 0;
+      if( !isxdigit(_p[0]) || !isxdigit(_p[1]) || sscanf( _p, "%2x", &byte ) != 1 ){
+        _error = "invalid \\x escape";
+        return false;
+      }
+      _p += 2;
+      escaped.add(byte);
+    }
+    break;
+
+    default:
+      escaped.add(c);
+  }
+
+  if( invert ){
+    escaped.invert();
+  }
+
+  for( int i = 0; i < 8; ++i ){
+    set.bits[i] |= escaped.bits[i];
+  }
+
+  return true;
+}
+
+int Regex::state( state_type_t type, int out /* = -1 */, int out1 /* = -1 */ ) {
+  State s;
+
+  s.type = type;
+  s.out  = out;
+  s.out1 = out1;
+
+  _nfa.push_back(s);
+  return _nfa.size() - 1;
+}
+
+void Regex::patch( const Outs& outs, int target ) {
+  for( Outs::const_iterator i = outs.begin(), e = outs.end(); i != e; ++i ){
+    if( i->second == 0 ){
+      _nfa[i->first].out = target;
+    }
+    else {
+      _nfa[i->first].out1 = target;
+    }
+  }
+}
+
+Regex::Fragment Regex::compile( int n ) {
+  const Node &nd = _ast[n];
+  Fragment f, a, b;
+
+  switch( nd.type ) {
+    case NODE_SET:
+      f.start = state(NFA_SET);
+      _nfa[f.start].set = _reversed && _utf16 ? nd.high : nd.low;
+      if( _utf16 ){
+        int high = state(NFA_SET);
+        _nfa[high].set = _reversed ? nd.low : nd.high;
+        _nfa[f.start].out = high;
+        f.outs.push_back( std::make_pair( high, 0 ) );
+      }
+      else {
+        f.outs.push_back( std::make_pair( f.start, 0 ) );
+      }
+    break;
+
+    case NODE_EMPTY:
+      f.start = state(NFA_EMPTY);
+      f.outs.push_back( std::make_pair( f.start, 0 ) );
+    break;
+
+    case NODE_CAT:
+      a = compile( _reversed ? nd.right : nd.left );
+      b = compile( _reversed ? nd.left : nd.right );
+      patch( a.outs, b.start );
+      f.start = a.start;
+      f.outs  = b.outs;
+    break;
+
+    case NODE_ALT:
+      a = compile(nd.left);
+      b = compile(nd.right);
+      f.start = state( NFA_SPLIT, a.start, b.start );
+      f.outs  = a.outs;
+      f.outs.insert( f.outs.end(), b.outs.begin(), b.outs.end() );
+    break;
+
+    case NODE_REPEAT:
+      f.start = state(NFA_EMPTY);
+      f.outs.push_back( std::make_pair( f.start, 0 ) );
+
+      for( int i = 0; i < nd.min; ++i ){
+        a = compile(nd.left);
+        patch( f.outs, a.start );
+        f.outs = a.outs;
+      }
+
+      if( nd.max == -1 ){
+        a = compile(nd.left);
+        int split = state( NFA_SPLIT, a.start );
+        patch( a.outs, split );
+        patch( f.outs, split );
+        f.outs.clear();
+        f.outs.push_back( std::make_pair( split, 1 ) );
+      }
+      else {
+        for( int i = nd.min; i < nd.max; ++i ){
+          a = compile(nd.left);
+          int split = state( NFA_SPLIT, a.start );
+          patch( f.outs, split );
+          f.outs = a.outs;
+          f.outs.push_back( std::make_pair( split, 1 ) );
+        }
+      }
+    break;
+  }
+
+  return f;
+}
+
+bool Regex::literalPrefix( int n ) {
+  const Node &nd = _ast[n];
+
+  if( nd.type == NODE_SET ){
+    if( nd.low.count() != 1 || ( _utf16 && nd.high.count() != 1 ) ){
+      return false;
+    }
+
+    for( int i = 0; i < 256; ++i ){
+      if( nd.low.has(i) ){
+        _prefix += (char)i;
+      }
+    }
+    for( int i = 0; _utf16 && i < 256; ++i ){
+      if( nd.high.has(i) ){
+        _prefix += (char)i;
+      }
+    }
+    return true;
+  }
+  else if( nd.type == NODE_CAT ){
+    return literalPrefix(nd.left) && literalPrefix(nd.right);
+  }
+
+  return false;
+}
+
+void Regex::closure( int s, vector<int>& set, vector<bool>& seen ) const {
+  vector<int> stack( 1, s );
+
+  while( stack.empty() == false ){
+    s = stack.back();
+    stack.pop_back();
+
+    if( s == -1 || seen[s] ){
+      continue;
+    }
+    seen[s] = true;
+
+    switch( _nfa[s].type ){
+      case NFA_SET:
+      case NFA_MATCH:
+        set.push_back(s);
+      break;
+
+      case NFA_SPLIT:
+        stack.push_back( _nfa[s].out1 );
+        stack.push_back( _nfa[s].out );
+      break;
+
+      case NFA_EMPTY:
+        stack.push_back( _nfa[s].out );
+      break;
+    }
+  }
+}
+
+int Regex::dstate( Dfa& dfa, const vector<int>& unsorted ) {
+  vector<int> set(unsorted);
+
+  std::sort( set.begin(), set.end() );
+
+  map< vector<int>, int>::iterator i = dfa.index.find(set);
+  if( i != dfa.index.end() ){
+    return i->second;
+  }
+
+  bool accept = false;
+  for( size_t j = 0; j < set.size() && !accept; ++j ){
+    accept = _nfa[ set[j] ].type == NFA_MATCH;
+  }
+
+  int id = dfa.states.size();
+
+  dfa.states.push_back(set);
+  dfa.index[set] = id;
+  dfa.accept.push_back(accept);
+  dfa.trans.resize( dfa.states.size() * 256, -1 );
+
+  return id;
+}
+
+void Regex::reset( Dfa& dfa ) {
+  vector<int> empty, start;
+  vector<bool> seen( _nfa.size(), false );
+
+  dfa.states.clear();
+  dfa.index.clear();
+  dfa.accept.clear();
+  dfa.trans.clear();
+
+  closure( dfa.start, start, seen );
+
+  // 0 is the dead state, 1 the start state
+  dstate( dfa, empty );
+  dstate( dfa, start );
+}
+
+void Regex::flush() {
+  _forward.start     = _start;
+  _forward.floating  = false;
+  _floating.start    = _start;
+  _floating.floating = true;
+  _backward.start    = _rstart;
+  _backward.floating = false;
+
+  reset(_forward);
+  reset(_floating);
+  reset(_backward);
+
+  for( int c = 0; c < 256; ++c ){
+    _first[c] = step( _forward, 1, c ) != 0;
+  }
+}
+
+int Regex::step( Dfa& dfa, int d, unsigned char c ) {
+  int t = dfa.trans[ d * 256 + c ];
+  if( t != -1 ){
+    return t;
+  }
+
+  vector<int> next, current( dfa.states[d] );
+  vector<bool> seen( _nfa.size(), false );
+
+  for( vector<int>::const_iterator i = current.begin(), e = current.end(); i != e; ++i ){
+    const State &s = _nfa[*i];
+    if( s.type == NFA_SET && s.set.has(c) ){
+      closure( s.out, next, seen );
+    }
+  }
+
+  if( dfa.floating ){
+    closure( dfa.start, next, seen );
+  }
+
+  // too many states, start over keeping only the one we're going to
+  if( dfa.states.size() >= REGEX_MAX_STATES ){
+    reset(dfa);
+    return dstate( dfa, next );
+  }
+
+  t = dstate( dfa, next );
+  dfa.trans[ d * 256 + c ] = t;
+
+  return t;
+}
+
+bool Regex::find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length ) {
+  if( _error.empty() == false ){
+    return false;
+  }
+
+  size_t p = from, plen = _prefix.size();
+
+  while( p < size ){
+    // jump to the next possible match
+    if( plen ){
+      const unsigned char *q = (const unsigned char *)memchr( data + p, (unsigned char)_prefix[0], size - p );
+      if( q == NULL || (size_t)( data + size - q ) < plen ){
+        return false;
+      }
+
+      p = q - data;
+      if( memcmp( q, _prefix.data(), plen ) != 0 ){
+        ++p;
+        continue;
+      }
+    }
+    else {
+      while( p < size && _first[ data[p] ] == false ){
+        ++p;
+      }
+      if( p >= size ){
+        return false;
+      }
+
+      // Without a prefix to jump to, trying every candidate would scan up
+      // to REGEX_MAX_MATCH bytes each: a single unanchored pass finds where
+      // the first match ends and a backward one where it starts.
+      size_t end = 0;
+      int d = 1;
+
+      for( size_t q = p; q < size; ++q ){
+        // known transitions without a call, this loop is the whole scan
+        int t = _floating.trans[ d * 256 + data[q] ];
+        d = t != -1 ? t : step( _floating, d, data[q] );
+        if( _floating.accept[d] ){
+          end = q + 1;
+          break;
+        }
+      }
+
+      if( end == 0 ){
+        return false;
+      }
+
+      size_t floor = std::max( p, end > REGEX_MAX_MATCH ? end - REGEX_MAX_MATCH : 0 ), begin = end;
+
+      d = 1;
+      for( size_t q = end; q > floor; --q ){
+        d = step( _backward, d, data[q - 1] );
+        if( d == 0 ){
+          break;
+        }
+        else if( _backward.accept[d] ){
+          begin = q - 1;
+        }
+      }
+
+      // longer than REGEX_MAX_MATCH, go on after it
+      if( begin == end ){
+        p = end;
+        continue;
+      }
+
+      p = begin;
+    }
+
+    size_t limit = std::min( size, p + REGEX_MAX_MATCH ), last = p;
+    int d = 1;
+
+    for( size_t q = p; q < limit; ++q ){
+      d = step( _forward, d, data[q] );
+      if( d == 0 ){
+        break;
+      }
+      else if( _forward.accept[d] ){
+        last = q + 1;
+      }
+    }
+
+    if( last > p ){
+      start  = p;
+      length = last - p;
+      return true;
+    }
+
+    ++p;
+  }
+
+  return false;
+}
+
+RegexMatcher::RegexMatcher( const char *expr, int encodings ) :
+  _expr(expr),
+  _encodings(encodings),
+  _ascii(NULL),
+  _utf16(NULL) {
+
+  if( _encodings & REGEX_ASCII ){
+    _ascii = new Regex( expr, false );
+  }
+  if( _encodings & REGEX_UTF16LE ){
+    _utf16 = new Regex( expr, true );
+  }
+
+  reset();
+}
+
+RegexMatcher::~RegexMatcher() {
+  delete _ascii;
+  delete _utf16;
+}
+
+bool RegexMatcher::valid( string& error ) const {
+  const Regex *r = _ascii ? _ascii : _utf16;
+  if( r == NULL ){
+    error = "no encoding selected";
+    return false;
+  }
+  error = r->error();
+  return r->valid();
+}
+
+Matcher *RegexMatcher::clone() const {
+  return new RegexMatcher( _expr.c_str(), _encodings );
+}
+
+size_t RegexMatcher::maxLength() const {
+  return REGEX_MAX_MATCH;
+}
+
+void RegexMatcher::reset() {
+  _cached[0].state = _cached[1].state = CACHE_UNKNOWN;
+}
+
+bool RegexMatcher::find( const unsigned char *data, size_t size, size_t from, size_t& start, size_t& length ) {
+  Regex *regexes[2] = { _ascii, _utf16 };
+  int best = -1;
+
+  for( int i = 0; i < 2; ++i ){
+    Cached &c = _cached[i];
+
+    if( regexes[i] == NULL ){
+      continue;
+    }
+    // the other encoding might have matched many times meanwhile, so the
+    // last result is kept as long as it's still ahead of us.
+    else if( c.state == CACHE_UNKNOWN || ( c.state == CACHE_FOUND && c.start < from ) ){
+      c.state = regexes[i]->find( data, size, from, c.start, c.length ) ? CACHE_FOUND : CACHE_NONE;
+    }
+
+    if( c.state == CACHE_FOUND && ( best == -1 || c.start < _cached[best].start ) ){
+      best = i;
+    }
+  }
+
+  if( best == -1 ){
+    return false;
+  }
+
+  start  = _cached[best].start;
+  length = _cached[best].length;
+  return true;
+}
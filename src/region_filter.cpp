@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <pthread.h>
+
+#include "region_filter.h"
+#include "regex.h"
+#include "common.h"
+
+class NamePredicate : public RegionPredicate {
+private:
+
+  string _word;
+  bool   _glob;
+
+public:
+
+  NamePredicate( const string& word, bool glob ) : _word(word), _glob(glob) { }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    if( _glob ){
+      return fnmatch( _word.c_str(), region.name().c_str(), 0 ) == 0;
+    }
+    return region.name().find(_word) != string::npos;
+  }
+};
+
+class RegexPredicate : public RegionPredicate {
+private:
+
+  // the DFA of the regex is built while matching, searches from many
+  // threads are serialized.
+  mutable Regex           _regex;
+  mutable pthread_mutex_t _lock;
+
+public:
+
+  RegexPredicate( const string& expr ) : _regex( expr.c_str() ) {
+    pthread_mutex_init( &_lock, NULL );
+  }
+
+  virtual ~RegexPredicate() {
+    pthread_mutex_destroy( &_lock );
+  }
+
+  inline const Regex& regex() const {
+    return _regex;
+  }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    string name = region.name();
+    size_t start = 0, length = 0;
+
+    pthread_mutex_lock( &_lock );
+    bool found = _regex.find( (const unsigned char *)name.c_str(), name.size(), 0, start, length );
+    pthread_mutex_unlock( &_lock );
+
+    return found;
+  }
+};
+
+class PermPredicate : public RegionPredicate {
+private:
+
+  string _perms;
+
+public:
+
+  PermPredicate( const string& perms ) : _perms(perms) { }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    string perms = region.permissions();
+    for( size_t i = 0; i < _perms.size(); ++i ){
+      if( perms.find( _perms[i] ) == string::npos ){
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+class TypePredicate : public RegionPredicate {
+private:
+
+  bool _file;
+
+public:
+
+  TypePredicate( bool file ) : _file(file) { }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    return region.isFileBacked() == _file;
+  }
+};
+
+class RangePredicate : public RegionPredicate {
+public:
+
+  typedef enum {
+    RANGE_SIZE = 0,
+    RANGE_ADDRESS,
+    RANGE_OFFSET,
+    RANGE_INODE
+  }
+  field_t;
+
+private:
+
+  field_t            _field;
+  unsigned long long _low;
+  unsigned long long _high;
+
+public:
+
+  RangePredicate( field_t field, unsigned long long low, unsigned long long high ) : _field(field), _low(low), _high(high) { }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    switch( _field ){
+      case RANGE_SIZE:    return region.size() >= _low && region.size() <= _high;
+      case RANGE_ADDRESS: return region.begin() <= _high && region.end() - 1 >= _low;
+      case RANGE_OFFSET:  return region.offset() >= _low && region.offset() <= _high;
+      case RANGE_INODE:   return region.inode() >= _low && region.inode() <= _high;
+    }
+    return false;
+  }
+};
+
+class NotPredicate : public RegionPredicate {
+private:
+
+  RegionPredicate *_child;
+
+public:
+
+  NotPredicate( RegionPredicate *child ) : _child(child) { }
+
+  virtual ~NotPredicate() {
+    delete _child;
+  }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    return !_child->matches(region);
+  }
+};
+
+// all children must match, or any of them if 'any'.
+class ListPredicate : public RegionPredicate {
+private:
+
+  bool                      _any;
+  vector<RegionPredicate *> _children;
+
+public:
+
+  ListPredicate( bool any ) : _any(any) { }
+
+  virtual ~ListPredicate() {
+    for( vector<RegionPredicate *>::iterator i = _children.begin(), e = _children.end(); i != e; ++i ){
+      delete *i;
+    }
+  }
+
+  inline void add( RegionPredicate *child ) {
+    _children.push_back(child);
+  }
+
+  virtual bool matches( const MemoryMap& region ) const {
+    for( vector<RegionPredicate *>::const_iterator i = _children.begin(), e = _children.end(); i != e; ++i ){
+      if( (*i)->matches(region) == _any ){
+        return _any;
+      }
+    }
+    return !_any;
+  }
+};
+
+// Recursive descent parser of filter expressions, see region_filter.h
+class FilterParser {
+private:
+
+  const char *_p;
+  string      _error;
+
+  static inline bool isDelimiter( char c ) {
+    return c == 0x00 || c == ' ' || c == '\t' || c == ',' || c == '|' || c == ')';
+  }
+
+  inline void skipSpaces() {
+    while( *_p == ' ' || *_p == '\t' ){
+      ++_p;
+    }
+  }
+
+  RegionPredicate *fail( const string& error, RegionPredicate *node = NULL ) {
+    if( _error.empty() ){
+      _error = error;
+    }
+    delete node;
+    return NULL;
+  }
+
+  bool value( string& out ) {
+    if( *_p == '"' ){
+      const char *end = strchr( _p + 1, '"' );
+      if( end == NULL ){
+        return false;
+      }
+      out.assign( _p + 1, end );
+      _p = end + 1;
+    }
+    else {
+      const char *start = _p;
+      while( !isDelimiter(*_p) ){
+        ++_p;
+      }
+      out.assign( start, _p );
+    }
+    return out.empty() == false;
+  }
+
+  static bool number( const char *s, int base, unsigned long long& n, const char **end ) {
+    char *e = NULL;
+
+    n = strtoull( s, &e, base );
+    if( e == s ){
+      return false;
+    }
+
+    switch( *e ){
+      case 'k': case 'K': n <<= 10; ++e; break;
+      case 'm': case 'M': n <<= 20; ++e; break;
+      case 'g': case 'G': n <<= 30; ++e; break;
+    }
+
+    *end = e;
+    return true;
+  }
+
+  static bool range( const string& value, int base, unsigned long long& low, unsigned long long& high ) {
+    const char *s = value.c_str(), *e = NULL;
+
+    low  = 0;
+    high = ~0ULL;
+
+    if( *s == '<' ){
+      return number( s + 1, base, high, &e ) && *e == 0x00;
+    }
+    else if( *s == '>' ){
+      return number( s + 1, base, low, &e ) && *e == 0x00;
+    }
+    else if( number( s, base, low, &e ) == false ){
+      return false;
+    }
+    else if( *e == '-' ){
+      return number( e + 1, base, high, &e ) && *e == 0x00 && low <= high;
+    }
+
+    high = low;
+    return *e == 0x00;
+  }
+
+  RegionPredicate *term() {
+    const char *start = _p;
+    string key, val;
+
+    while( ( *_p >= 'a' && *_p <= 'z' ) ){
+      ++_p;
+    }
+
+    if( *_p == ':' ){
+      key.assign( start, _p );
+      ++_p;
+    }
+
+    if( key != "perm" && key != "type" && key != "size" && key != "addr" &&
+        key != "offset" && key != "inode" && key != "name" && key != "re" ){
+      // not a known key, the whole word is a substring of the name
+      _p = start;
+      key = "";
+    }
+
+    if( value(val) == false ){
+      return fail( "missing value after '" + string( start, _p ) + "'" );
+    }
+
+    unsigned long long low = 0, high = 0;
+
+    if( key == "" ){
+      return new NamePredicate( val, false );
+    }
+    else if( key == "name" ){
+      return new NamePredicate( val, true );
+    }
+    else if( key == "re" ){
+      RegexPredicate *re = new RegexPredicate(val);
+      if( re->regex().valid() == false ){
+        return fail( "invalid regular expression '" + val + "': " + re->regex().error(), re );
+      }
+      return re;
+    }
+    else if( key == "perm" ){
+      if( val.find_first_not_of("rwxsp") != string::npos ){
+        return fail( "invalid permissions '" + val + "'" );
+      }
+      return new PermPredicate(val);
+    }
+    else if( key == "type" ){
+      if( val != "anon" && val != "file" ){
+        return fail( "type must be anon or file" );
+      }
+      return new TypePredicate( val == "file" );
+    }
+    else if( key == "size" || key == "inode" ){
+      if( range( val, 10, low, high ) == false ){
+        return fail( "invalid range '" + val + "'" );
+      }
+      return new RangePredicate( key == "size" ? RangePredicate::RANGE_SIZE : RangePredicate::RANGE_INODE, low, high );
+    }
+    else {
+      if( range( val, 16, low, high ) == false ){
+        return fail( "invalid range '" + val + "'" );
+      }
+      return new RangePredicate( key == "addr" ? RangePredicate::RANGE_ADDRESS : RangePredicate::RANGE_OFFSET, low, high );
+    }
+  }
+
+  RegionPredicate *unary() {
+    skipSpaces();
+
+    if( *_p == '!' ){
+      ++_p;
+      RegionPredicate *child = unary();
+      return child ? new NotPredicate(child) : NULL;
+    }
+    else if( *_p == '(' ){
+      ++_p;
+      RegionPredicate *child = alternatives();
+      if( child == NULL ){
+        return NULL;
+      }
+
+      skipSpaces();
+      if( *_p != ')' ){
+        return fail( "missing ')'", child );
+      }
+      ++_p;
+      return child;
+    }
+    else if( isDelimiter(*_p) ){
+      return fail( *_p ? string("unexpected '") + *_p + "'" : "unexpected end of expression" );
+    }
+
+    return term();
+  }
+
+  RegionPredicate *all() {
+    ListPredicate *list = new ListPredicate(false);
+
+    while(1) {
+      RegionPredicate *child = unary();
+      if( child == NULL ){
+        return fail( "", list );
+      }
+      list->add(child);
+
+      skipSpaces();
+      if( *_p == ',' ){
+        ++_p;
+      }
+      else if( *_p == 0x00 || *_p == '|' || *_p == ')' ){
+        return list;
+      }
+    }
+  }
+
+  RegionPredicate *alternatives() {
+    ListPredicate *list = new ListPredicate(true);
+
+    while(1) {
+      RegionPredicate *child = all();
+      if( child == NULL ){
+        return fail( "", list );
+      }
+      list->add(child);
+
+      if( *_p != '|' ){
+        return list;
+      }
+      ++_p;
+    }
+  }
+
+public:
+
+  FilterParser( const char *expression ) : _p(expression) { }
+
+  RegionPredicate *parse() {
+    RegionPredicate *root = alternatives();
+    if( root != NULL && *_p != 0x00 ){
+      return fail( string("unexpected '") + *_p + "'", root );
+    }
+    return root;
+  }
+
+  inline const string& error() const {
+    return _error;
+  }
+};
+
+RegionFilter::RegionFilter() :
+  _root(NULL),
+  _selected(0),
+  _selected_bytes(0) {
+
+  for( int i = 0; i < PRUNED_REASONS; ++i ){
+    _pruned[i] = _pruned_bytes[i] = 0;
+  }
+}
+
+RegionFilter::~RegionFilter() {
+  delete _root;
+}
+
+bool RegionFilter::compile( const string& expression, string& error ) {
+  FilterParser parser( expression.c_str() );
+  RegionPredicate *root = parser.parse();
+
+  if( root == NULL ){
+    error = parser.error();
+    return false;
+  }
+
+  delete _root;
+  _root = root;
+  _expression = expression;
+  return true;
+}
+
+bool RegionFilter::matches( const MemoryMap& region ) const {
+  return _root == NULL || _root->matches(region);
+}
+
+void RegionFilter::prune( prune_reason_t reason, const MemoryMap& region ) {
+  __sync_fetch_and_add( &_pruned[reason], 1 );
+  __sync_fetch_and_add( &_pruned_bytes[reason], (uint64_t)region.size() );
+}
+
+bool RegionFilter::select( const MemoryMap& region ) {
+  string name = region.name();
+
+  if( region.isReadable() == false ){
+    prune( PRUNED_UNREADABLE, region );
+    return false;
+  }
+  // reading device memory fails or has side effects, ashmem is where the
+  // heaps of Android apps are.
+  else if( ( name.compare( 0, 5, "/dev/" ) == 0 && name.compare( 0, 11, "/dev/ashmem" ) != 0 && name != "/dev/zero" ) || name.compare( 0, 5, "[vvar" ) == 0 ){
+    prune( PRUNED_DEVICE, region );
+    return false;
+  }
+  else if( matches(region) == false ){
+    prune( PRUNED_FILTER, region );
+    return false;
+  }
+
+  __sync_fetch_and_add( &_selected, 1 );
+  __sync_fetch_and_add( &_selected_bytes, (uint64_t)region.size() );
+  return true;
+}
+
+void RegionFilter::stats() const {
+  size_t regions = 0;
+  uint64_t bytes = 0;
+
+  for( int i = 0; i < PRUNED_REASONS; ++i ){
+    regions += _pruned[i];
+    bytes   += _pruned_bytes[i];
+  }
+
+  printf( "Selected %u regions ( %llu KB ), pruned %u regions ( %llu KB ) before reading : %u unreadable ( %llu KB ), %u devices ( %llu KB ), %u filtered out ( %llu KB ).\n",
+          _selected, (unsigned long long)( _selected_bytes / 1024 ),
+          regions, (unsigned long long)( bytes / 1024 ),
+          _pruned[PRUNED_UNREADABLE], (unsigned long long)( _pruned_bytes[PRUNED_UNREADABLE] / 1024 ),
+          _pruned[PRUNED_DEVICE], (unsigned long long)( _pruned_bytes[PRUNED_DEVICE] / 1024 ),
+          _pruned[PRUNED_FILTER], (unsigned long long)( _pruned_bytes[PRUNED_FILTER] / 1024 ) );
+}
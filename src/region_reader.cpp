@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "region_reader.h"
+#include <algorithm>
+
+RegionReader::RegionReader( Tracer *tracer, size_t overlap /* = 0 */, size_t chunk /* = REGION_READER_CHUNK_SIZE */, Allocator *allocator /* = NULL */ ) :
+  _tracer(tracer),
+  _allocator( allocator ? allocator : HeapAllocator::instance() ),
+  _chunk(chunk),
+  _overlap(overlap),
+  _buffer(NULL),
+  _begin(0),
+  _next(0),
+  _end(0),
+  _size(0),
+  _unreadable(0),
+  _tail(false) {
+
+  // the chunk must be word aligned and bigger than the overlap
+  while( _chunk <= _overlap ){
+    _chunk *= 2;
+  }
+  _chunk -= _chunk % sizeof(long);
+
+  _buffer = (unsigned char *)_allocator->allocate( _overlap + _chunk );
+}
+
+RegionReader::~RegionReader() {
+  if( _buffer ){
+    _allocator->release( _buffer, _overlap + _chunk );
+  }
+}
+
+void RegionReader::reset( uintptr_t begin, uintptr_t end ) {
+  _begin = begin;
+  _next  = begin;
+  _end   = end;
+  _size  = 0;
+  _unreadable = 0;
+  _tail  = false;
+  _holes.clear();
+}
+
+bool RegionReader::next( uintptr_t& address, const unsigned char *& data, size_t& size ) {
+  _tail = false;
+
+  while( _buffer && _next < _end ){
+    size_t toread = std::min( _chunk, (size_t)(_end - _next) ),
+           keep   = std::min( _overlap, _size );
+
+    // carry the tail of the previous chunk over
+    if( keep ){
+      memmove( _buffer, _buffer + _size - keep, keep );
+    }
+
+    size_t got = _tracer->salvage( _next, _buffer + keep, toread, &_pages );
+
+    _unreadable += toread - got;
+
+    if( got == 0 ){
+      // nothing to look at here, the next chunk starts from scratch
+      _next += toread;
+      _size  = 0;
+
+      // but what the previous one left for us is still to be scanned
+      if( keep ){
+        address = _next - toread - keep;
+        data    = _buffer;
+        size    = keep;
+        _tail   = true;
+        return true;
+      }
+
+      _holes.clear();
+      continue;
+    }
+
+    address = _next - keep;
+
+    // forget the holes which are not in the buffer anymore
+    size_t gone = 0;
+    while( gone < _holes.size() && _holes[gone].second <= address ){
+      ++gone;
+    }
+    _holes.erase( _holes.begin(), _holes.begin() + gone );
+
+    uintptr_t base = _next & ~( TRACER_PAGE_SIZE - 1 );
+    for( size_t i = 0; got != toread && i < _pages.size(); ++i ){
+      if( _pages[i] == false ){
+        uintptr_t from = std::max( base + i * TRACER_PAGE_SIZE, _next ),
+                  to   = std::min( base + ( i + 1 ) * TRACER_PAGE_SIZE, _next + toread );
+
+        if( _holes.empty() == false && _holes.back().second == from ){
+          _holes.back().second = to;
+        }
+        else {
+          _holes.push_back( Hole( from, to ) );
+        }
+      }
+    }
+
+    data    = _buffer;
+    size    = _size = keep + toread;
+    _next  += toread;
+
+    return true;
+  }
+
+  return false;
+}
+
+size_t RegionReader::readable( uintptr_t address, size_t size ) const {
+  uintptr_t end = address + size;
+
+  for( vector<Hole>::const_iterator i = _holes.begin(), e = _holes.end(); i != e; ++i ){
+    if( i->first < end && i->second > address ){
+      return i->first > address ? i->first - address : 0;
+    }
+  }
+
+  return size;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/mman.h>
+#include <algorithm>
+
+#include "remote_arena.h"
+
+static inline size_t align( size_t size ) {
+  return ( size + ARENA_ALIGNMENT - 1 ) & ~( ARENA_ALIGNMENT - 1 );
+}
+
+RemoteArena::RemoteArena( Tracer *tracer, size_t size /* = ARENA_DEFAULT_SIZE */ ) :
+  _tracer(tracer),
+  _size( align( size ? size : ARENA_DEFAULT_SIZE ) ),
+  _base(0),
+  _top(0),
+  _end(0),
+  _remote_calls(0) {
+
+}
+
+RemoteArena::~RemoteArena() {
+  if( _chunks.empty() || _tracer->isAttached() == false ){
+    return;
+  }
+
+  for( Blocks::iterator i = _chunks.begin(), e = _chunks.end(); i != e; ++i ){
+    _tracer->unmapMemory( i->first, i->second );
+  }
+}
+
+bool RemoteArena::reserve( size_t size ) {
+  // whole pages, zero filled by the kernel
+  size_t chunk = ( std::max( _size, size ) + TRACER_PAGE_SIZE - 1 ) & ~( TRACER_PAGE_SIZE - 1 );
+  uintptr_t base = _tracer->mapMemory( chunk, PROT_READ | PROT_WRITE );
+
+  ++_remote_calls;
+
+  if( base == 0 ){
+    fprintf( stderr, "Could not reserve %u bytes in the remote process.\n", chunk );
+    return false;
+  }
+
+  // whatever is left of the previous chunk can still be used
+  if( _top < _end ){
+    _free[_top] = _end - _top;
+  }
+
+  _chunks[base] = chunk;
+  _base = base;
+  _top = base;
+  _end = base + chunk;
+
+  return true;
+}
+
+uintptr_t RemoteArena::chunkOf( uintptr_t address ) const {
+  Blocks::const_iterator i = _chunks.upper_bound( address );
+  return i == _chunks.begin() ? 0 : (--i)->first;
+}
+
+uintptr_t RemoteArena::alloc( size_t size ) {
+  uintptr_t address = 0;
+
+  size = align( size ? size : 1 );
+
+  // first fit from the free list
+  for( Blocks::iterator i = _free.begin(), e = _free.end(); i != e; ++i ){
+    if( i->second >= size ){
+      address = i->first;
+      if( i->second > size ){
+        _free[address + size] = i->second - size;
+      }
+      _free.erase(i);
+      break;
+    }
+  }
+
+  if( address == 0 ){
+    if( _end - _top < size && reserve( size ) == false ){
+      return 0;
+    }
+    address = _top;
+    _top += size;
+  }
+
+  _used[address] = size;
+
+  return address;
+}
+
+void RemoteArena::free( uintptr_t address ) {
+  Blocks::iterator used = _used.find( address );
+  if( used == _used.end() ){
+    fprintf( stderr, "WARNING: %p was not allocated by the arena.\n", (void *)address );
+    return;
+  }
+
+  uintptr_t chunk = chunkOf( address );
+  size_t size = used->second;
+
+  _used.erase( used );
+
+  Blocks::iterator i = _free.insert( std::make_pair( address, size ) ).first;
+
+  // merge with the following free range
+  Blocks::iterator next = i;
+  ++next;
+  if( next != _free.end() && i->first + i->second == next->first && chunkOf( next->first ) == chunk ){
+    i->second += next->second;
+    _free.erase( next );
+  }
+
+  // and with the previous one
+  if( i != _free.begin() ){
+    Blocks::iterator prev = i;
+    --prev;
+    if( prev->first + prev->second == i->first && chunkOf( prev->first ) == chunk ){
+      prev->second += i->second;
+      _free.erase( i );
+      i = prev;
+    }
+  }
+
+  // give it back to the bump pointer if it ends where the bump pointer is
+  if( i->first + i->second == _top && i->first >= _base ){
+    _top = i->first;
+    _free.erase( i );
+  }
+}
+
+uintptr_t RemoteArena::copy( const void *data, size_t size ) {
+  uintptr_t address = alloc( size );
+
+  if( address && _tracer->write( address, (unsigned char *)data, size ) == false ){
+    free( address );
+    return 0;
+  }
+
+  return address;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "search.h"
+#include <algorithm>
+
+Searcher::Searcher( Matcher *matcher ) :
+  _matcher(matcher) {
+
+}
+
+class MatchCollector : public MatchSink {
+private:
+
+  Matches& _matches;
+
+public:
+
+  MatchCollector( Matches& matches ) : _matches(matches) {
+
+  }
+
+  virtual bool match( const MemoryMap& region, uintptr_t offset, size_t length, const unsigned char *context, size_t size ) {
+    Match match;
+
+    match.offset = offset;
+    match.length = length;
+    match.context.assign( context, context + size );
+
+    _matches.push_back(match);
+    return true;
+  }
+};
+
+bool Searcher::scan( RegionReader& reader, const MemoryMap& region, Matches& matches ) const {
+  MatchCollector collector( matches );
+  return scan( reader, region, collector );
+}
+
+bool Searcher::scan( RegionReader& reader, const MemoryMap& region, MatchSink& sink ) const {
+  uintptr_t address = 0, resume = region.begin();
+  const unsigned char *data = NULL;
+  size_t size = 0, start = 0, length = 0;
+
+  reader.reset( region.begin(), region.end() );
+
+  while( reader.next( address, data, size ) ){
+    // matches starting in the tail of a chunk are reported with the next
+    // one, where they're followed by their whole context.
+    size_t limit = reader.last() ? size : size - std::min( size, reader.overlap() ),
+           from  = resume > address ? resume - address : 0;
+
+    _matcher->reset();
+
+    while( from < limit && _matcher->find( data, size, from, start, length ) && start < limit ){
+      // zero filled pages which could not be read don't match anything
+      if( reader.readable( address + start, length ) < length ){
+        from = start + 1;
+        continue;
+      }
+
+      size_t context = std::min( std::max( length, (size_t)SEARCH_CONTEXT_SIZE ), size - start );
+
+      context = std::max( length, reader.readable( address + start, context ) );
+
+      if( sink.match( region, address + start - region.begin(), length, data + start, context ) == false ){
+        return true;
+      }
+
+      from = _matcher->overlapping() ? start + 1 : start + length;
+    }
+
+    resume = address + from;
+  }
+
+  return !reader.failed();
+}
+
+MultiSearch::MultiSearch( const vector<Process *>& targets, const Matcher *matcher, RegionFilter *filter, size_t jobs /* = SEARCH_DEFAULT_JOBS */ ) :
+  _matcher(matcher),
+  _filter(filter),
+  _jobs( jobs ? jobs : 1 ),
+  _next(0),
+  _shared_hits(0) {
+
+  pthread_mutex_init( &_lock, NULL );
+
+  _results.resize( targets.size() );
+  for( size_t i = 0; i < targets.size(); ++i ){
+    _results[i].process = targets[i];
+  }
+}
+
+MultiSearch::~MultiSearch() {
+  for( map<string, SharedRegion*>::iterator i = _shared.begin(), e = _shared.end(); i != e; ++i ){
+    delete i->second;
+  }
+  pthread_mutex_destroy( &_lock );
+}
+
+string MultiSearch::sharedKey( const MemoryMap& region ) {
+  char key[0xFF] = {0};
+
+  snprintf( key, sizeof(key), "%s:%u:%lx:%lx:%s",
+            region.device().c_str(),
+            region.inode(),
+            region.offset(),
+            region.size(),
+            region.permissions().c_str() );
+
+  return key;
+}
+
+MultiSearch::SharedRegion *MultiSearch::claimShared( const MemoryMap& region, bool& owner ) {
+  string key = sharedKey(region);
+  SharedRegion *shared = NULL;
+
+  pthread_mutex_lock( &_lock );
+
+  map<string, SharedRegion*>::iterator i = _shared.find(key);
+  if( i == _shared.end() ){
+    shared = _shared[key] = new SharedRegion();
+    owner  = true;
+  }
+  else {
+    shared = i->second;
+    owner  = false;
+    ++_shared_hits;
+  }
+
+  pthread_mutex_unlock( &_lock );
+
+  return shared;
+}
+
+void MultiSearch::searchTarget( const Searcher& searcher, TargetResult& target ) {
+  // ptrace requests must come from the thread which attached, so every
+  // target is handled from start to end by the same worker.
+  Tracer tracer( target.process, 0 );
+  if( tracer.isAttached() == false ){
+    return;
+  }
+
+  target.attached = true;
+  tracer.useFileCache( &_files );
+
+  RegionReader reader( &tracer, searcher.overlap() );
+
+  PROCESS_FOREACH_MAP_CONST( target.process ){
+    if( _filter->select(*i) == false ){
+      continue;
+    }
+
+    RegionHits hits;
+
+    hits.region = &(*i);
+
+    // read only file mappings are the same everywhere unless relocated or
+    // patched, like RELRO segments, which the pagemap tells apart
+    if( i->isFileBacked() && i->isWritable() == false && tracer.isPristine(*i) ){
+      bool owner = false;
+
+      hits.shared = claimShared( *i, owner );
+      if( owner ){
+        Matches matches;
+        bool ok = searcher.scan( reader, *i, matches );
+
+        pthread_mutex_lock( &_lock );
+        hits.shared->matches.swap(matches);
+        hits.shared->state = ok ? SHARED_DONE : SHARED_FAILED;
+        pthread_mutex_unlock( &_lock );
+      }
+    }
+    else {
+      hits.failed = !searcher.scan( reader, *i, hits.matches );
+    }
+
+    target.regions.push_back(hits);
+  }
+}
+
+void *MultiSearch::worker( void *arg ) {
+  MultiSearch *search = (MultiSearch *)arg;
+  Matcher *matcher = search->_matcher->clone();
+  Searcher searcher( matcher );
+
+  while(1) {
+    pthread_mutex_lock( &search->_lock );
+    size_t idx = search->_next++;
+    pthread_mutex_unlock( &search->_lock );
+
+    if( idx >= search->_results.size() ){
+      break;
+    }
+
+    search->searchTarget( searcher, search->_results[idx] );
+  }
+
+  delete matcher;
+  return NULL;
+}
+
+void MultiSearch::run() {
+  size_t nthreads = std::min( _jobs, _results.size() );
+  vector<pthread_t> threads( nthreads );
+
+  printf( "Searching %u processes using %u jobs ...\n\n", _results.size(), nthreads );
+
+  for( size_t i = 0; i < nthreads; ++i ){
+    if( pthread_create( &threads[i], NULL, MultiSearch::worker, this ) != 0 ){
+      perror("pthread_create");
+      nthreads = i;
+      break;
+    }
+  }
+
+  // the workers pull targets from a shared queue, so fewer of them ( even
+  // none, the caller doing it all ) still search every target.
+  if( nthreads == 0 ){
+    MultiSearch::worker(this);
+  }
+
+  for( size_t i = 0; i < nthreads; ++i ){
+    pthread_join( threads[i], NULL );
+  }
+}
+
+void MultiSearch::dump() const {
+  size_t total = 0;
+  // processes share most of their libraries, their symbols are loaded once
+  SymbolCache symbols;
+
+  for( vector<TargetResult>::const_iterator t = _results.begin(), te = _results.end(); t != te; ++t ){
+    if( t->attached == false ){
+      printf( "Process: %s ( pid=%d ) - could not attach.\n\n", t->process->name().c_str(), t->process->pid() );
+      continue;
+    }
+
+    size_t found = 0;
+    bool header = false;
+    Symbolizer symbolizer( t->process, &symbols );
+    vector<uintptr_t> addresses;
+    vector<Annotation> annotations;
+
+    for( vector<RegionHits>::const_iterator r = t->regions.begin(), re = t->regions.end(); r != re; ++r ){
+      const Matches& matches = r->shared ? r->shared->matches : r->matches;
+      bool failed = r->shared ? r->shared->state != SHARED_DONE : r->failed;
+
+      for( Matches::const_iterator m = matches.begin(), me = matches.end(); failed == false && m != me; ++m ){
+        addresses.push_back( r->region->begin() + m->offset );
+      }
+    }
+
+    symbolizer.annotate( addresses, annotations );
+
+    for( vector<RegionHits>::const_iterator r = t->regions.begin(), re = t->regions.end(); r != re; ++r ){
+      const Matches& matches = r->shared ? r->shared->matches : r->matches;
+      bool failed = r->shared ? r->shared->state != SHARED_DONE : r->failed;
+
+      if( failed == false && matches.empty() ){
+        continue;
+      }
+      else if( header == false ){
+        printf( "Process: %s ( pid=%d )\n\n", t->process->name().c_str(), t->process->pid() );
+        header = true;
+      }
+
+      if( failed ){
+        printf( "  Could not read %p-%p ( %s ).\n\n", r->region->begin(), r->region->end(), r->region->name().c_str() );
+        continue;
+      }
+
+      for( Matches::const_iterator m = matches.begin(), me = matches.end(); m != me; ++m ){
+        string where = annotations[found].str();
+
+        printf( "  Match @ offset %lu of %p-%p ( %s%s )%s%s:\n\n",
+                m->offset,
+                r->region->begin(),
+                r->region->end(),
+                r->region->name().c_str(),
+                r->shared ? ", shared" : "",
+                where.empty() ? "" : " at ",
+                where.c_str() );
+        dumphex( (unsigned char *)&m->context[0], r->region->begin() + m->offset, m->context.size(), "    " );
+        printf("\n");
+        ++found;
+      }
+    }
+
+    total += found;
+  }
+
+  printf( "%u matches, %u scans of shared regions avoided.\n", total, _shared_hits );
+  _files.stats();
+}
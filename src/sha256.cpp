@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) ( ( (x) >> (n) ) | ( (x) << ( 32 - (n) ) ) )
+
+SHA256::SHA256() : _length(0), _used(0) {
+  _state[0] = 0x6a09e667;
+  _state[1] = 0xbb67ae85;
+  _state[2] = 0x3c6ef372;
+  _state[3] = 0xa54ff53a;
+  _state[4] = 0x510e527f;
+  _state[5] = 0x9b05688c;
+  _state[6] = 0x1f83d9ab;
+  _state[7] = 0x5be0cd19;
+}
+
+void SHA256::transform( const unsigned char *block ) {
+  uint32_t w[64], a, b, c, d, e, f, g, h;
+
+  for( int i = 0; i < 16; ++i ){
+    w[i] = ( block[i * 4] << 24 ) | ( block[i * 4 + 1] << 16 ) | ( block[i * 4 + 2] << 8 ) | block[i * 4 + 3];
+  }
+
+  for( int i = 16; i < 64; ++i ){
+    uint32_t s0 = ROTR( w[i - 15], 7 ) ^ ROTR( w[i - 15], 18 ) ^ ( w[i - 15] >> 3 ),
+             s1 = ROTR( w[i - 2], 17 ) ^ ROTR( w[i - 2], 19 ) ^ ( w[i - 2] >> 10 );
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  a = _state[0]; b = _state[1]; c = _state[2]; d = _state[3];
+  e = _state[4]; f = _state[5]; g = _state[6]; h = _state[7];
+
+  for( int i = 0; i < 64; ++i ){
+    uint32_t s1 = ROTR( e, 6 ) ^ ROTR( e, 11 ) ^ ROTR( e, 25 ),
+             ch = ( e & f ) ^ ( ~e & g ),
+             t1 = h + s1 + ch + K[i] + w[i],
+             s0 = ROTR( a, 2 ) ^ ROTR( a, 13 ) ^ ROTR( a, 22 ),
+             mj = ( a & b ) ^ ( a & c ) ^ ( b & c ),
+             t2 = s0 + mj;
+
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  _state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+  _state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+}
+
+void SHA256::update( const unsigned char *data, size_t size ) {
+  _length += size;
+
+  if( _used ){
+    size_t n = 64 - _used < size ? 64 - _used : size;
+
+    memcpy( _buffer + _used, data, n );
+    _used += n;
+    data  += n;
+    size  -= n;
+
+    if( _used < 64 ){
+      return;
+    }
+
+    transform( _buffer );
+    _used = 0;
+  }
+
+  for( ; size >= 64; data += 64, size -= 64 ){
+    transform( data );
+  }
+
+  memcpy( _buffer, data, size );
+  _used = size;
+}
+
+void SHA256::final( unsigned char digest[SHA256_DIGEST_SIZE] ) {
+  uint64_t bits = _length * 8;
+  unsigned char pad[72] = { 0x80 };
+  size_t padlen = _used < 56 ? 56 - _used : 120 - _used;
+
+  for( int i = 0; i < 8; ++i ){
+    pad[padlen + i] = ( bits >> ( 56 - i * 8 ) ) & 0xff;
+  }
+
+  update( pad, padlen + 8 );
+
+  for( int i = 0; i < 8; ++i ){
+    digest[i * 4]     = ( _state[i] >> 24 ) & 0xff;
+    digest[i * 4 + 1] = ( _state[i] >> 16 ) & 0xff;
+    digest[i * 4 + 2] = ( _state[i] >> 8 ) & 0xff;
+    digest[i * 4 + 3] = _state[i] & 0xff;
+  }
+}
+
+string SHA256::hex( const unsigned char *data, size_t size ) {
+  static const char digits[] = "0123456789abcdef";
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  char out[SHA256_DIGEST_SIZE * 2 + 1] = {0};
+  SHA256 sha;
+
+  sha.update( data, size );
+  sha.final( digest );
+
+  for( int i = 0; i < SHA256_DIGEST_SIZE; ++i ){
+    out[i * 2]     = digits[ digest[i] >> 4 ];
+    out[i * 2 + 1] = digits[ digest[i] & 0xf ];
+  }
+
+  return out;
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+
+#include "string_scanner.h"
+#include "hash.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define EVEN_BITS 0x5555555555555555ULL
+
+static inline bool is_printable( unsigned char c ) {
+  return ( c >= 0x20 && c <= 0x7e ) || c == '\t';
+}
+
+#if defined(__ARM_NEON__)
+static inline uint16_t movemask( uint8x16_t v ) {
+  static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t bits = vandq_u8( v, vld1q_u8(weights) );
+  uint8x8_t sum = vpadd_u8( vget_low_u8(bits), vget_high_u8(bits) );
+
+  sum = vpadd_u8( sum, sum );
+  sum = vpadd_u8( sum, sum );
+
+  return vget_lane_u8( sum, 0 ) | ( vget_lane_u8( sum, 1 ) << 8 );
+}
+#endif
+
+// Classify 64 bytes at once, bit i of printable is set if p[i] is a
+// printable character, bit i of zero if p[i] is 0x00.
+static inline void classify( const unsigned char *p, uint64_t& printable, uint64_t& zero ) {
+#if defined(__ARM_NEON__)
+  const uint8x16_t lo = vdupq_n_u8(0x20), hi = vdupq_n_u8(0x7e), tab = vdupq_n_u8('\t'), nul = vdupq_n_u8(0x00);
+
+  printable = zero = 0;
+  for( int i = 0; i < 4; ++i ){
+    uint8x16_t v  = vld1q_u8( p + i * 16 ),
+               pr = vorrq_u8( vandq_u8( vcgeq_u8( v, lo ), vcleq_u8( v, hi ) ), vceqq_u8( v, tab ) );
+
+    printable |= (uint64_t)movemask(pr) << ( i * 16 );
+    zero      |= (uint64_t)movemask( vceqq_u8( v, nul ) ) << ( i * 16 );
+  }
+#else
+  printable = zero = 0;
+  for( int i = 0; i < 64; ++i ){
+    printable |= (uint64_t)is_printable(p[i]) << i;
+    zero      |= (uint64_t)( p[i] == 0x00 ) << i;
+  }
+#endif
+}
+
+StringSet::StringSet( size_t budget ) : _table(NULL), _mask(0), _used(0), _limit(0) {
+  size_t slots = 1024;
+
+  while( slots * 2 * sizeof(uint64_t) <= budget ){
+    slots *= 2;
+  }
+
+  _table = new uint64_t[slots];
+  _mask  = slots - 1;
+  // keep probe sequences short
+  _limit = slots / 4 * 3;
+
+  memset( _table, 0, slots * sizeof(uint64_t) );
+}
+
+StringSet::~StringSet() {
+  delete[] _table;
+}
+
+bool StringSet::insert( uint64_t hash ) {
+  // 0 marks empty slots
+  hash |= 1;
+
+  for( size_t i = hash & _mask; ; i = ( i + 1 ) & _mask ){
+    if( _table[i] == hash ){
+      return false;
+    }
+    else if( _table[i] == 0 ){
+      if( full() == false ){
+        _table[i] = hash;
+        ++_used;
+      }
+      return true;
+    }
+  }
+}
+
+StringScanner::StringScanner( size_t min_length /* = STRINGS_MIN_LENGTH */, size_t budget /* = 0 */, StringSink *sink /* = NULL */ ) :
+  _min( std::max( min_length, (size_t)1 ) ),
+  _sink(sink),
+  _unique(NULL),
+  _found(0),
+  _duplicates(0) {
+
+  if( budget ){
+    _unique = new StringSet( budget * 1024 * 1024 );
+  }
+}
+
+StringScanner::~StringScanner() {
+  delete _unique;
+}
+
+void StringScanner::emit( uintptr_t address, const MemoryMap& region, bool wide, const unsigned char *p, size_t length ) {
+  string s;
+
+  s.reserve(length);
+  for( size_t i = 0; i < length; ++i ){
+    s += (char)p[ wide ? i * 2 : i ];
+  }
+
+  if( _unique ){
+    const unsigned char *d = (const unsigned char *)s.data();
+    uint64_t h = ( (uint64_t)hash32( d, s.size(), 0 ) << 32 ) | hash32( d, s.size(), 0x9e3779b9 );
+
+    if( _unique->insert(h) == false ){
+      ++_duplicates;
+      return;
+    }
+  }
+
+  ++_found;
+  if( _sink ){
+    _sink->found( address, region, wide, s );
+    return;
+  }
+
+  printf( "%p %-7s %s %s\n", address, wide ? "utf16le" : "ascii", region.name().empty() ? "-" : region.name().c_str(), s.c_str() );
+}
+
+size_t StringScanner::scanAscii( const unsigned char *data, size_t size, size_t from, size_t limit, uintptr_t address, const MemoryMap& region ) {
+  size_t i = from, resume = limit;
+  uint64_t printable, zero;
+
+  while( i < limit ){
+    // skip blocks without printable characters
+    if( i + 64 <= size ){
+      classify( data + i, printable, zero );
+      if( printable == 0 ){
+        i += 64;
+        continue;
+      }
+      i += __builtin_ctzll(printable);
+    }
+    else if( is_printable( data[i] ) == false ){
+      ++i;
+      continue;
+    }
+
+    if( i >= limit ){
+      break;
+    }
+
+    size_t start = i, max = std::min( size, start + STRINGS_MAX_LENGTH );
+
+    while( i < max ){
+      if( i + 64 <= max ){
+        classify( data + i, printable, zero );
+        if( ~printable == 0 ){
+          i += 64;
+          continue;
+        }
+        i += __builtin_ctzll(~printable);
+        break;
+      }
+      else if( is_printable( data[i] ) ){
+        ++i;
+      }
+      else {
+        break;
+      }
+    }
+
+    if( i - start >= _min ){
+      emit( address + start, region, false, data + start, i - start );
+    }
+    resume = std::max( resume, i );
+  }
+
+  return resume;
+}
+
+size_t StringScanner::scanWide( const unsigned char *data, size_t size, size_t from, size_t limit, uintptr_t address, const MemoryMap& region ) {
+  // code units are 2 bytes aligned
+  size_t i = from + ( from & 1 ), resume = limit;
+  uint64_t printable, zero;
+
+  while( i < limit ){
+    if( i + 64 <= size ){
+      classify( data + i, printable, zero );
+      uint64_t wide = printable & ( zero >> 1 ) & EVEN_BITS;
+      if( wide == 0 ){
+        i += 64;
+        continue;
+      }
+      i += __builtin_ctzll(wide);
+    }
+    else if( i + 1 >= size || is_printable( data[i] ) == false || data[i + 1] != 0x00 ){
+      i += 2;
+      continue;
+    }
+
+    if( i >= limit ){
+      break;
+    }
+
+    size_t start = i, max = std::min( size - ( size - start ) % 2, start + STRINGS_MAX_LENGTH * 2 );
+
+    while( i < max && is_printable( data[i] ) && data[i + 1] == 0x00 ){
+      i += 2;
+    }
+
+    if( ( i - start ) / 2 >= _min ){
+      emit( address + start, region, true, data + start, ( i - start ) / 2 );
+    }
+    resume = std::max( resume, i );
+  }
+
+  return resume;
+}
+
+bool StringScanner::scan( RegionReader& reader, const MemoryMap& region ) {
+  uintptr_t address = 0, ascii = region.begin(), wide = region.begin();
+  const unsigned char *data = NULL;
+  size_t size = 0;
+
+  reader.reset( region.begin(), region.end() );
+
+  while( reader.next( address, data, size ) ){
+    // strings starting in the tail of the chunk are handled with the next
+    // one, those starting before it are handled here even if they cross it.
+    size_t limit = reader.last() ? size : size - std::min( size, reader.overlap() );
+
+    ascii = address + scanAscii( data, size, ascii > address ? ascii - address : 0, limit, address, region );
+    wide  = address + scanWide( data, size, wide > address ? wide - address : 0, limit, address, region );
+  }
+
+  return !reader.failed();
+}
+
+void StringScanner::stats() const {
+  printf( "\n%u strings", _found );
+  if( _unique ){
+    printf( ", %u duplicates%s", _duplicates, _unique->full() ? " ( dedup budget exhausted, some duplicates might be shown )" : "" );
+  }
+  printf( ".\n" );
+}
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <elf.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+
+#include "symbolizer.h"
+
+// ( address or virtual address, index of the caller's address )
+typedef std::pair<uintptr_t, size_t> Slot;
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static string module_name( const string& path ) {
+  size_t slash = path.rfind('/');
+  return slash == string::npos ? path : path.substr( slash + 1 );
+}
+
+ModuleSymbols::ModuleSymbols( const string& path ) :
+  _path(path),
+  _min_vaddr(0),
+  _loaded(false) {
+
+  int fd = open( path.c_str(), O_RDONLY );
+  if( fd == -1 ){
+    return;
+  }
+
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr)) ){
+    close(fd);
+    return;
+  }
+
+  size_t size = st.st_size;
+  const unsigned char *data = (const unsigned char *)mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close(fd);
+
+  if( data == MAP_FAILED ){
+    return;
+  }
+
+  const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)data;
+
+  // only modules of our own class, as we are built for the target
+  if( memcmp( ehdr->e_ident, ELFMAG, SELFMAG ) != 0 ||
+      ehdr->e_ident[EI_CLASS] != ( sizeof(long) == 8 ? ELFCLASS64 : ELFCLASS32 ) ||
+      ehdr->e_phoff + ehdr->e_phnum * sizeof(ElfW(Phdr)) > size ||
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) > size ){
+    munmap( (void *)data, size );
+    return;
+  }
+
+  const ElfW(Phdr) *phdr = (const ElfW(Phdr) *)( data + ehdr->e_phoff );
+  bool first = true;
+
+  for( int i = 0; i < ehdr->e_phnum; ++i ){
+    if( phdr[i].p_type == PT_LOAD && ( first || phdr[i].p_vaddr < _min_vaddr ) ){
+      _min_vaddr = phdr[i].p_vaddr;
+      first = false;
+    }
+  }
+
+  const ElfW(Shdr) *shdr = (const ElfW(Shdr) *)( data + ehdr->e_shoff );
+  bool symtab = false;
+
+  for( int i = 0; i < ehdr->e_shnum; ++i ){
+    symtab |= shdr[i].sh_type == SHT_SYMTAB;
+  }
+
+  for( int i = 0; i < ehdr->e_shnum; ++i ){
+    // .dynsym is a subset of .symtab when both are there
+    if( shdr[i].sh_type != ( symtab ? SHT_SYMTAB : SHT_DYNSYM ) || shdr[i].sh_link >= ehdr->e_shnum ){
+      continue;
+    }
+
+    const ElfW(Shdr) *strtab = &shdr[ shdr[i].sh_link ];
+    if( shdr[i].sh_offset + shdr[i].sh_size > size || strtab->sh_offset + strtab->sh_size > size ){
+      continue;
+    }
+
+    const ElfW(Sym) *sym = (const ElfW(Sym) *)( data + shdr[i].sh_offset ),
+                    *end = sym + shdr[i].sh_size / sizeof(ElfW(Sym));
+    const char *strings = (const char *)( data + strtab->sh_offset );
+
+    for( ; sym < end; ++sym ){
+      // st_info is laid out the same way in both classes
+      if( ( ELF32_ST_TYPE(sym->st_info) != STT_FUNC && ELF32_ST_TYPE(sym->st_info) != STT_OBJECT ) || sym->st_shndx == SHN_UNDEF || sym->st_value == 0 || sym->st_name >= strtab->sh_size ){
+        continue;
+      }
+
+      Symbol s;
+
+      // the lowest bit only flags Thumb functions
+      s.value = sym->st_value & ~(uintptr_t)1;
+      s.size  = sym->st_size;
+      s.name  = strings + sym->st_name;
+
+      _symbols.push_back(s);
+    }
+  }
+
+  munmap( (void *)data, size );
+
+  std::sort( _symbols.begin(), _symbols.end(), ModuleSymbols::less );
+  _loaded = true;
+}
+
+bool ModuleSymbols::less( const Symbol& a, const Symbol& b ) {
+  return a.value < b.value;
+}
+
+bool ModuleSymbols::find( uintptr_t vaddr, string& name, uintptr_t& offset ) const {
+  Symbol key;
+
+  key.value = vaddr;
+
+  // the last symbol starting at or before vaddr
+  vector<Symbol>::const_iterator i = std::upper_bound( _symbols.begin(), _symbols.end(), key, ModuleSymbols::less );
+  if( i == _symbols.begin() ){
+    return false;
+  }
+  --i;
+
+  // symbols without a size extend up to the next one
+  if( i->size && vaddr >= i->value + i->size ){
+    return false;
+  }
+
+  name   = i->name;
+  offset = vaddr - i->value;
+  return true;
+}
+
+SymbolCache::~SymbolCache() {
+  for( map<string, ModuleSymbols *>::iterator i = _modules.begin(), e = _modules.end(); i != e; ++i ){
+    delete i->second;
+  }
+}
+
+ModuleSymbols *SymbolCache::get( const MemoryMap& region ) {
+  char key[0xFF] = {0};
+
+  // the same path might be a different file in another process
+  snprintf( key, sizeof(key), "%s:%lu", region.name().c_str(), (unsigned long)region.inode() );
+
+  map<string, ModuleSymbols *>::iterator i = _modules.find(key);
+  if( i != _modules.end() ){
+    return i->second;
+  }
+
+  // opening ashmem and other devices would have side effects
+  ModuleSymbols *symbols = new ModuleSymbols( region.name().compare( 0, 5, "/dev/" ) == 0 ? "" : region.name() );
+  _modules[key] = symbols;
+  return symbols;
+}
+
+size_t SymbolCache::loaded( size_t& symbols ) const {
+  size_t loaded = 0;
+
+  symbols = 0;
+  for( map<string, ModuleSymbols *>::const_iterator i = _modules.begin(), e = _modules.end(); i != e; ++i ){
+    if( i->second->loaded() ){
+      ++loaded;
+      symbols += i->second->size();
+    }
+  }
+
+  return loaded;
+}
+
+string Annotation::str() const {
+  char buffer[0xFF] = {0};
+
+  if( module.empty() ){
+    return "";
+  }
+  else if( symbol.empty() ){
+    snprintf( buffer, sizeof(buffer), "%s+0x%lx", module.c_str(), (unsigned long)offset );
+  }
+  else {
+    snprintf( buffer, sizeof(buffer), "%s+0x%lx ( %s+0x%lx )", module.c_str(), (unsigned long)offset, symbol.c_str(), (unsigned long)delta );
+  }
+
+  return buffer;
+}
+
+Symbolizer::Symbolizer( Process *process, SymbolCache *symbols /* = NULL */ ) :
+  _process(process),
+  _symbols( symbols ? symbols : new SymbolCache() ),
+  _owned( symbols == NULL ),
+  _annotated(0),
+  _joined(0),
+  _annotate_time(0) {
+
+}
+
+Symbolizer::~Symbolizer() {
+  if( _owned ){
+    delete _symbols;
+  }
+}
+
+uintptr_t Symbolizer::base( const MemoryMap *region ) const {
+  uintptr_t base = region->begin() - region->offset();
+
+  PROCESS_FOREACH_MAP_CONST( _process ){
+    if( i->inode() == region->inode() && i->name() == region->name() && i->offset() == 0 ){
+      base = i->begin();
+      break;
+    }
+  }
+
+  return base;
+}
+
+const string& Symbolizer::resolve( uintptr_t address ) {
+  map<uintptr_t, string>::iterator cached = _cache.find(address);
+  if( cached != _cache.end() ){
+    return cached->second;
+  }
+
+  string& out = _cache[address];
+  char buffer[0xFF] = {0};
+  const MemoryMap *region = _process->findRegion(address);
+
+  if( region == NULL || region->name().empty() ){
+    sprintf( buffer, "[unknown]`0x%lx", (unsigned long)address );
+    out = buffer;
+    return out;
+  }
+
+  string module = module_name( region->name() );
+
+  ModuleSymbols *symbols = region->isFileBacked() ? _symbols->get(*region) : NULL;
+  uintptr_t load = base(region),
+            vaddr = ( address & ~(uintptr_t)1 ) - load + ( symbols ? ( symbols->minVaddr() & ~( 4096 - 1 ) ) : 0 );
+  string name;
+  uintptr_t offset = 0;
+
+  // functions, not addresses, so that samples of the same function merge
+  if( symbols && symbols->find( vaddr, name, offset ) ){
+    out = module + "`" + name;
+  }
+  else {
+    sprintf( buffer, "`0x%lx", (unsigned long)vaddr );
+    out = module + buffer;
+  }
+
+  return out;
+}
+
+void Symbolizer::annotate( const vector<uintptr_t>& addresses, vector<Annotation>& annotations ) {
+  double start = now();
+  const vector<MemoryMap>& regions = _process->memory();
+  vector<Slot> sorted( addresses.size() );
+  map<string, uintptr_t> bases;
+  // module -> ( virtual address, index ), in address order
+  map<ModuleSymbols *, vector<Slot> > joins;
+
+  annotations.assign( addresses.size(), Annotation() );
+
+  for( size_t i = 0; i < addresses.size(); ++i ){
+    sorted[i] = Slot( addresses[i], i );
+  }
+  std::sort( sorted.begin(), sorted.end() );
+
+  PROCESS_FOREACH_MAP_CONST( _process ){
+    if( i->isFileBacked() && i->offset() == 0 && bases.count( i->name() ) == 0 ){
+      bases[ i->name() ] = i->begin();
+    }
+  }
+
+  // regions are sorted by address too, both lists are walked once
+  size_t r = 0;
+  for( vector<Slot>::const_iterator a = sorted.begin(), e = sorted.end(); a != e; ++a ){
+    while( r < regions.size() && regions[r].end() <= a->first ){
+      ++r;
+    }
+
+    if( r == regions.size() ){
+      break;
+    }
+    else if( regions[r].begin() > a->first || regions[r].isFileBacked() == false ){
+      continue;
+    }
+
+    const MemoryMap& region = regions[r];
+    map<string, uintptr_t>::const_iterator base = bases.find( region.name() );
+    Annotation& out = annotations[ a->second ];
+
+    out.module = module_name( region.name() );
+    out.offset = a->first - ( base != bases.end() ? base->second : region.begin() - region.offset() );
+
+    ModuleSymbols *symbols = _symbols->get( region );
+    if( symbols->size() ){
+      joins[symbols].push_back( Slot( out.offset + ( symbols->minVaddr() & ~( 4096 - 1 ) ), a->second ) );
+    }
+  }
+
+  for( map<ModuleSymbols *, vector<Slot> >::iterator j = joins.begin(), je = joins.end(); j != je; ++j ){
+    const ModuleSymbols *symbols = j->first;
+    vector<Slot>& slots = j->second;
+    size_t s = 0;
+
+    // only out of order if the module segments were mapped out of order
+    for( size_t i = 1; i < slots.size(); ++i ){
+      if( slots[i].first < slots[i - 1].first ){
+        std::sort( slots.begin(), slots.end() );
+        break;
+      }
+    }
+
+    for( vector<Slot>::const_iterator i = slots.begin(), e = slots.end(); i != e; ++i ){
+      while( s + 1 < symbols->size() && symbols->symbol( s + 1 ).value <= i->first ){
+        ++s;
+      }
+
+      const ModuleSymbols::Symbol& symbol = symbols->symbol(s);
+      if( symbol.value <= i->first ){
+        annotations[ i->second ].symbol = symbol.name;
+        annotations[ i->second ].delta  = i->first - symbol.value;
+      }
+    }
+
+    _joined += slots.size() + s + 1;
+  }
+
+  _annotated     += addresses.size();
+  _annotate_time += now() - start;
+}
+
+void Symbolizer::stats() const {
+  size_t symbols = 0, loaded = _symbols->loaded( symbols );
+
+  if( _cache.size() ){
+    printf( "%u addresses resolved with %u symbols from %u of %u modules.\n", _cache.size(), symbols, loaded, _symbols->size() );
+  }
+  if( _annotated ){
+    printf( "%u addresses annotated in %.2f ms, %u merge steps with %u symbols from %u of %u modules.\n",
+            _annotated, _annotate_time * 1000.0, _joined, symbols, loaded, _symbols->size() );
+  }
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <pthread.h>
+#include <set>
+#include <algorithm>
+
+#include "thread_dump.h"
+
+// older NDK headers lack these
+#ifndef PTRACE_SEIZE
+#define PTRACE_SEIZE      0x4206
+#endif
+#ifndef PTRACE_INTERRUPT
+#define PTRACE_INTERRUPT  0x4207
+#endif
+#ifndef PTRACE_EVENT_STOP
+#define PTRACE_EVENT_STOP 128
+#endif
+
+// threads created while seizing are picked up by listing the tasks again
+#define THREADS_SEIZE_ROUNDS 8
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *register_names[] = {
+  "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+  "r8", "r9", "r10", "r11", "r12", "sp", "lr", "pc"
+};
+
+ThreadDump::ThreadDump( Process *process, size_t window /* = THREADS_STACK_WINDOW */, size_t jobs /* = THREADS_DEFAULT_JOBS */ ) :
+  _process(process),
+  _window( window ? window : THREADS_STACK_WINDOW ),
+  _jobs( jobs ? jobs : 1 ),
+  _reader(NULL),
+  _next(0),
+  _released(false),
+  _seize_time(0),
+  _regs_time(0),
+  _stack_time(0) {
+
+  // stacks are read by many threads only if we don't have to go through
+  // ptrace, which is bound to the thread that seized.
+  if( Tracer::canReadWithoutStopping() ){
+    _reader = new Tracer( _process, TRACER_NOSTOP );
+  }
+  else {
+    _jobs = 1;
+  }
+}
+
+ThreadDump::~ThreadDump() {
+  if( _released == false ){
+    release();
+  }
+  delete _reader;
+}
+
+bool ThreadDump::seizeAll() {
+  double start = now();
+  std::set<pid_t> known;
+
+  for( int round = 0; round < THREADS_SEIZE_ROUNDS; ++round ){
+    vector<pid_t> tids;
+    size_t first = _threads.size();
+
+    if( _process->threads(tids) == false ){
+      break;
+    }
+
+    for( vector<pid_t>::iterator i = tids.begin(), e = tids.end(); i != e; ++i ){
+      if( known.insert(*i).second ){
+        ThreadState thread;
+
+        thread.tid = *i;
+        thread.seized = ptrace( PTRACE_SEIZE, *i, 0, 0 ) == 0;
+        if( thread.seized == false && errno != ESRCH ){
+          perror("PTRACE_SEIZE");
+        }
+        _threads.push_back(thread);
+      }
+    }
+
+    if( first == _threads.size() ){
+      break;
+    }
+
+    // nothing else between two interrupts, to keep the skew small
+    for( size_t i = first; i < _threads.size(); ++i ){
+      if( _threads[i].seized ){
+        _threads[i].interrupted = now();
+        ptrace( PTRACE_INTERRUPT, _threads[i].tid, 0, 0 );
+      }
+    }
+  }
+
+  bool stopped = false;
+
+  for( vector<ThreadState>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->seized ){
+      waitStop(*i);
+      stopped |= i->stopped;
+    }
+  }
+
+  _seize_time = now() - start;
+
+  return stopped;
+}
+
+void ThreadDump::waitStop( ThreadState& thread ) {
+  int status = 0;
+
+  while(1) {
+    pid_t pid = waitpid( thread.tid, &status, __WALL );
+    if( pid == -1 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      thread.seized = false;
+      return;
+    }
+    else if( WIFEXITED(status) || WIFSIGNALED(status) ){
+      thread.seized = false;
+      return;
+    }
+    else if( WIFSTOPPED(status) ){
+      thread.stopped    = true;
+      thread.stopped_at = now();
+      // a signal got there before the interrupt, don't swallow it
+      if( ( status >> 16 ) != PTRACE_EVENT_STOP ){
+        thread.signal = WSTOPSIG(status);
+      }
+      return;
+    }
+  }
+}
+
+void ThreadDump::readStack( ThreadState& thread ) {
+  if( thread.stack.empty() ){
+    return;
+  }
+  else if( _reader ){
+    thread.stack_ok = _reader->read( thread.stack_begin, &thread.stack[0], thread.stack.size() );
+    return;
+  }
+
+  long *words = (long *)&thread.stack[0];
+  size_t n = thread.stack.size() / sizeof(long);
+
+  thread.stack_ok = true;
+  for( size_t i = 0; i < n; ++i ){
+    errno = 0;
+    words[i] = ptrace( PTRACE_PEEKDATA, thread.tid, (void *)( thread.stack_begin + i * sizeof(long) ), 0 );
+    if( errno ){
+      thread.stack_ok = false;
+      return;
+    }
+  }
+}
+
+void *ThreadDump::worker( void *arg ) {
+  ThreadDump *dump = (ThreadDump *)arg;
+
+  while(1) {
+    size_t idx = __sync_fetch_and_add( &dump->_next, 1 );
+    if( idx >= dump->_threads.size() ){
+      break;
+    }
+    dump->readStack( dump->_threads[idx] );
+  }
+
+  return NULL;
+}
+
+void ThreadDump::release() {
+  for( vector<ThreadState>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->seized ){
+      ptrace( PTRACE_DETACH, i->tid, 0, (void *)(uintptr_t)i->signal );
+      i->released = now();
+    }
+  }
+  _released = true;
+}
+
+bool ThreadDump::run() {
+  if( seizeAll() == false ){
+    fprintf( stderr, "Could not stop any thread of process %d.\n", _process->pid() );
+    release();
+    return false;
+  }
+
+  double start = now();
+
+  for( vector<ThreadState>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->stopped == false ){
+      continue;
+    }
+
+    i->has_regs = ptrace( PTRACE_GETREGS, i->tid, 0, &i->regs ) == 0;
+    if( i->has_regs == false ){
+      continue;
+    }
+
+    // the window is clipped to the end of the stack mapping
+    uintptr_t sp = i->regs.ARM_sp & ~( sizeof(long) - 1 ),
+              end = sp + _window;
+    const MemoryMap *region = _process->findRegion(sp);
+
+    if( region && region->end() < end ){
+      end = region->end();
+    }
+
+    i->stack_begin = sp;
+    i->stack.resize( end - sp );
+  }
+
+  _regs_time = now() - start;
+  start = now();
+
+  size_t nthreads = std::min( _jobs, _threads.size() );
+  vector<pthread_t> threads;
+
+  for( size_t i = 1; i < nthreads; ++i ){
+    pthread_t tid;
+    if( pthread_create( &tid, NULL, ThreadDump::worker, this ) != 0 ){
+      perror("pthread_create");
+      break;
+    }
+    threads.push_back(tid);
+  }
+
+  // this thread reads as well, and it's the only one when using ptrace.
+  worker(this);
+
+  for( size_t i = 0; i < threads.size(); ++i ){
+    pthread_join( threads[i], NULL );
+  }
+
+  _stack_time = now() - start;
+
+  release();
+
+  // names are read once threads are running again
+  for( vector<ThreadState>::iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    char path[0xFF] = {0}, name[0xFF] = {0};
+
+    sprintf( path, "/proc/%d/task/%d/comm", _process->pid(), i->tid );
+
+    FILE *fp = fopen( path, "rt" );
+    if( fp ){
+      if( fgets( name, sizeof(name), fp ) ){
+        char *p = strrchr( name, '\n' );
+        if( p ){
+          *p = 0x00;
+        }
+        i->name = name;
+      }
+      fclose(fp);
+    }
+  }
+
+  return true;
+}
+
+void ThreadDump::dump() const {
+  for( vector<ThreadState>::const_iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->stopped == false ){
+      printf( "Thread %d ( %s ) : could not be stopped.\n\n", i->tid, i->name.c_str() );
+      continue;
+    }
+
+    printf( "Thread %d ( %s ) : stopped for %.3f ms", i->tid, i->name.c_str(), ( i->released - i->interrupted ) * 1000.0 );
+    if( i->signal ){
+      printf( ", signal %d pending", i->signal );
+    }
+    printf( ".\n\n" );
+
+    if( i->has_regs == false ){
+      printf( "  Could not read registers.\n\n" );
+      continue;
+    }
+
+    for( int r = 0; r < 16; ++r ){
+      printf( "  %-4s %08lx", register_names[r], (unsigned long)i->regs.uregs[r] );
+      if( r % 4 == 3 ){
+        printf( "\n" );
+      }
+    }
+    printf( "  cpsr %08lx\n\n", (unsigned long)i->regs.ARM_cpsr );
+
+    const MemoryMap *region = _process->findRegion( i->stack_begin );
+
+    if( i->stack_ok ){
+      printf( "  Stack @ %p ( %s ) :\n\n", i->stack_begin, region ? region->name().c_str() : "?" );
+      dumphex( (unsigned char *)&i->stack[0], i->stack_begin, i->stack.size(), "  " );
+      printf( "\n" );
+    }
+    else {
+      printf( "  Could not read the stack @ %p.\n\n", i->stack_begin );
+    }
+  }
+}
+
+void ThreadDump::stats() const {
+  size_t stopped = 0, bytes = 0;
+  double first_stop = 0, last_stop = 0, first_release = 0, longest = 0;
+
+  for( vector<ThreadState>::const_iterator i = _threads.begin(), e = _threads.end(); i != e; ++i ){
+    if( i->stopped == false ){
+      continue;
+    }
+
+    if( stopped++ == 0 ){
+      first_stop = last_stop = i->stopped_at;
+      first_release = i->released;
+    }
+
+    first_stop    = std::min( first_stop, i->stopped_at );
+    last_stop     = std::max( last_stop, i->stopped_at );
+    first_release = std::min( first_release, i->released );
+    longest       = std::max( longest, i->released - i->interrupted );
+
+    if( i->stack_ok ){
+      bytes += i->stack.size();
+    }
+  }
+
+  printf( "%u of %u threads stopped in %.3f ms ( %.3f ms between the first and the last ), registers read in %.3f ms, %u KB of stacks read in %.3f ms by %u jobs.\n",
+          stopped,
+          _threads.size(),
+          _seize_time * 1000.0,
+          ( last_stop - first_stop ) * 1000.0,
+          _regs_time * 1000.0,
+          bytes / 1024,
+          _stack_time * 1000.0,
+          std::min( _jobs, _threads.size() ) );
+
+  printf( "All threads were stopped together for %.3f ms, none for longer than %.3f ms.\n",
+          ( first_release - last_stop ) * 1000.0,
+          longest * 1000.0 );
+}
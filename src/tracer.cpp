@@ -28,11 +28,85 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <algorithm>
 
 #include "tracer.h"
+#include "remote_arena.h"
+#include "dump_pipeline.h"
 
 #define CPSR_T_MASK ( 1u << 5 )
 
+#define SVC_ARM   0xef000000
+#define SVC_THUMB 0xdf00
+
+// older NDK headers lack these
+#ifndef __NR_process_vm_readv
+#define __NR_process_vm_readv 376
+#endif
+#ifndef __NR_process_vm_writev
+#define __NR_process_vm_writev 377
+#endif
+#ifndef __NR_memfd_create
+#define __NR_memfd_create 385
+#endif
+#ifndef __NR_mmap2
+#define __NR_mmap2 192
+#endif
+#ifndef PTRACE_O_TRACESYSGOOD
+#define PTRACE_O_TRACESYSGOOD 1
+#endif
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ssize_t process_vm_readv_( pid_t pid, const struct iovec *local, unsigned long liovcnt, const struct iovec *remote, unsigned long riovcnt, unsigned long flags ) {
+  return syscall( __NR_process_vm_readv, pid, local, liovcnt, remote, riovcnt, flags );
+}
+
+static ssize_t process_vm_writev_( pid_t pid, const struct iovec *local, unsigned long liovcnt, const struct iovec *remote, unsigned long riovcnt, unsigned long flags ) {
+  return syscall( __NR_process_vm_writev, pid, local, liovcnt, remote, riovcnt, flags );
+}
+
+bool Tracer::canReadWithoutStopping() {
+  static int supported = -1;
+
+  if( supported == -1 ){
+    // probe the syscall reading from ourselves
+    char src = 0x42, dst = 0;
+    struct iovec local = { &dst, 1 }, remote = { &src, 1 };
+
+    supported = process_vm_readv_( getpid(), &local, 1, &remote, 1, 0 ) == 1;
+  }
+
+  return supported == 1;
+}
+
+bool Tracer::canWriteWithoutStopping() {
+  static int supported = -1;
+
+  if( supported == -1 ){
+    char src = 0x42, dst = 0;
+    struct iovec local = { &src, 1 }, remote = { &dst, 1 };
+
+    supported = process_vm_writev_( getpid(), &local, 1, &remote, 1, 0 ) == 1;
+  }
+
+  return supported == 1;
+}
+
 long Tracer::trace( int request, void *addr /* = 0 */, void *data /* = 0 */ ) {
   long ret = ptrace( request, _process->pid(), (caddr_t)addr, data );
   if( ret == -1 && (errno == EBUSY || errno == EFAULT || errno == ESRCH) ){
@@ -42,10 +116,12 @@ long Tracer::trace( int request, void *addr /* = 0 */, void *data /* = 0 */ ) {
   return ret;
 }
 
-bool Tracer::attach() {
+bool Tracer::attach( bool wait ) {
   if( trace( PTRACE_ATTACH ) != -1 ){
     int status;
-    waitpid( _process->pid(), &status, 0 );
+    if( wait ){
+      waitpid( _process->pid(), &status, 0 );
+    }
     return true;
   }
   else {
@@ -54,66 +130,435 @@ bool Tracer::attach() {
   }
 }
 
+bool Tracer::resume( int sig /* = 0 */ ) {
+  // a signal arriving during a remote call is delivered on its registers,
+  // otherwise the process goes on from where it was.
+  if( _calling == false ){
+    restoreRegisters();
+    _saved = false;
+  }
+  return trace( PTRACE_CONT, 0, (void *)(uintptr_t)sig ) != -1;
+}
+
+bool Tracer::interrupt() {
+  // tgkill rather than kill, a SIGSTOP taken by any other thread would stop
+  // the whole group.
+  return ::syscall( __NR_tgkill, _process->pid(), _process->pid(), SIGSTOP ) == 0;
+}
+
 void Tracer::detach() {
+  restoreRegisters();
   trace( PTRACE_DETACH );
 }
 
 bool Tracer::read( size_t addr, unsigned char *buf, size_t blen ) {
-  size_t i = 0;
-  long *d, ret;
+  if( blen == 0 ){
+    return true;
+  }
+  else if( isBad( addr, blen ) ){
+    return false;
+  }
 
-  d = (long*)buf;
-  blen /= sizeof(long);
+  if( canReadWithoutStopping() ){
+    struct iovec local = { buf, blen }, remote = { (void *)addr, blen };
 
-  for( i = 0; i < blen; ++i, addr += sizeof(long) ) {
-    ret = trace( PTRACE_PEEKDATA, (void *)addr );
+    if( process_vm_readv_( _process->pid(), &local, 1, &remote, 1, 0 ) == (ssize_t)blen ){
+      return true;
+    }
+    // PTRACE_PEEKDATA can still read some mappings process_vm_readv can't.
+    else if( _attached == false ){
+      return false;
+    }
+  }
+
+  return peek( addr, buf, blen );
+}
+
+bool Tracer::peek( size_t addr, unsigned char *buf, size_t blen ) {
+  for( size_t done = 0; done < blen; done += sizeof(long), addr += sizeof(long) ) {
+    // PEEKDATA returns the word, only errno tells -1 from a failure.
+    errno = 0;
+    long ret = trace( PTRACE_PEEKDATA, (void *)addr );
     if(errno) {
       return false;
     }
-    d[i] = ret;
+    // the last word might be partial
+    memcpy( buf + done, &ret, std::min( sizeof(long), blen - done ) );
   }
 
   return true;
 }
 
-bool Tracer::write( size_t addr, unsigned char *buf, size_t blen) {
-  size_t i = 0;
-  long ret;
+bool Tracer::isBad( uintptr_t addr, size_t blen ) {
+  bool bad = false;
+
+  pthread_mutex_lock( &_bad_lock );
+  if( _bad.empty() == false ){
+    // the last range starting before the end of ours
+    map<uintptr_t, uintptr_t>::iterator i = _bad.lower_bound( addr + blen );
+    if( i != _bad.begin() ){
+      --i;
+      bad = i->second > addr;
+    }
+  }
+  pthread_mutex_unlock( &_bad_lock );
+
+  return bad;
+}
+
+void Tracer::setBad( uintptr_t begin, uintptr_t end ) {
+  pthread_mutex_lock( &_bad_lock );
+
+  // another thread might have found it already
+  map<uintptr_t, uintptr_t>::iterator prev = _bad.lower_bound(end);
+  if( prev != _bad.begin() && (--prev)->second > begin ){
+    pthread_mutex_unlock( &_bad_lock );
+    return;
+  }
+
+  _bad_bytes += end - begin;
+
+  // merge with the ranges right before and after
+  map<uintptr_t, uintptr_t>::iterator next = _bad.find(end);
+  if( next != _bad.end() ){
+    end = next->second;
+    _bad.erase(next);
+  }
+
+  prev = _bad.lower_bound(begin);
+  if( prev != _bad.begin() && (--prev)->second == begin ){
+    prev->second = end;
+  }
+  else {
+    _bad[begin] = end;
+  }
+
+  pthread_mutex_unlock( &_bad_lock );
+}
+
+void Tracer::forgetUnreadable() {
+  pthread_mutex_lock( &_bad_lock );
+  _bad.clear();
+  _bad_bytes = 0;
+  pthread_mutex_unlock( &_bad_lock );
+}
+
+size_t Tracer::unreadable() {
+  pthread_mutex_lock( &_bad_lock );
+  size_t bytes = _bad_bytes;
+  pthread_mutex_unlock( &_bad_lock );
+  return bytes;
+}
 
-  // make sure the buffer is word aligned
-  char *ptr = (char *)calloc(blen + blen % sizeof(size_t), 1);
-  memcpy(ptr, buf, blen);
+bool Tracer::openPagemap() {
+  char procfile[0xFF] = {0};
 
-  for( i = 0; i < blen; i += sizeof(size_t) ){
-    ret = trace( PTRACE_POKETEXT, (void *)(addr + i), (void *)*(size_t *)&ptr[i] );
-    if( ret == -1 ) {
-      ::free(ptr);
+  if( _pagemap_fd == -1 ){
+    sprintf( procfile, "/proc/%d/pagemap", _process->pid() );
+    _pagemap_fd = open( procfile, O_RDONLY );
+  }
+
+  return _pagemap_fd != -1;
+}
+
+bool Tracer::useFileCache( FileCache *files ) {
+  _files = openPagemap() ? files : NULL;
+  return _files != NULL;
+}
+
+bool Tracer::isPristine( const MemoryMap& region ) {
+  if( region.isFileBacked() == false || openPagemap() == false ){
+    return false;
+  }
+
+  uint64_t entries[512];
+  size_t npages = region.size() / TRACER_PAGE_SIZE;
+
+  for( size_t done = 0; done < npages; ){
+    size_t count = std::min( npages - done, sizeof(entries) / sizeof(entries[0]) );
+    off64_t at = (off64_t)( region.begin() / TRACER_PAGE_SIZE + done ) * sizeof(uint64_t);
+
+    if( pread64( _pagemap_fd, entries, count * sizeof(uint64_t), at ) != (ssize_t)( count * sizeof(uint64_t) ) ){
       return false;
     }
+
+    // the FileCache::clean rule, past the end of the file every process
+    // fails alike
+    for( size_t i = 0; i < count; ++i ){
+      if( ( entries[i] & PAGEMAP_PRESENT ) ? ( entries[i] & PAGEMAP_FILE ) == 0 : ( entries[i] & PAGEMAP_SWAPPED ) != 0 ){
+        return false;
+      }
+    }
+
+    done += count;
+  }
+
+  return true;
+}
+
+size_t Tracer::salvage( size_t addr, unsigned char *buf, size_t blen, vector<bool> *readable /* = NULL */ ) {
+  uintptr_t base = addr & ~( TRACER_PAGE_SIZE - 1 ), end = addr + blen;
+  size_t done = 0;
+
+  if( readable ){
+    readable->assign( ( addr + blen - base + TRACER_PAGE_SIZE - 1 ) / TRACER_PAGE_SIZE, true );
+  }
+
+  if( _files == NULL ){
+    return salvageRange( addr, buf, blen, base, readable );
+  }
+
+  // file backed regions separately, everything else as usual
+  while( addr < end ){
+    const MemoryMap *region = _process->findRegion(addr);
+    size_t len = region ? std::min( end, region->end() ) - addr : end - addr;
+
+    done += region ? salvageFile( *region, addr, buf, len, base, readable ) : salvageRange( addr, buf, len, base, readable );
+    addr += len;
+    buf  += len;
+  }
+
+  return done;
+}
+
+// Pages still identical to the file, according to the pagemap, are copied
+// from the file cache and the others read from the process, both in runs
+// as long as possible.
+size_t Tracer::salvageFile( const MemoryMap& region, uintptr_t addr, unsigned char *buf, size_t blen, uintptr_t base, vector<bool> *readable ) {
+  size_t size = 0;
+  const unsigned char *file = _files->get( region, size );
+
+  if( file == NULL ){
+    return salvageRange( addr, buf, blen, base, readable );
+  }
+
+  uintptr_t first = addr & ~( TRACER_PAGE_SIZE - 1 ), end = addr + blen;
+  size_t npages = ( end - first + TRACER_PAGE_SIZE - 1 ) / TRACER_PAGE_SIZE;
+  vector<uint64_t> entries( npages );
+  off64_t at = (off64_t)( first / TRACER_PAGE_SIZE ) * sizeof(uint64_t);
+
+  if( pread64( _pagemap_fd, &entries[0], npages * sizeof(uint64_t), at ) != (ssize_t)( npages * sizeof(uint64_t) ) ){
+    return salvageRange( addr, buf, blen, base, readable );
+  }
+
+  size_t done = 0, from_file = 0, from_process = 0;
+  uintptr_t run = addr;
+  bool run_clean = FileCache::clean( region, first, entries[0], size );
+
+  for( size_t p = 1; p <= npages; ++p ){
+    uintptr_t page = first + p * TRACER_PAGE_SIZE;
+    bool clean = p < npages && FileCache::clean( region, page, entries[p], size );
+
+    if( p < npages && clean == run_clean ){
+      continue;
+    }
+
+    uintptr_t stop = std::min( page, end );
+    size_t len = stop - run;
+
+    if( run_clean ){
+      memcpy( buf + ( run - addr ), file + region.offset() + ( run - region.begin() ), len );
+      from_file += len;
+      done += len;
+    }
+    else {
+      size_t got = salvageRange( run, buf + ( run - addr ), len, base, readable );
+      from_process += got;
+      done += got;
+    }
+
+    run = stop;
+    run_clean = clean;
+  }
+
+  _files->account( from_file, from_process );
+
+  return done;
+}
+
+size_t Tracer::salvageRange( uintptr_t addr, unsigned char *buf, size_t blen, uintptr_t base, vector<bool> *readable ) {
+  if( blen == 0 ){
+    return 0;
+  }
+  else if( read( addr, buf, blen ) ){
+    return blen;
+  }
+
+  uintptr_t first = addr & ~( TRACER_PAGE_SIZE - 1 ),
+            last  = ( addr + blen - 1 ) & ~( TRACER_PAGE_SIZE - 1 );
+
+  if( first == last ){
+    memset( buf, 0x00, blen );
+    if( readable ){
+      (*readable)[ ( first - base ) / TRACER_PAGE_SIZE ] = false;
+    }
+    setBad( first, first + TRACER_PAGE_SIZE );
+    return 0;
+  }
+
+  // split on the page boundary closest to the middle
+  uintptr_t middle = first + ( ( last - first ) / TRACER_PAGE_SIZE + 1 ) / 2 * TRACER_PAGE_SIZE;
+  size_t left = middle - addr;
+
+  return salvageRange( addr, buf, left, base, readable ) +
+         salvageRange( middle, buf + left, blen - left, base, readable );
+}
+
+bool Tracer::write( size_t addr, unsigned char *buf, size_t blen ) {
+  if( blen == 0 ){
+    return true;
+  }
+
+  // fails on read only mappings
+  if( canWriteWithoutStopping() ){
+    struct iovec local = { buf, blen }, remote = { (void *)addr, blen };
+
+    if( process_vm_writev_( _process->pid(), &local, 1, &remote, 1, 0 ) == (ssize_t)blen ){
+      return true;
+    }
+  }
+
+  // /proc/<pid>/mem writes go through read only pages ( code ) as well.
+  if( _mem_fd == -1 ){
+    char procfile[0xFF] = {0};
+
+    sprintf( procfile, "/proc/%u/mem", _process->pid() );
+    _mem_fd = open( procfile, O_RDWR );
   }
 
-  ::free(ptr);
+  if( _mem_fd != -1 && pwrite64( _mem_fd, buf, blen, (off64_t)addr ) == (ssize_t)blen ){
+    return true;
+  }
+
+  return poke( addr, buf, blen );
+}
+
+bool Tracer::poke( size_t addr, unsigned char *buf, size_t blen ) {
+  size_t word  = sizeof(long),
+         start = addr & ~( word - 1 ),
+         end   = ( addr + blen + word - 1 ) & ~( word - 1 );
+
+  for( size_t a = start; a < end; a += word ){
+    size_t lo = std::max( addr, a ) - a,
+           hi = std::min( addr + blen, a + word ) - a;
+    long data = 0;
+
+    // partial words must preserve the bytes around the buffer
+    if( lo != 0 || hi != word ){
+      errno = 0;
+      data = trace( PTRACE_PEEKDATA, (void *)a );
+      if( errno ){
+        return false;
+      }
+    }
+
+    memcpy( (unsigned char *)&data + lo, buf + ( a + lo - addr ), hi - lo );
+
+    if( trace( PTRACE_POKETEXT, (void *)a, (void *)data ) == -1 ){
+      return false;
+    }
+  }
 
   return true;
 }
 
-uintptr_t Tracer::call( uintptr_t function, int nargs, ... ) {
-  int i = 0;
-  struct pt_regs regs = {{0}}, rbackup = {{0}};
+size_t Tracer::writev( const struct iovec *local, const struct iovec *remote, size_t count ) {
+  size_t done = 0;
 
-  // get registers and backup them
-  if( trace( PTRACE_GETREGS, 0, &regs ) < 0 ){
-    perror("PTRACE_GETREGS 1");
-    return -1;
+  while( canWriteWithoutStopping() && done < count ){
+    size_t batch = std::min( count - done, (size_t)TRACER_IOV_MAX ), expected = 0;
+    ssize_t written = process_vm_writev_( _process->pid(), local + done, batch, remote + done, batch, 0 );
+
+    for( size_t i = done; i < done + batch; ++i ){
+      expected += remote[i].iov_len;
+    }
+
+    if( written == (ssize_t)expected ){
+      done += batch;
+      continue;
+    }
+
+    // the kernel stops at the first failing remote vector, skip those that
+    // made it and let the caller retry the rest one by one.
+    for( ; written > 0 && (size_t)written >= remote[done].iov_len; ++done ){
+      written -= remote[done].iov_len;
+    }
+    break;
   }
 
-  memcpy( &rbackup, &regs, sizeof(struct pt_regs) );
+  return done;
+}
 
-  va_list vl;
-  va_start(vl,nargs);
+bool Tracer::saveRegisters() {
+  if( _saved ){
+    return true;
+  }
+
+  ++_transfers;
+  if( trace( PTRACE_GETREGS, 0, &_backup ) < 0 ){
+    perror("PTRACE_GETREGS");
+    return false;
+  }
+
+  _saved = true;
+  _dirty = false;
+  return true;
+}
+
+bool Tracer::setRegisters( struct pt_regs& regs ) {
+  ++_transfers;
+  if( trace( PTRACE_SETREGS, 0, &regs ) < 0 ){
+    perror("PTRACE_SETREGS");
+    return false;
+  }
+
+  _dirty = true;
+  return true;
+}
+
+bool Tracer::restoreRegisters() {
+  if( _saved == false || _dirty == false ){
+    return true;
+  }
+
+  ++_transfers;
+  if( trace( PTRACE_SETREGS, 0, &_backup ) < 0 ){
+    perror("PTRACE_SETREGS");
+    return false;
+  }
+
+  _dirty = false;
+  return true;
+}
+
+bool Tracer::readResult( uintptr_t& ret ) {
+  ++_transfers;
+  // R0 holds the return value, PEEKUSER returns it so only errno tells -1
+  // from a failure.
+  errno = 0;
+  long r0 = trace( PTRACE_PEEKUSER, 0 );
+  if( errno ){
+    perror("PTRACE_PEEKUSER");
+    return false;
+  }
+
+  ret = (uintptr_t)r0;
+  return true;
+}
+
+bool Tracer::beginCall( uintptr_t function, int nargs, const uintptr_t *args ) {
+  int i = 0;
+  struct pt_regs regs;
+
+  // registers are saved once for all the calls
+  if( saveRegisters() == false ){
+    return false;
+  }
+
+  memcpy( &regs, &_backup, sizeof(struct pt_regs) );
 
   for( i = 0; i < nargs; ++i ){
-    uintptr_t arg = va_arg( vl, uintptr_t );
+    uintptr_t arg = args[i];
 
     // fill R0-R3 with the first 4 arguments
     if( i < 4 ){
@@ -126,8 +571,6 @@ uintptr_t Tracer::call( uintptr_t function, int nargs, ... ) {
     }
   }
 
-  va_end(vl);
-
   regs.ARM_lr = 0;
   regs.ARM_pc = function;
   // setup the current processor status register
@@ -142,39 +585,276 @@ uintptr_t Tracer::call( uintptr_t function, int nargs, ... ) {
   }
 
   // do the call
-  if( trace( PTRACE_SETREGS, 0, &regs ) < 0 ){
-    perror("PTRACE_SETREGS");
-    return -1;
+  if( setRegisters( regs ) == false ){
+    return false;
   }
 
   if( trace( PTRACE_CONT ) < 0 ){
     perror("PTRACE_CONT");
+    return false;
+  }
+
+  _calling = true;
+  return true;
+}
+
+bool Tracer::endCall( uintptr_t& ret ) {
+  _calling = false;
+  // the original registers are put back by resume() or detach()
+  return readResult( ret );
+}
+
+uintptr_t Tracer::call( uintptr_t function, int nargs, ... ) {
+  vector<uintptr_t> args;
+  uintptr_t ret = -1;
+
+  va_list vl;
+  va_start(vl,nargs);
+  for( int i = 0; i < nargs; ++i ){
+    args.push_back( va_arg( vl, uintptr_t ) );
+  }
+  va_end(vl);
+
+  if( beginCall( function, nargs, args.empty() ? NULL : &args[0] ) == false ){
     return -1;
   }
 
+  // the function returns to address 0 and the process stops with SIGSEGV
   waitpid( _process->pid(), NULL, WUNTRACED );
 
-  // get registers again, R0 holds the return value
-  if( trace( PTRACE_GETREGS, 0, &regs ) < 0 ){
-    perror("PTRACE_GETREGS 2");
+  if( endCall( ret ) == false ){
     return -1;
   }
 
-  // restore original registers state
-  if( trace( PTRACE_SETREGS, 0, &rbackup ) < 0 ){
-    perror("PTRACE_SETREGS");
+  return ret;
+}
+
+// An svc instruction of our own libc, the same address in the libc of the
+// process once relocated by findSymbol.
+static uintptr_t local_svc() {
+  Process *self = Process::open( getpid() );
+  uintptr_t found = 0;
+
+  const MemoryMap *libc = self ? self->findRegion( (uintptr_t)::calloc ) : NULL;
+  if( libc && libc->isExecutable() && libc->isReadable() ){
+    for( uintptr_t a = ( libc->begin() + 3 ) & ~3u; a + 4 <= libc->end(); a += 4 ){
+      if( *(const uint32_t *)a == SVC_ARM ){
+        found = a;
+        break;
+      }
+    }
+  }
+
+  delete self;
+  return found;
+}
+
+long Tracer::syscall( int number, int nargs, ... ) {
+  struct pt_regs regs;
+  uintptr_t ret = (uintptr_t)-ESRCH;
+  int status = 0, stops = 0;
+
+  // symbols set from a cache may lack the svc, look it up here; never
+  // plant one, libc text is shared with threads we did not stop
+  if( _symbols._syscall == 0 ){
+    uintptr_t svc = local_svc();
+    _symbols._syscall = svc ? _process->findSymbol(svc) : 0;
+    if( _symbols._syscall == 0 ){
+      return -ENOSYS;
+    }
+  }
+
+  if( saveRegisters() == false ){
+    return -ESRCH;
+  }
+
+  if( _sysgood == false ){
+    _sysgood = trace( PTRACE_SETOPTIONS, 0, (void *)PTRACE_O_TRACESYSGOOD ) != -1;
+  }
+
+  memcpy( &regs, &_backup, sizeof(struct pt_regs) );
+
+  va_list vl;
+  va_start(vl,nargs);
+  for( int i = 0; i < nargs && i < 6; ++i ){
+    regs.uregs[i] = va_arg( vl, uintptr_t );
+  }
+  va_end(vl);
+
+  regs.ARM_r7    = number;
+  regs.ARM_pc    = _symbols._syscall;
+  regs.ARM_cpsr &= ~CPSR_T_MASK;
+
+  if( setRegisters( regs ) ){
+    int trap = _sysgood ? ( SIGTRAP | 0x80 ) : SIGTRAP;
+
+    // stops on entry and on exit, other signals are delivered meanwhile
+    _calling = true;
+    for( int sig = 0; stops < 2; ){
+      if( trace( PTRACE_SYSCALL, 0, (void *)(uintptr_t)sig ) == -1 ||
+          waitpid( _process->pid(), &status, __WALL ) == -1 ||
+          WIFSTOPPED(status) == false ){
+        break;
+      }
+
+      sig = WSTOPSIG(status);
+      if( sig == trap ){
+        ++stops;
+        sig = 0;
+      }
+    }
+    _calling = false;
+
+    if( stops < 2 || readResult( ret ) == false ){
+      ret = (uintptr_t)-ESRCH;
+    }
+  }
+
+  ++_syscalls;
+
+  return (long)ret;
+}
+
+uintptr_t Tracer::mapMemory( size_t size, int prot ) {
+  long ret = syscall( __NR_mmap2, 6, 0, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  // errors are the last page of the address space
+  return (unsigned long)ret > -4096UL ? 0 : (uintptr_t)ret;
+}
+
+bool Tracer::unmapMemory( uintptr_t address, size_t size ) {
+  return syscall( __NR_munmap, 2, address, size ) == 0;
+}
+
+bool Tracer::protectMemory( uintptr_t address, size_t size, int prot ) {
+  return syscall( __NR_mprotect, 3, address, size, prot ) == 0;
+}
+
+int Tracer::createMemfd( const char *name, unsigned int flags /* = 0 */ ) {
+  uintptr_t remote = writeString( name );
+  if( remote == 0 ){
     return -1;
   }
 
-  return regs.ARM_r0;
+  long fd = syscall( __NR_memfd_create, 2, remote, flags );
+
+  arena()->free( remote );
+
+  return fd < 0 ? -1 : (int)fd;
 }
 
-Tracer::Tracer( Process* process ) : _process(process) {
-  // attach to process
-  if( attach() == false ){
-    perror("ptrace");
-    FATAL( "Could not attach to process.\n" );
+bool Tracer::inLibraries( uintptr_t address ) {
+  const MemoryMap *region = _process->findRegion( address );
+  if( region == NULL ){
+    return false;
+  }
+
+  // dlopen runs in the linker whatever library exports it
+  const string& name = region->name();
+  size_t slash = name.rfind('/');
+  if( name.compare( slash == string::npos ? 0 : slash + 1, 6, "linker" ) == 0 ){
+    return true;
+  }
+
+  uintptr_t functions[] = { _symbols._dlopen, _symbols._dlsym, _symbols._dlerror, _symbols._calloc, _symbols._free };
+
+  for( size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i ){
+    const MemoryMap *library = functions[i] ? _process->findRegion( functions[i] ) : NULL;
+    if( library && library->name() == name ){
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Tracer::atSafePoint() {
+  if( saveRegisters() == false ){
+    return false;
+  }
+
+  uintptr_t pc = _backup.ARM_pc;
+
+  if( inLibraries( pc ) == false ){
+    return true;
+  }
+
+  // blocked in a syscall: the pc is right after the svc, or on it if the
+  // syscall is going to be restarted.
+  bool blocked = false;
+  if( _backup.ARM_cpsr & CPSR_T_MASK ){
+    uint16_t code[2] = {0};
+    blocked = read( pc - 2, (unsigned char *)code, sizeof(code) ) && ( code[0] == SVC_THUMB || code[1] == SVC_THUMB );
+  }
+  else {
+    uint32_t code[2] = {0};
+    blocked = read( pc - 4, (unsigned char *)code, sizeof(code) ) && ( code[0] == SVC_ARM || code[1] == SVC_ARM );
+  }
+
+  if( blocked == false ){
+    return false;
+  }
+
+  // a futex wait inside malloc is blocked too, only trust the calls which
+  // take no lock: in their stub, or the stub returning into their wrapper
+  uintptr_t lr = _backup.ARM_lr & ~1u;
+  for( int i = 0; i < TRACER_BLOCKING_FUNCTIONS; ++i ){
+    uintptr_t function = _symbols._blocking[i] & ~1u;
+    if( function == 0 ){
+      continue;
+    }
+    else if( pc >= function && pc - function <= TRACER_STUB_SIZE ){
+      return true;
+    }
+    else if( lr >= function && lr - function <= TRACER_WRAPPER_SIZE ){
+      return true;
+    }
   }
+
+  return false;
+}
+
+bool Tracer::safePoint( double timeout /* = TRACER_SAFEPOINT_TIMEOUT */ ) {
+  double deadline = now() + timeout;
+
+  // no single stepping on ARM, sample where the process is instead
+  while( atSafePoint() == false ){
+    if( now() >= deadline || resume() == false ){
+      return false;
+    }
+
+    usleep( TRACER_SAFEPOINT_SLICE );
+    interrupt();
+
+    // wait for our SIGSTOP, delivering whatever comes before it
+    for(;;){
+      int status = 0;
+      if( waitpid( _process->pid(), &status, __WALL ) == -1 || WIFSTOPPED(status) == false ){
+        return false;
+      }
+      else if( WSTOPSIG(status) == SIGSTOP ){
+        break;
+      }
+      resume( WSTOPSIG(status) );
+    }
+  }
+
+  return true;
+}
+
+Tracer::Tracer( Process* process, int flags /* = 0 */ ) : _process(process), _attached(false), _nostop(false), _mem_fd(-1), _pagemap_fd(-1), _files(NULL), _arena(NULL), _saved(false), _dirty(false), _calling(false), _sysgood(false), _transfers(0), _syscalls(0), _bad_bytes(0) {
+  pthread_mutex_init( &_bad_lock, NULL );
+
+  if( (flags & TRACER_NOSTOP) && canReadWithoutStopping() ){
+    _nostop = true;
+    return;
+  }
+
+  // attach to process
+  _attached = attach( (flags & TRACER_ASYNC) == 0 );
+}
+
+void Tracer::setSymbols( const Symbols& symbols ) {
+  _symbols = symbols;
 }
 
 const Symbols *Tracer::getSymbols() {
@@ -185,22 +865,37 @@ const Symbols *Tracer::getSymbols() {
     _symbols._calloc  = _process->findSymbol((uintptr_t)::calloc);
     _symbols._free    = _process->findSymbol((uintptr_t)::free);
 
+    uintptr_t svc = local_svc();
+    _symbols._syscall = svc ? _process->findSymbol(svc) : 0;
+
+    // where threads of apps spend their time, binder included
+    uintptr_t blocking[TRACER_BLOCKING_FUNCTIONS] = {
+      (uintptr_t)::read, (uintptr_t)::write, (uintptr_t)::ioctl, (uintptr_t)::poll,
+      (uintptr_t)::select, (uintptr_t)::epoll_wait, (uintptr_t)::nanosleep,
+      (uintptr_t)::recvfrom, (uintptr_t)::recvmsg, (uintptr_t)::accept,
+      (uintptr_t)::waitpid, (uintptr_t)::sigsuspend
+    };
+    for( int i = 0; i < TRACER_BLOCKING_FUNCTIONS; ++i ){
+      _symbols._blocking[i] = _process->findSymbol( blocking[i] );
+    }
+
     if( _symbols.valid() == false ){
-      FATAL( "Could not resolve process symbols.\n" );
+      return NULL;
     }
   }
 
   return &_symbols;
 }
 
-uintptr_t Tracer::writeString( const char *s ) {
-  getSymbols();
-
-  uintptr_t mem = call( _symbols._calloc, 2, strlen(s) + 1, 1 );
-
-  write( mem, (unsigned char *)s, strlen(s) + 1 );
+RemoteArena *Tracer::arena() {
+  if( _arena == NULL ){
+    _arena = new RemoteArena( this );
+  }
+  return _arena;
+}
 
-  return mem;
+uintptr_t Tracer::writeString( const char *s ) {
+  return arena()->string( s );
 }
 
 bool Tracer::dumpRegion( uintptr_t address, const char *output ) {
@@ -212,34 +907,29 @@ bool Tracer::dumpRegion( uintptr_t address, const char *output ) {
   }
   printf( "Found 0x%08x in %s\n", address, mem->name().c_str() );
 
-  bool ok = false;
-  size_t toread = mem->size() - ( address - mem->begin() );
-  unsigned char *buffer = new unsigned char[ toread ];
-  // read memory region into buffer
-  if( read( address, buffer, toread ) ){
-    printf( "Dumping %ld bytes to '%s' ...\n", toread, output );
-    FILE *fp = fopen( output, "w+b" );
-    if( fp ){
-      fwrite( buffer, 1, toread, fp );
-      fclose(fp);
-      // we're running as root, we need to chmod the file in order to pull it.
-      chmod( output, 0755 );
-      ok = true;
-    }
-    else {
-      perror("fopen");
-      fprintf( stderr, "Failed to create dump file.\n" );
-    }
-  }
-  else {
-    perror("ptrace");
-    fprintf( stderr, "Could not read from process.\n" );
-  }
+  DumpPipeline pipeline( this );
+
+  pipeline.add( address, mem->end(), mem->name() );
+
+  printf( "Dumping %ld bytes to '%s' ...\n", mem->end() - address, output );
+
+  bool ok = pipeline.run( output );
+  pipeline.stats();
 
-  delete[] buffer;
   return ok;
 }
 
 Tracer::~Tracer() {
-  detach();
+  // the arena needs the process attached to release its memory
+  delete _arena;
+  pthread_mutex_destroy( &_bad_lock );
+  if( _mem_fd != -1 ){
+    close( _mem_fd );
+  }
+  if( _pagemap_fd != -1 ){
+    close( _pagemap_fd );
+  }
+  if( _attached ){
+    detach();
+  }
 }
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <algorithm>
+
+#include "watcher.h"
+#include "hash.h"
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+MemoryWatcher::MemoryWatcher( Process *process, uintptr_t address, size_t size, size_t block /* = WATCHER_DEFAULT_BLOCK */, unsigned int hz /* = WATCHER_DEFAULT_HZ */ ) :
+  _process(process),
+  _tracer(NULL),
+  _address(address),
+  _size(size),
+  _block( block ? block : WATCHER_DEFAULT_BLOCK ),
+  _hz( hz ? hz : WATCHER_DEFAULT_HZ ),
+  _current(NULL),
+  _previous(NULL) {
+
+  // without process_vm_readv we need to stop the process for every sample,
+  // but we can't keep it stopped the whole time or nothing would change.
+  if( Tracer::canReadWithoutStopping() ){
+    _tracer = new Tracer( _process, TRACER_NOSTOP );
+  }
+  else {
+    fprintf( stderr, "WARNING: process_vm_readv not supported, the process will be attached for every sample.\n" );
+  }
+
+  _current  = new unsigned char[ _size ];
+  _previous = new unsigned char[ _size ];
+  _hashes.resize( ( _size + _block - 1 ) / _block );
+}
+
+MemoryWatcher::~MemoryWatcher() {
+  delete _tracer;
+  delete[] _current;
+  delete[] _previous;
+}
+
+bool MemoryWatcher::sample( unsigned char *buffer ) {
+  if( _tracer ){
+    return _tracer->read( _address, buffer, _size );
+  }
+
+  Tracer tracer( _process );
+  return tracer.read( _address, buffer, _size );
+}
+
+void MemoryWatcher::report( double timestamp, size_t block ) const {
+  size_t begin = block * _block,
+         end   = std::min( begin + _block, _size );
+
+  // narrow down to the bytes which actually changed
+  while( begin < end && _current[begin] == _previous[begin] ){
+    ++begin;
+  }
+  while( end > begin && _current[end - 1] == _previous[end - 1] ){
+    --end;
+  }
+
+  printf( "[%12.6f] +0x%08x ( %p ) %u bytes changed:\n", timestamp, begin, _address + begin, end - begin );
+  dumphex( _previous + begin, _address + begin, end - begin, "  - " );
+  dumphex( _current + begin, _address + begin, end - begin, "  + " );
+}
+
+void MemoryWatcher::run( volatile sig_atomic_t *stop ) {
+  size_t nblocks = _hashes.size(),
+         samples = 0,
+         changed = 0,
+         overruns = 0;
+  double period = 1.0 / _hz,
+         busy = 0.0;
+
+  if( sample( _previous ) == false ){
+    perror("read");
+    fprintf( stderr, "Could not read %u bytes from %p.\n", _size, _address );
+    return;
+  }
+
+  for( size_t b = 0; b < nblocks; ++b ){
+    size_t off = b * _block;
+    _hashes[b] = hash32( _previous + off, std::min( _block, _size - off ) );
+  }
+
+  printf( "Watching %u bytes @ %p at %u Hz in %u blocks of %u bytes, hit CTRL+C to stop ...\n\n", _size, _address, _hz, nblocks, _block );
+
+  double start = now(), next = start + period;
+
+  while( *stop == 0 ){
+    double t = now();
+    if( t < next ){
+      struct timespec ts;
+      double wait = next - t;
+
+      ts.tv_sec  = (time_t)wait;
+      ts.tv_nsec = (long)( ( wait - ts.tv_sec ) * 1e9 );
+      nanosleep( &ts, NULL );
+    }
+    else if( t - next > period ){
+      // we're late, don't try to catch up with the missed samples
+      ++overruns;
+      next = t;
+    }
+    next += period;
+
+    t = now();
+    if( sample( _current ) == false ){
+      perror("read");
+      fprintf( stderr, "Could not read %u bytes from %p.\n", _size, _address );
+      break;
+    }
+
+    for( size_t b = 0; b < nblocks; ++b ){
+      size_t off = b * _block;
+      uint32_t h = hash32( _current + off, std::min( _block, _size - off ) );
+
+      if( h != _hashes[b] ){
+        _hashes[b] = h;
+        report( t - start, b );
+        ++changed;
+      }
+    }
+
+    std::swap( _current, _previous );
+    busy += now() - t;
+    ++samples;
+  }
+
+  double elapsed = now() - start;
+
+  printf( "\n%u samples in %.2fs ( %.1f Hz, %u overruns ), %.1f us per sample, %u changed blocks.\n",
+          samples,
+          elapsed,
+          samples / elapsed,
+          overruns,
+          samples ? busy * 1e6 / samples : 0.0,
+          changed );
+}